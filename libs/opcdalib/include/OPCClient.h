@@ -41,6 +41,7 @@ Boston, MA  02111-1307, USA.
 #include <stdexcept>
 #include "opcda.h"
 #include "OPCItemData.h"
+#include "OPCSampleBuffer.h"
 
 
 class COPCHost;
@@ -74,8 +75,38 @@ public:
 class IAsynchDataCallback
 {
 public:
-    virtual void OnDataChange(COPCGroup & group, CAtlMap<COPCItem *, OPCItemData *> & changes) = 0;
-    virtual ~IAsynchDataCallback();
+	virtual void OnDataChange(COPCGroup & group, CAtlMap<COPCItem *, OPCItemData *> & changes) = 0;
+
+	virtual ~IAsynchDataCallback(){}
+};
+
+
+
+/**
+* Allocation free alternative to IAsynchDataCallback. The group fills its own sample buffer in place
+* and samples.updated lists the client handles of the changed items. The buffer is reused for the next
+* callback, so the handler must copy what it wants to keep.
+*/
+class IAsynchSampleCallback
+{
+public:
+	virtual void OnDataChange(COPCGroup & group, COPCSampleBuffer & samples) = 0;
+
+	virtual ~IAsynchSampleCallback(){}
+};
+
+
+
+/**
+* Receives the IOPCShutdown::ShutdownRequest of a server, which asks its clients to release all references to it
+* before it goes away. Called on a COM thread, the handler must not release the server from within the callback.
+*/
+class IServerShutdownCallback
+{
+public:
+	virtual void OnShutdown(COPCServer & server, const std::string & reason) = 0;
+
+	virtual ~IServerShutdownCallback(){}
 };
 
 
@@ -25,6 +25,7 @@ Boston, MA  02111-1307, USA.
 #pragma once
 #endif // _MSC_VER > 1000
 #include "OPCClient.h"
+#include "OPCReadSet.h"
 #include "Transaction.h"
 
 
@@ -52,6 +53,14 @@ private:
 	ATL::CComPtr<IOPCAsyncIO2>		iAsych2IO;
 	ATL::CComPtr<IOPCItemMgt>		iItemManagement;
 
+	/**
+	* DA 3.0 interfaces, NULL if the server only implements DA 2.0
+	*/
+	ATL::CComPtr<IOPCGroupStateMgt2>	iStateManagement2;
+	ATL::CComPtr<IOPCSyncIO2>		iSychIO2;
+	ATL::CComPtr<IOPCItemDeadbandMgt>	iItemDeadbandManagement;
+	ATL::CComPtr<IOPCItemSamplingMgt>	iItemSamplingManagement;
+
 	/**
 	* Used to keep track of the connection point for the
 	* AsynchDataCallback
@@ -78,9 +87,16 @@ private:
 
 	/**
 	* list of OPC items associated with this goup. Not owned (at the moment!)
+	* The client handle of an item is its index in this table, slots of deleted items are NULL.
 	*/
 	std::vector<COPCItem *> items;
 
+	/**
+	* client handles of deleted items, given out again before the table grows so it stays as large as the most items
+	* the group ever held at once
+	*/
+	std::vector<OPCHANDLE> freeClientHandles;
+
 
 	/**
 	* Name of the group
@@ -101,11 +117,50 @@ private:
 	IAsynchDataCallback *userAsynchCBHandler;
 	CAsynchDataCallback* _CAsynchDataCallback;
 
+	/**
+	* Users handler for allocation free data change callbacks
+	* NOT OWNED.
+	*/
+	IAsynchSampleCallback *userAsynchSampleHandler;
+
+	/**
+	* filled in place by data change callbacks when userAsynchSampleHandler is set
+	*/
+	COPCSampleBuffer asynchSamples;
+
+	/**
+	* asynchronous transactions awaiting their completion callback, keyed on the transaction id given to the server
+	*/
+	CTransactionRegistry transactions;
+
+	/**
+	* connect our CAsynchDataCallback to the servers connection point
+	*/
+	void adviseDataCallback();
+
+	/**
+	* move the results of a synchronous read into samples and free them.
+	* readSet gives the client handle of each result by position, without it hClient of the result is used.
+	*/
+	void storeReadResults(DWORD noItems, OPCITEMSTATE *itemState, HRESULT *itemResult, COPCReadSet *readSet, COPCSampleBuffer &samples);
+
 	/**
 	* Caller owns returned array
 	*/
 	OPCHANDLE * buildServerHandleList(std::vector<COPCItem *>& items);
 
+	/**
+	* copy the per item results of a server call into errors, which has one entry per item, and free them.
+	* returns the number of failed items.
+	*/
+	int storeItemResults(HRESULT *itemResult, std::vector<HRESULT>& errors);
+
+	friend class COPCItem;
+	/**
+	* called by the item destructor, frees the items slot in the item table
+	*/
+	void releaseClientHandle(OPCHANDLE clientHandle);
+
 public:
 	COPCGroup(const std::string & groupName, bool active, unsigned long reqUpdateRate_ms, unsigned long &revisedUpdateRate_ms, float deadBand, COPCServer &server);
 
@@ -121,12 +176,39 @@ public:
 	int addItems(std::vector<std::string>& itemName, std::vector<COPCItem *>& itemsCreated, std::vector<HRESULT>& errors, bool active);
 
 
+	/**
+	* checks item ids with the server without adding them, errors[x] is the result for itemName[x].
+	* returns the number of invalid items.
+	*/
+	int validateItems(std::vector<std::string>& itemName, std::vector<HRESULT>& errors);
+
+
+	/**
+	* removes items from the server in one call and deletes them, errors[x] is the result for itemsToRemove[x].
+	* returns the number of items the server failed to remove. itemsToRemove is cleared, the items are deleted
+	* unless the call fails as a whole, which throws.
+	*/
+	int removeItems(std::vector<COPCItem *>& itemsToRemove, std::vector<HRESULT>& errors);
+
+
+	/**
+	* enable Asynch IO for transactions only, data changes of an active group are dropped
+	*/
+	void enableAsynch();
+
+
 	/**
 	* enable Asynch IO
 	*/
 	void enableAsynch(IAsynchDataCallback &handler);
 
 
+	/**
+	* enable Asynch IO, data changes are delivered through the groups sample buffer
+	*/
+	void enableAsynch(IAsynchSampleCallback &handler);
+
+
 	/**
 	* disable Asych IO 
 	*/
@@ -139,6 +221,67 @@ public:
 	void setState(DWORD reqUpdateRate_ms, DWORD &returnedUpdateRate_ms, float deadBand, BOOL active);
 
 
+	/**
+	* ask the server to send a data change callback at least every keepAlive_ms, with no items if nothing changed.
+	* 0 turns keep-alive off. revisedKeepAlive_ms receives the time the server granted.
+	* Returns false, and leaves keep-alive off, if the server does not implement IOPCGroupStateMgt2.
+	*/
+	bool setKeepAlive(DWORD keepAlive_ms, DWORD &revisedKeepAlive_ms);
+
+
+	bool supportsKeepAlive() const{
+		return iStateManagement2 != NULL;
+	}
+
+
+	/**
+	* DA 3.0 item deadbands, see setItemDeadbands
+	*/
+	bool supportsItemDeadband() const{
+		return iItemDeadbandManagement != NULL;
+	}
+
+
+	/**
+	* DA 3.0 item sampling rates and buffering, see setItemSamplingRates
+	*/
+	bool supportsItemSampling() const{
+		return iItemSamplingManagement != NULL;
+	}
+
+
+	/**
+	* DA 3.0 reads with a maximum age, see readSyncMaxAge
+	*/
+	bool supportsMaxAgeRead() const{
+		return iSychIO2 != NULL;
+	}
+
+
+	/**
+	* set a deadband per item in percent of its EU range, overriding the deadband of the group.
+	* errors[x] is the result for items[x], returns the number of failed items.
+	* Throws if the server does not implement IOPCItemDeadbandMgt.
+	*/
+	int setItemDeadbands(std::vector<COPCItem *>& items, std::vector<float>& percentDeadbands, std::vector<HRESULT>& errors);
+
+
+	/**
+	* set the rate the server samples each item at, independent of the update rate of the group.
+	* revisedRates_ms[x] receives the rate granted for items[x], returns the number of failed items.
+	* Throws if the server does not implement IOPCItemSamplingMgt.
+	*/
+	int setItemSamplingRates(std::vector<COPCItem *>& items, std::vector<DWORD>& samplingRates_ms, std::vector<DWORD>& revisedRates_ms, std::vector<HRESULT>& errors);
+
+
+	/**
+	* let the server buffer the samples it takes of an item between two updates of the group and send all of them.
+	* An IAsynchSampleCallback then gets one call per buffered value of an item. Returns the number of failed items.
+	* Throws if the server does not implement IOPCItemSamplingMgt.
+	*/
+	int setItemBufferEnable(std::vector<COPCItem *>& items, bool enable, std::vector<HRESULT>& errors);
+
+
 
 	/**
 	* Read set of OPC items synchronously.
@@ -146,12 +289,81 @@ public:
 	void readSync(std::vector<COPCItem *>& items, COPCItem_DataMap &opcData, OPCDATASOURCE source);
 
 
+	/**
+	* Read set of OPC items synchronously into a sample buffer, which is grown to the item table size if needed.
+	* Does not allocate once the buffer has been sized.
+	*/
+	void readSync(std::vector<COPCItem *>& items, COPCSampleBuffer &samples, OPCDATASOURCE source);
+
+
+	/**
+	* Prepare a set of items for repeated reads. Caller owns returned read set.
+	*/
+	COPCReadSet * prepareRead(std::vector<COPCItem *>& items);
+
+
+	/**
+	* Read a prepared set of OPC items synchronously into a sample buffer.
+	* Does not allocate once the buffer has been sized.
+	*/
+	void readSync(COPCReadSet &readSet, COPCSampleBuffer &samples, OPCDATASOURCE source);
+
+
+	/**
+	* Read a prepared set of OPC items synchronously with IOPCSyncIO2, the server returns a cached value if it is not
+	* older than maxAge_ms and reads the device otherwise. 0 always reads the device, 0xFFFFFFFF always the cache.
+	* Throws if the server does not implement IOPCSyncIO2.
+	*/
+	void readSyncMaxAge(COPCReadSet &readSet, DWORD maxAge_ms, COPCSampleBuffer &samples);
+
+
 	/**
 	* Read a defined group of OPC item asynchronously
 	*/
 	CTransaction * readAsync(std::vector<COPCItem *>& items, ITransactionComplete *transactionCB = NULL);
 
 
+	/**
+	* Read a defined group of OPC item asynchronously, OnReadComplete fills samples in place.
+	* samples must stay alive until the transaction has completed.
+	*/
+	CTransaction * readAsync(std::vector<COPCItem *>& items, COPCSampleBuffer &samples, ITransactionComplete *transactionCB = NULL);
+
+
+	/**
+	* Read a prepared set of OPC items asynchronously, OnReadComplete fills samples in place.
+	* samples must stay alive until the transaction has completed.
+	*/
+	CTransaction * readAsync(COPCReadSet &readSet, COPCSampleBuffer &samples, ITransactionComplete *transactionCB = NULL);
+
+
+	/**
+	* Read a prepared set of OPC items asynchronously into the sample buffer of a caller supplied transaction,
+	* typically one from a CTransactionPool. The transaction has to be fresh or reset.
+	*/
+	void readAsync(COPCReadSet &readSet, CTransaction &trans);
+
+
+	/**
+	* Write values to a set of OPC items synchronously in one server call, values[i] goes to items[i].
+	* errors receives the HRESULT of every item, the call throws only if the write as a whole fails.
+	*/
+	void writeSync(std::vector<COPCItem *>& items, std::vector<VARIANT>& values, std::vector<HRESULT>& errors);
+
+
+	/**
+	* Write values to a set of OPC items asynchronously in one server call, values[i] goes to items[i].
+	* The item errors are stored in the returned transaction, which is owned by the caller.
+	*/
+	CTransaction * writeAsync(std::vector<COPCItem *>& items, std::vector<VARIANT>& values, ITransactionComplete *transactionCB = NULL);
+
+
+	/**
+	* Write values asynchronously, the item errors are stored in a caller supplied transaction.
+	*/
+	void writeAsync(std::vector<COPCItem *>& items, std::vector<VARIANT>& values, CTransaction &trans);
+
+
 	/**
 	* Refresh is an asysnch operation.
 	* retreives all active items in the group, which will be stored in the transaction object
@@ -161,6 +373,19 @@ public:
 	CTransaction * refresh(OPCDATASOURCE source, ITransactionComplete *transactionCB = NULL);
 
 
+	/**
+	* Refresh into a caller supplied transaction, the results go to its sample buffer or, without one, its data map.
+	*/
+	void refresh(OPCDATASOURCE source, CTransaction &trans);
+
+
+	/**
+	* Cancel a pending asynchronous transaction, it will not complete and can be deleted right away.
+	* Returns false if the transaction had already completed.
+	*/
+	bool cancel(CTransaction &trans);
+
+
 
 	ATL::CComPtr<IOPCSyncIO> & getSychIOInterface(){
 		return iSychIO;
@@ -184,6 +409,36 @@ public:
 		return userAsynchCBHandler;
 	}
 
+	IAsynchSampleCallback *getUsrAsynchSampleHandler(){
+		return userAsynchSampleHandler;
+	}
+
+	COPCSampleBuffer & getAsynchSamples(){
+		return asynchSamples;
+	}
+
+	CTransactionRegistry & getTransactions(){
+		return transactions;
+	}
+
+	/**
+	* map a client handle returned by the server back to the item. 
+	* Returns NULL for handles we never gave out or whose item has been deleted.
+	*/
+	COPCItem * getItemByClientHandle(OPCHANDLE clientHandle) const{
+		if (clientHandle >= items.size()){
+			return NULL;
+		}
+		return items[clientHandle];
+	}
+
+	/**
+	* size of the item table, all client handles are below this value
+	*/
+	size_t getItemTableSize() const{
+		return items.size();
+	}
+
 	/**
 	* returns reaference to the OPC server that this group belongs to.
 	*/
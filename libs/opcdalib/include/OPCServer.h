@@ -27,6 +27,7 @@ Boston, MA  02111-1307, USA.
 
 #include "OPCClient.h"
 #include "OPCGroup.h"
+#include "opccomn.h"
 
 
 
@@ -50,6 +51,13 @@ std::string vendorInfo;
 
 
 
+/**
+* used internally to implement the IOPCShutdown sink
+*/
+class CShutdownCallback;
+
+
+
 /**
 * Local representation of a local or remote OPC server. Wrapper for the COM interfaces to the server.
 */
@@ -73,6 +81,31 @@ private:
 	ATL::CComPtr<IOPCItemProperties> iOpcProperties;
 
 
+	/**
+	* connection point of the IOPCShutdown sink, set while shutdown notification is enabled
+	*/
+	ATL::CComPtr<IConnectionPoint> iShutdownConnectionPoint;
+
+
+	/**
+	* IOPCShutdown sink registered with the server
+	*/
+	ATL::CComPtr<CShutdownCallback> shutdownCallBackHandler;
+
+
+	/**
+	* cookie of the shutdown sink given by the connection point
+	*/
+	DWORD shutdownCallbackHandle;
+
+
+	/**
+	* Users handler for shutdown requests
+	* NOT OWNED.
+	*/
+	IServerShutdownCallback *userShutdownHandler;
+
+
 	friend class COPCGroup;
 	/**
 	* Used by group object.
@@ -117,6 +150,24 @@ public:
 	* get the current status of the server.
 	*/
 	void getStatus(ServerStatus &status);
+
+
+	/**
+	* register an IOPCShutdown sink, so the server tells handler before it shuts down.
+	* Throws if the server offers no IOPCShutdown connection point.
+	*/
+	void enableShutdownNotification(IServerShutdownCallback &handler);
+
+
+	/**
+	* unregister the IOPCShutdown sink, called by the destructor if needed
+	*/
+	void disableShutdownNotification();
+
+
+	IServerShutdownCallback *getUsrShutdownHandler(){
+		return userShutdownHandler;
+	}
 };
 
 #endif // !defined(AFX_OPCSERVER_H__AD6316C0_37B3_4DEC_8378_EE03CC3AEED8__INCLUDED_)
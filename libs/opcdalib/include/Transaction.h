@@ -1,7 +1,14 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "OPCClient.h"
+#include "TransactionRegistry.h"
 
 class CTransaction;
 
@@ -35,12 +42,63 @@ class CTransaction{
 
 	// true when the transaction has completed
 	bool completed;
+
+	/**
+	* guards completed, promise and the completion state below, completion happens on a COM thread.
+	*/
+	mutable std::recursive_mutex completionMutex;
+
+	/**
+	* true from the moment the transaction left its registry until the completion callback returned. The callback
+	* runs without any lock held, a reset or delete from another thread waits on completionDone for it to return.
+	* One from completingThread, the callback itself, goes ahead.
+	*/
+	bool completing;
+	std::thread::id completingThread;
+	std::condition_variable_any completionDone;
+
+	/**
+	* set by the destructor when the callback deletes the transaction, so the completion does not touch it any more
+	*/
+	bool * deletedByCallback;
+
+	/**
+	* only made when a future is asked for, so transactions that nobody waits on do not allocate
+	*/
+	std::unique_ptr<std::promise<void> > promise;
 	
 
 	DWORD cancelID;
 
+	/**
+	* registry the transaction is pending in and its id there, registry is NULL once it completed or was cancelled.
+	* The registry sets it under its lock, reset and the destructor read it without.
+	*/
+	friend class CTransactionRegistry;
+	std::atomic<CTransactionRegistry *> registry;
+	DWORD transactionID;
+
+	/**
+	* completion in two steps: beginCompletion marks the transaction completed while its registry is still locked,
+	* finishCompletion hands it to the future and the callback after the lock was released
+	*/
+	void beginCompletion();
+
+	void finishCompletion();
+
+	/**
+	* waits until a completion callback running on another thread returned, called with completionMutex held
+	*/
+	void waitForCompletion(std::unique_lock<std::recursive_mutex> &guard);
+
 
 public:
+	/**
+	* when set the results are written to this buffer instead of opcData - not owned
+	*/
+	COPCSampleBuffer * samples;
+
+
 	/**
 	* keyed on OPCitem address (not owned)
 	* OPCitem data is owned by the transaction - may be NULL
@@ -55,6 +113,24 @@ public:
 	*/
 	CTransaction(std::vector<COPCItem *>&items, ITransactionComplete * completeCB);
 
+	/**
+	* Used where the results go into a caller supplied sample buffer.
+	*/
+	CTransaction(COPCSampleBuffer &sampleBuffer, ITransactionComplete * completeCB);
+
+	/**
+	* a transaction deleted while still pending leaves its registry, the server's late completion is dropped.
+	* The completion callback may delete its transaction.
+	*/
+	~CTransaction();
+
+	/**
+	* Make the transaction ready for another operation, used to recycle transactions instead of allocating new ones.
+	* A transaction still pending leaves its registry first, so its late completion is dropped.
+	* The data map is emptied, a sample buffer keeps its values but forgets which items were updated.
+	*/
+	void reset(ITransactionComplete * completeCB = NULL);
+
 
 	
 	void setItemError(COPCItem *item, HRESULT error);
@@ -63,6 +139,12 @@ public:
 	void setItemValue(COPCItem *item, FILETIME time, WORD qual, VARIANT & val, HRESULT err);
 
 
+	/**
+	* store data for an item in the data map, taking ownership of it
+	*/
+	void setItemData(COPCItem *item, OPCItemData *data);
+
+
 	/**
 	* return Value stored for a given opc item.
 	*/
@@ -70,13 +152,17 @@ public:
 			
 
 	/**
-	* trigger completion of the transaction.
+	* trigger completion of the transaction. The callback is called last, it may reset or delete the transaction.
 	*/
 	void setCompleted();
 
-	bool isCompeleted() const{
-		return completed;
-	}
+	bool isCompeleted() const;
+
+	/**
+	* Future that becomes ready when the transaction completes, so callers can block or wait with a timeout instead of
+	* polling isCompeleted(). Can be asked for once per operation, a reset before completion breaks the promise.
+	*/
+	std::future<void> getFuture();
 
 	void setCancelId(DWORD id){
 		cancelID = id;
@@ -85,4 +171,11 @@ public:
 	DWORD getCancelId() const{
 		return cancelID;
 	}
+
+	/**
+	* id passed to the server, only valid while the transaction is pending
+	*/
+	DWORD getTransactionId() const{
+		return transactionID;
+	}
 };
@@ -0,0 +1,89 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "Transaction.h"
+
+
+
+/**
+* Recycles transactions together with a sample buffer each, so sustained asynchronous reads, writes and refreshes
+* do not allocate once the pool is warm. Pooled transactions always deliver their results into their own sample
+* buffer, which is sized by the group operation they are passed to.
+*/
+class CTransactionPool{
+private:
+	struct Entry{
+		COPCSampleBuffer samples;
+		CTransaction transaction;
+
+		Entry():transaction(samples, NULL){}
+	};
+
+	/**
+	* owned, every transaction handed out lives in one of them
+	*/
+	std::vector<Entry *> entries;
+
+	std::vector<CTransaction *> idle;
+
+	std::mutex mutex;
+
+	// the entries are owned, so the pool must not be copied
+	CTransactionPool(const CTransactionPool &);
+	CTransactionPool & operator=(const CTransactionPool &);
+
+public:
+	CTransactionPool(){}
+
+	/**
+	* transactions still pending leave their registry, their late completions are dropped
+	*/
+	~CTransactionPool();
+
+	/**
+	* returns an idle transaction reset for a new operation, or a new one if none is idle
+	*/
+	CTransaction * acquire(ITransactionComplete * completeCB = NULL);
+
+	/**
+	* hands a transaction back once its results have been used. A transaction still pending is taken out of its
+	* registry, cancel it first if the server should stop working on it.
+	*/
+	void release(CTransaction * transaction);
+
+	/**
+	* number of transactions the pool has made, idle or not
+	*/
+	size_t size();
+};
+
+
+
+/**
+* Completion callback that queues the transactions it is given, so one thread can wait on any number of outstanding
+* transactions at once and handle them in the order they completed, without polling isCompeleted().
+*/
+class CTransactionQueue : public ITransactionComplete{
+private:
+	std::mutex mutex;
+
+	std::condition_variable ready;
+
+	std::deque<CTransaction *> completed;
+
+public:
+	void complete(CTransaction &transaction);
+
+	/**
+	* returns the next completed transaction, or NULL if none completed within timeout_ms
+	*/
+	CTransaction * waitNext(DWORD timeout_ms);
+
+	/**
+	* returns the next completed transaction, or NULL if none has completed
+	*/
+	CTransaction * next();
+};
@@ -0,0 +1,92 @@
+#pragma once
+#include <mutex>
+#include <vector>
+
+#include "OPCClientToolKitDLL.h"
+#include "opcda.h"
+
+class CTransaction;
+
+
+
+/**
+* Maps the transaction ids passed to the asynchronous OPC calls of a group to the pending CTransaction objects.
+* An id holds a slot index and the generation of that slot, so a completion arriving after its transaction was
+* cancelled, timed out or deleted finds a newer generation or a free slot and is dropped instead of using freed
+* memory. Ids are never 0, the server passes 0 for plain data changes.
+* Results are stored under the registry lock and the transaction leaves the registry before its completion callback
+* runs. A reset or delete waits for a callback running on another thread, so once it returned no completion touches
+* the transaction any more.
+*/
+class CTransactionRegistry{
+private:
+	struct Slot{
+		CTransaction *transaction;
+		WORD generation;
+	};
+
+	std::vector<Slot> slots;
+
+	std::vector<WORD> freeSlots;
+
+	std::mutex mutex;
+
+	/**
+	* frees the slot of a pending transaction, called with the lock held
+	*/
+	void release(DWORD transactionId);
+
+public:
+	/**
+	* Looks up the transaction of an id and keeps the registry locked while it lives. get() is NULL if the id is not
+	* pending, otherwise the caller stores the results and calls complete(). A completion going away without it drops
+	* the transaction from the registry without completing it.
+	*/
+	class Completion{
+	private:
+		CTransactionRegistry &registry;
+
+		std::unique_lock<std::mutex> guard;
+
+		CTransaction *transaction;
+
+		DWORD transactionId;
+
+	public:
+		Completion(CTransactionRegistry &registry, DWORD transactionId);
+
+		~Completion();
+
+		CTransaction * get() const{
+			return transaction;
+		}
+
+		/**
+		* takes the transaction out of the registry, unlocks it and completes the transaction. Its callback may
+		* reset or delete it, or start the next operation in this registry.
+		*/
+		void complete();
+	};
+
+	CTransactionRegistry(){}
+
+	/**
+	* pending transactions are detached, a late completion of them is dropped
+	*/
+	~CTransactionRegistry();
+
+	/**
+	* registers a pending transaction and returns its id, which is stored in the transaction as well
+	*/
+	DWORD add(CTransaction &transaction);
+
+	/**
+	* takes a transaction out of the registry before it completed, returns false if it was not pending
+	*/
+	bool remove(CTransaction &transaction);
+
+	/**
+	* number of pending transactions
+	*/
+	size_t size();
+};
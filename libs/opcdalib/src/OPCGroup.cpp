@@ -22,6 +22,8 @@ Boston, MA  02111-1307, USA.
 #include "OPCGroup.h"
 #include "OPCItem.h"
 
+#include <algorithm>
+
 
 
 
@@ -40,9 +42,26 @@ private:
 	*/
 	COPCGroup &callbacksGroup;
 
+	/**
+	* number of the delivery each client handle was last stored in, see deliverSamples
+	*/
+	std::vector<DWORD> itemBatch;
+	DWORD batch;
+
+
+	/**
+	* starts the next delivery to the sample handler
+	*/
+	void nextBatch(){
+		if (++batch == 0){
+			std::fill(itemBatch.begin(), itemBatch.end(), 0);
+			batch = 1;
+		}
+	}
+
 
 public:
-	CAsynchDataCallback(COPCGroup &group):callbacksGroup(group){
+	CAsynchDataCallback(COPCGroup &group):callbacksGroup(group),batch(0){
 		mRefCount = 0;
 	}
 
@@ -101,12 +120,20 @@ public:
 
 		if (Transid != 0){
 			// it is a result of a refresh (see p106 of spec)
-			CTransaction & trans = *(CTransaction *)Transid; 
-			updateOPCData(trans.opcData, count, clienthandles, values,quality,time,errors);
-			trans.setCompleted();	
+			CTransactionRegistry::Completion completion(callbacksGroup.getTransactions(), Transid);
+			if (completion.get()){
+				updateTransaction(*completion.get(), count, clienthandles, values,quality,time,errors);
+				completion.complete();
+			}
 			return S_OK;	
 		}
 
+		IAsynchSampleCallback * usrSampleHandler = callbacksGroup.getUsrAsynchSampleHandler();
+		if (usrSampleHandler){
+			deliverSamples(*usrSampleHandler, count, clienthandles, values,quality,time,errors);
+			return S_OK;
+		}
+
 		if (usrHandler){
 			COPCItem_DataMap dataChanges;
 			updateOPCData(dataChanges, count, clienthandles, values,quality,time,errors);
@@ -121,10 +148,13 @@ public:
 		OPCHANDLE * clienthandles, VARIANT* values, WORD * quality,
 		FILETIME * time, HRESULT * errors)
 	{
-		// TODO this is bad  - server could corrupt address - need to use look up table
-		CTransaction & trans = *(CTransaction *)Transid; 
-		updateOPCData(trans.opcData, count, clienthandles, values,quality,time,errors);
-		trans.setCompleted();
+		// the transaction may have been cancelled or timed out, then the results are dropped
+		CTransactionRegistry::Completion completion(callbacksGroup.getTransactions(), Transid);
+		if (!completion.get()){
+			return S_OK;
+		}
+		updateTransaction(*completion.get(), count, clienthandles, values,quality,time,errors);
+		completion.complete();
 		return S_OK;
 	}
 
@@ -132,24 +162,28 @@ public:
 	STDMETHODIMP OnWriteComplete(DWORD Transid, OPCHANDLE grphandle, HRESULT mastererr, 
 		DWORD count, OPCHANDLE * clienthandles, HRESULT * errors)
 	{
-		// TODO this is bad  - server could corrupt address - need to use look up table
-		CTransaction & trans = *(CTransaction *)Transid; 
+		CTransactionRegistry::Completion completion(callbacksGroup.getTransactions(), Transid);
+		if (!completion.get()){
+			return S_OK;
+		}
+		CTransaction & trans = *completion.get();
 
 		// see page 145 - number of items returned may be less than sent
 		for (unsigned i = 0; i < count; i++){
-			// TODO this is bad  - server could corrupt address - need to use look up table
-			COPCItem * item = (COPCItem *)clienthandles[i];
-			trans.setItemError(item, errors[i]); // this records error state - may be good
+			COPCItem * item = callbacksGroup.getItemByClientHandle(clienthandles[i]);
+			if (item){
+				trans.setItemError(item, errors[i]); // this records error state - may be good
+			}
 		}
 
-		trans.setCompleted();
+		completion.complete();
 		return S_OK;
 	}
 
 
 
 	STDMETHODIMP OnCancelComplete(DWORD transid, OPCHANDLE grphandle){
-		printf("OnCancelComplete: Transid=%ld GrpHandle=%ld\n", transid, grphandle);
+		// cancel() already took the transaction out of the registry
 		return S_OK;
 	}
 
@@ -167,15 +201,82 @@ public:
 		return data;
 	}
 
+	/**
+	* Enter the OPC items data that resulted from an operation into the transactions sample buffer or data map
+	*/
+	void updateTransaction(CTransaction &trans, DWORD count, OPCHANDLE * clienthandles, 
+		VARIANT* values, WORD * quality,FILETIME * time, HRESULT * errors){
+		if (trans.samples){
+			trans.samples->resize(callbacksGroup.getItemTableSize());
+			updateSamples(*trans.samples, count, clienthandles, values,quality,time,errors);
+		} else {
+			updateOPCData(trans.opcData, count, clienthandles, values,quality,time,errors);
+		}
+	}
+
+	/**
+	* Hand data changes to the users sample handler. A server buffering item samples (DA 3.0) sends several values of
+	* an item in one callback, but the sample buffer holds one value per item. So the handler is called before an item
+	* repeats, and gets the buffered values in the order the server sent them.
+	*/
+	void deliverSamples(IAsynchSampleCallback &handler, DWORD count, OPCHANDLE * clienthandles, 
+		VARIANT* values, WORD * quality,FILETIME * time, HRESULT * errors){
+		COPCSampleBuffer & samples = callbacksGroup.getAsynchSamples();
+		samples.resize(callbacksGroup.getItemTableSize());
+		itemBatch.resize(callbacksGroup.getItemTableSize(), 0);
+		samples.clearUpdated();
+		nextBatch();
+		for (unsigned i = 0; i < count; i++){
+			OPCHANDLE clientHandle = clienthandles[i];
+			if (callbacksGroup.getItemByClientHandle(clientHandle) == NULL){
+				continue;
+			}
+			if (itemBatch[clientHandle] == batch){
+				handler.OnDataChange(callbacksGroup, samples);
+				samples.clearUpdated();
+				nextBatch();
+			}
+			itemBatch[clientHandle] = batch;
+			if (FAILED(errors[i])){
+				samples.setError(clientHandle, errors[i]);
+			} else {
+				samples.set(clientHandle, values[i], quality[i], time[i], errors[i]);
+			}
+		}
+		// keep-alive callbacks without items are delivered too, they show the connection is alive
+		handler.OnDataChange(callbacksGroup, samples);
+	}
+
+	/**
+	* Enter the OPC items data that resulted from an operation into a sample buffer, without allocating
+	*/
+	void updateSamples(COPCSampleBuffer &samples, DWORD count, OPCHANDLE * clienthandles, 
+		VARIANT* values, WORD * quality,FILETIME * time, HRESULT * errors){
+		for (unsigned i = 0; i < count; i++){
+			if (callbacksGroup.getItemByClientHandle(clienthandles[i]) == NULL){
+				continue;
+			}
+			if (FAILED(errors[i])){
+				samples.setError(clienthandles[i], errors[i]);
+			} else {
+				// the arrays belong to the COM runtime, so values are copied not taken
+				samples.set(clienthandles[i], values[i], quality[i], time[i], errors[i]);
+			}
+		}
+	}
+
 	/**
 	* Enter the OPC items data that resulted from an operation
 	*/
-	static void updateOPCData(COPCItem_DataMap &opcData, DWORD count, OPCHANDLE * clienthandles, 
+	void updateOPCData(COPCItem_DataMap &opcData, DWORD count, OPCHANDLE * clienthandles, 
 		VARIANT* values, WORD * quality,FILETIME * time, HRESULT * errors){
 		// see page 136 - returned arrays may be out of order
 		for (unsigned i = 0; i < count; i++){
-			// TODO this is bad  - server could corrupt address - need to use look up table
-			COPCItem * item = (COPCItem *)clienthandles[i];
+			// client handles are indices into the groups item table, unknown handles are dropped
+			COPCItem * item = callbacksGroup.getItemByClientHandle(clienthandles[i]);
+			if (item == NULL){
+				continue;
+			}
 			OPCItemData * data = makeOPCDataItem(values[i], quality[i], time[i], errors[i]);
 			COPCItem_DataMap::CPair* pair = opcData.Lookup(item);
 			if (pair == NULL){
@@ -196,7 +297,9 @@ public:
 
 COPCGroup::COPCGroup(const std::string & groupName, bool active, unsigned long reqUpdateRate_ms, unsigned long &revisedUpdateRate_ms, float deadBand, COPCServer &server):
 name(groupName),
-opcServer(server)
+opcServer(server),
+userAsynchCBHandler(NULL),
+userAsynchSampleHandler(NULL)
 {
 	USES_CONVERSION;
 	WCHAR* wideName = T2OLE(groupName.c_str());
@@ -223,6 +326,27 @@ opcServer(server)
 	if (FAILED(result)){
 		throw OPCException("Failed to get IID_IOPCItemMgt");
 	}
+
+	// optional, only DA 3.0 servers implement these. A DA 2.0 server leaves them NULL and the group works as before.
+	result = iStateManagement->QueryInterface(IID_IOPCGroupStateMgt2, (void**)&iStateManagement2);
+	if (FAILED(result)){
+		iStateManagement2 = NULL;
+	}
+
+	result = iStateManagement->QueryInterface(IID_IOPCSyncIO2, (void**)&iSychIO2);
+	if (FAILED(result)){
+		iSychIO2 = NULL;
+	}
+
+	result = iStateManagement->QueryInterface(IID_IOPCItemDeadbandMgt, (void**)&iItemDeadbandManagement);
+	if (FAILED(result)){
+		iItemDeadbandManagement = NULL;
+	}
+
+	result = iStateManagement->QueryInterface(IID_IOPCItemSamplingMgt, (void**)&iItemSamplingManagement);
+	if (FAILED(result)){
+		iItemSamplingManagement = NULL;
+	}
 }
 
 
@@ -264,7 +388,11 @@ void COPCGroup::readSync(std::vector<COPCItem *>& items, COPCItem_DataMap & opcD
 	} 
 
 	for (unsigned i = 0; i < noItems; i++){
-		COPCItem * item = (COPCItem *)itemState[i].hClient;
+		COPCItem * item = getItemByClientHandle(itemState[i].hClient);
+		if (item == NULL){
+			VariantClear(&itemState[i].vDataValue);
+			continue;
+		}
 		OPCItemData * data = CAsynchDataCallback::makeOPCDataItem(itemState[i].vDataValue, itemState[i].wQuality, itemState[i].ftTimeStamp, itemResult[i]);
 		COPCItem_DataMap::CPair* pair = opcData.Lookup(item);
 		if (pair == NULL){
@@ -281,6 +409,109 @@ void COPCGroup::readSync(std::vector<COPCItem *>& items, COPCItem_DataMap & opcD
 
 
 
+void COPCGroup::readSync(std::vector<COPCItem *>& items, COPCSampleBuffer & samples, OPCDATASOURCE source){
+	OPCHANDLE *serverHandles = buildServerHandleList(items);
+	HRESULT *itemResult;
+	OPCITEMSTATE *itemState;
+	DWORD noItems = (DWORD)items.size();
+
+	HRESULT	result = iSychIO->Read(source, noItems, serverHandles, &itemState, &itemResult);
+	delete []serverHandles;
+	if (FAILED(result)){
+		throw OPCException("Read failed");
+	} 
+
+	storeReadResults(noItems, itemState, itemResult, NULL, samples);
+}
+
+
+
+COPCReadSet * COPCGroup::prepareRead(std::vector<COPCItem *>& items){
+	return new COPCReadSet(items);
+}
+
+
+
+void COPCGroup::readSync(COPCReadSet &readSet, COPCSampleBuffer & samples, OPCDATASOURCE source){
+	HRESULT *itemResult;
+	OPCITEMSTATE *itemState;
+
+	HRESULT	result = iSychIO->Read(source, readSet.size(), readSet.getServerHandles(), &itemState, &itemResult);
+	if (FAILED(result)){
+		throw OPCException("Read failed");
+	} 
+
+	storeReadResults(readSet.size(), itemState, itemResult, &readSet, samples);
+}
+
+
+
+void COPCGroup::storeReadResults(DWORD noItems, OPCITEMSTATE *itemState, HRESULT *itemResult, COPCReadSet *readSet, COPCSampleBuffer &samples){
+	samples.resize(items.size());
+	samples.clearUpdated();
+	for (unsigned i = 0; i < noItems; i++){
+		// results of a synchronous read are in request order, so the read set knows the handle even for failed items
+		OPCHANDLE clientHandle = readSet ? readSet->getClientHandle(i) : itemState[i].hClient;
+		if (getItemByClientHandle(clientHandle) == NULL){
+			VariantClear(&itemState[i].vDataValue);
+			continue;
+		}
+		if (FAILED(itemResult[i])){
+			VariantClear(&itemState[i].vDataValue);
+			samples.setError(clientHandle, itemResult[i]);
+		} else {
+			// itemState is ours to free, so its VARIANTs are moved into the buffer instead of copied
+			samples.take(clientHandle, itemState[i].vDataValue, itemState[i].wQuality, itemState[i].ftTimeStamp, itemResult[i]);
+		}
+	}
+
+	COPCClient::comFree(itemResult);
+	COPCClient::comFree(itemState);	
+}
+
+
+
+void COPCGroup::readSyncMaxAge(COPCReadSet &readSet, DWORD maxAge_ms, COPCSampleBuffer &samples){
+	if (iSychIO2 == NULL){
+		throw OPCException("IOPCSyncIO2 not supported", E_NOINTERFACE);
+	}
+
+	DWORD noItems = readSet.size();
+	std::vector<DWORD> maxAges(noItems, maxAge_ms);
+	VARIANT *itemValues;
+	WORD *itemQualities;
+	FILETIME *itemTimes;
+	HRESULT *itemResult;
+	HRESULT	result = iSychIO2->ReadMaxAge(noItems, readSet.getServerHandles(), noItems > 0 ? &maxAges[0] : NULL,
+		&itemValues, &itemQualities, &itemTimes, &itemResult);
+	if (FAILED(result)){
+		throw OPCException("ReadMaxAge failed", result);
+	}
+
+	samples.resize(items.size());
+	samples.clearUpdated();
+	for (unsigned i = 0; i < noItems; i++){
+		OPCHANDLE clientHandle = readSet.getClientHandle(i);
+		if (getItemByClientHandle(clientHandle) == NULL){
+			VariantClear(&itemValues[i]);
+			continue;
+		}
+		if (FAILED(itemResult[i])){
+			VariantClear(&itemValues[i]);
+			samples.setError(clientHandle, itemResult[i]);
+		} else {
+			samples.take(clientHandle, itemValues[i], itemQualities[i], itemTimes[i], itemResult[i]);
+		}
+	}
+
+	COPCClient::comFree(itemValues);
+	COPCClient::comFree(itemQualities);
+	COPCClient::comFree(itemTimes);
+	COPCClient::comFree(itemResult);
+}
+
+
+
 CTransaction * COPCGroup::readAsync(std::vector<COPCItem *>& items, ITransactionComplete *transactionCB){
 		DWORD cancelID;
 		HRESULT * individualResults;
@@ -288,7 +519,7 @@ CTransaction * COPCGroup::readAsync(std::vector<COPCItem *>& items, ITransaction
 		OPCHANDLE *serverHandles = buildServerHandleList(items);
 		DWORD noItems = (DWORD)items.size();
 
-		HRESULT result = iAsych2IO->Read(noItems, serverHandles, (DWORD)trans, &cancelID, &individualResults);
+		HRESULT result = iAsych2IO->Read(noItems, serverHandles, transactions.add(*trans), &cancelID, &individualResults);
 		delete [] serverHandles;
 		if (FAILED(result)){
 			delete trans;
@@ -303,7 +534,7 @@ CTransaction * COPCGroup::readAsync(std::vector<COPCItem *>& items, ITransaction
 				failCount++;
 			}
 		}
-		if (failCount == items.size()){
+		if (failCount == items.size() && transactions.remove(*trans)){
 			trans->setCompleted(); // if all items return error then no callback will occur. p 101
 		}
 		
@@ -314,17 +545,213 @@ CTransaction * COPCGroup::readAsync(std::vector<COPCItem *>& items, ITransaction
 
 
 
-CTransaction * COPCGroup::refresh(OPCDATASOURCE source, ITransactionComplete *transactionCB){
+CTransaction * COPCGroup::readAsync(std::vector<COPCItem *>& items, COPCSampleBuffer &samples, ITransactionComplete *transactionCB){
+		DWORD cancelID;
+		HRESULT * individualResults;
+		samples.resize(this->items.size());
+		CTransaction * trans = new CTransaction(samples,transactionCB);
+		OPCHANDLE *serverHandles = buildServerHandleList(items);
+		DWORD noItems = (DWORD)items.size();
+
+		HRESULT result = iAsych2IO->Read(noItems, serverHandles, transactions.add(*trans), &cancelID, &individualResults);
+		delete [] serverHandles;
+		if (FAILED(result)){
+			delete trans;
+			throw OPCException("Asynch Read failed");
+		}
+
+		trans->setCancelId(cancelID);
+		unsigned failCount = 0;
+		for (unsigned i = 0;i < noItems; i++){
+			if (FAILED(individualResults[i])){
+				trans->setItemError(items[i],individualResults[i]);
+				failCount++;
+			}
+		}
+		if (failCount == items.size() && transactions.remove(*trans)){
+			trans->setCompleted(); // if all items return error then no callback will occur. p 101
+		}
+		
+
+		COPCClient::comFree(individualResults);
+		return trans;
+}
+
+
+
+CTransaction * COPCGroup::readAsync(COPCReadSet &readSet, COPCSampleBuffer &samples, ITransactionComplete *transactionCB){
+		CTransaction * trans = new CTransaction(samples,transactionCB);
+		try {
+			readAsync(readSet, *trans);
+		} catch (OPCException &){
+			delete trans;
+			throw;
+		}
+		return trans;
+}
+
+
+
+void COPCGroup::readAsync(COPCReadSet &readSet, CTransaction &trans){
+		if (trans.samples == NULL){
+			throw OPCException("Transaction has no sample buffer");
+		}
+
+		DWORD cancelID;
+		HRESULT * individualResults;
+		trans.samples->resize(items.size());
+		DWORD noItems = readSet.size();
+
+		HRESULT result = iAsych2IO->Read(noItems, readSet.getServerHandles(), transactions.add(trans), &cancelID,
+			&individualResults);
+		if (FAILED(result)){
+			transactions.remove(trans);
+			throw OPCException("Asynch Read failed");
+		}
+
+		trans.setCancelId(cancelID);
+		unsigned failCount = 0;
+		for (unsigned i = 0;i < noItems; i++){
+			if (FAILED(individualResults[i])){
+				trans.samples->setError(readSet.getClientHandle(i), individualResults[i]);
+				failCount++;
+			}
+		}
+		if (failCount == noItems && transactions.remove(trans)){
+			trans.setCompleted(); // if all items return error then no callback will occur. p 101
+		}
+		
+
+		COPCClient::comFree(individualResults);
+}
+
+
+
+void COPCGroup::writeSync(std::vector<COPCItem *>& items, std::vector<VARIANT>& values, std::vector<HRESULT>& errors){
+	if (values.size() != items.size()){
+		throw OPCException("Number of values does not match number of items");
+	}
+	errors.resize(items.size());
+	if (items.empty()){
+		return;
+	}
+
+	OPCHANDLE *serverHandles = buildServerHandleList(items);
+	HRESULT *itemWriteErrors;
+	DWORD noItems = (DWORD)items.size();
+
+	HRESULT result = iSychIO->Write(noItems, serverHandles, &values[0], &itemWriteErrors);
+	delete []serverHandles;
+	if (FAILED(result)){
+		throw OPCException("write failed", result);
+	}
+
+	// results are in request order, S_FALSE is returned if any item failed (p 96)
+	for (unsigned i = 0; i < noItems; i++){
+		errors[i] = itemWriteErrors[i];
+	}
+	COPCClient::comFree(itemWriteErrors);
+}
+
+
+
+CTransaction * COPCGroup::writeAsync(std::vector<COPCItem *>& items, std::vector<VARIANT>& values, ITransactionComplete *transactionCB){
+	CTransaction * trans = new CTransaction(items,transactionCB);
+	try {
+		writeAsync(items, values, *trans);
+	} catch (OPCException &){
+		delete trans;
+		throw;
+	}
+	return trans;
+}
+
+
+
+void COPCGroup::writeAsync(std::vector<COPCItem *>& items, std::vector<VARIANT>& values, CTransaction &trans){
+	if (values.size() != items.size() || items.empty()){
+		throw OPCException("Number of values does not match number of items");
+	}
+
 	DWORD cancelID;
-	CTransaction * trans = new CTransaction(items, transactionCB);
+	HRESULT * individualResults;
+	if (trans.samples){
+		trans.samples->resize(this->items.size());
+	}
+	OPCHANDLE *serverHandles = buildServerHandleList(items);
+	DWORD noItems = (DWORD)items.size();
 
-	HRESULT result = iAsych2IO->Refresh2(source, (DWORD)trans, &cancelID);
+	HRESULT result = iAsych2IO->Write(noItems, serverHandles, &values[0], transactions.add(trans), &cancelID,
+		&individualResults);
+	delete [] serverHandles;
 	if (FAILED(result)){
+		transactions.remove(trans);
+		throw OPCException("Asynch Write failed", result);
+	}
+
+	trans.setCancelId(cancelID);
+	unsigned failCount = 0;
+	for (unsigned i = 0; i < noItems; i++){
+		if (FAILED(individualResults[i])){
+			trans.setItemError(items[i],individualResults[i]);
+			failCount++;
+		}
+	}
+	if (failCount == noItems && transactions.remove(trans)){
+		trans.setCompleted(); // if all items return error then no callback will occur. p 104
+	}
+
+	COPCClient::comFree(individualResults);
+}
+
+
+
+CTransaction * COPCGroup::refresh(OPCDATASOURCE source, ITransactionComplete *transactionCB){
+	CTransaction * trans = new CTransaction(items, transactionCB);
+	try {
+		refresh(source, *trans);
+	} catch (OPCException &){
 		delete trans;
+		throw;
+	}
+	return trans;
+}
+
+
+
+void COPCGroup::refresh(OPCDATASOURCE source, CTransaction &trans){
+	DWORD cancelID;
+	if (trans.samples){
+		trans.samples->resize(items.size());
+	}
+
+	HRESULT result = iAsych2IO->Refresh2(source, transactions.add(trans), &cancelID);
+	if (FAILED(result)){
+		transactions.remove(trans);
 		throw OPCException("refresh failed");
 	}
 
-	return trans;
+	trans.setCancelId(cancelID);
+}
+
+
+
+bool COPCGroup::cancel(CTransaction &trans){
+	if (!transactions.remove(trans)){
+		return false; // completed already
+	}
+	// whether or not the server manages to cancel, a late completion no longer finds the transaction
+	iAsych2IO->Cancel2(trans.getCancelId());
+	return true;
+}
+
+
+
+void COPCGroup::releaseClientHandle(OPCHANDLE clientHandle){
+	if (clientHandle < items.size() && items[clientHandle] != NULL){
+		items[clientHandle] = NULL;
+		freeClientHandles.push_back(clientHandle);
+	}
 }
 
 
@@ -347,17 +774,32 @@ COPCItem * COPCGroup::addItem(std::string &itemName, bool active)
 int COPCGroup::addItems(std::vector<std::string>& itemName, std::vector<COPCItem *>& itemsCreated, std::vector<HRESULT>& errors, bool active){
 	itemsCreated.resize(itemName.size());
 	errors.resize(itemName.size());
+	if (itemName.empty()){
+		return 0;
+	}
  	OPCITEMDEF *itemDef = new OPCITEMDEF[itemName.size()];
 	unsigned i = 0;
 	std::vector<CT2OLE *> tpm;
+	// client handles are the free slots of the item table, then new ones at its end, so they stay dense and fit into
+	// 32 bit. The server sends no data for removed items, so a handle given out again is not mistaken for its old item.
+	size_t tableSize = items.size();
 	for (; i < itemName.size(); i++){
-		itemsCreated[i] = new COPCItem(itemName[i],*this);
+		OPCHANDLE clientHandle;
+		if (freeClientHandles.empty()){
+			clientHandle = (OPCHANDLE)items.size();
+			items.push_back(NULL);
+		} else {
+			clientHandle = freeClientHandles.back();
+			freeClientHandles.pop_back();
+		}
+		itemsCreated[i] = new COPCItem(itemName[i],*this, clientHandle);
+		items[clientHandle] = itemsCreated[i];
 		USES_CONVERSION;
 		tpm.push_back(new CT2OLE(itemName[i].c_str())) ;
 		itemDef[i].szItemID = **(tpm.end()-1);
 		itemDef[i].szAccessPath = NULL;//wideName;
 		itemDef[i].bActive = active;
-		itemDef[i].hClient = (DWORD)itemsCreated[i];
+		itemDef[i].hClient = itemsCreated[i]->getClientHandle();
 		itemDef[i].dwBlobSize = 0;
 		itemDef[i].pBlob = NULL;
 		itemDef[i].vtRequestedDataType = VT_EMPTY;
@@ -373,7 +815,15 @@ int COPCGroup::addItems(std::vector<std::string>& itemName, std::vector<COPCItem
 		delete tpm[i];
 	}
 	if (FAILED(result)){
-		throw OPCException("Failed to add items");
+		// the items give their handles back, those beyond the old end of the table are dropped with it
+		for (i = 0; i < noItems; i++){
+			delete itemsCreated[i];
+			itemsCreated[i] = NULL;
+		}
+		items.resize(tableSize);
+		freeClientHandles.erase(std::remove_if(freeClientHandles.begin(), freeClientHandles.end(),
+			[tableSize](OPCHANDLE clientHandle){ return clientHandle >= tableSize; }), freeClientHandles.end());
+		throw OPCException("Failed to add items", result);
 	}
 
 
@@ -381,7 +831,7 @@ int COPCGroup::addItems(std::vector<std::string>& itemName, std::vector<COPCItem
 	int errorCount = 0;
 	for (i = 0; i < noItems; i++){
 		if(itemDetails[i].pBlob){ 
-			COPCClient::comFree(itemDetails[0].pBlob);
+			COPCClient::comFree(itemDetails[i].pBlob);
 		}
 
 		if (FAILED(itemResult[i])){
@@ -405,7 +855,182 @@ int COPCGroup::addItems(std::vector<std::string>& itemName, std::vector<COPCItem
 
 
 
-void COPCGroup::enableAsynch(IAsynchDataCallback &handler){
+int COPCGroup::validateItems(std::vector<std::string>& itemName, std::vector<HRESULT>& errors){
+	errors.resize(itemName.size());
+	if (itemName.empty()){
+		return 0;
+	}
+	OPCITEMDEF *itemDef = new OPCITEMDEF[itemName.size()];
+	std::vector<CT2OLE *> tpm;
+	for (unsigned i = 0; i < itemName.size(); i++){
+		USES_CONVERSION;
+		tpm.push_back(new CT2OLE(itemName[i].c_str()));
+		itemDef[i].szItemID = *tpm.back();
+		itemDef[i].szAccessPath = NULL;
+		itemDef[i].bActive = FALSE;
+		itemDef[i].hClient = 0;
+		itemDef[i].dwBlobSize = 0;
+		itemDef[i].pBlob = NULL;
+		itemDef[i].vtRequestedDataType = VT_EMPTY;
+	}
+
+	HRESULT *itemResult;
+	OPCITEMRESULT *itemDetails;
+	DWORD noItems = (DWORD)itemName.size();
+
+	HRESULT	result = getItemManagementInterface()->ValidateItems(noItems, itemDef, FALSE, &itemDetails, &itemResult);
+	delete[] itemDef;
+	for (unsigned i = 0; i < tpm.size(); i++){
+		delete tpm[i];
+	}
+	if (FAILED(result)){
+		throw OPCException("Failed to validate items", result);
+	}
+
+	int errorCount = 0;
+	for (unsigned i = 0; i < noItems; i++){
+		if (itemDetails[i].pBlob){
+			COPCClient::comFree(itemDetails[i].pBlob);
+		}
+		errors[i] = itemResult[i];
+		if (FAILED(itemResult[i])){
+			errorCount++;
+		}
+	}
+	COPCClient::comFree(itemDetails);
+	COPCClient::comFree(itemResult);
+	return errorCount;
+}
+
+
+
+
+int COPCGroup::removeItems(std::vector<COPCItem *>& itemsToRemove, std::vector<HRESULT>& errors){
+	errors.assign(itemsToRemove.size(), ERROR_SUCCESS);
+	// items the server rejected were never added to it, they are only deleted
+	std::vector<OPCHANDLE> serverHandles;
+	std::vector<unsigned> positions;
+	for (unsigned i = 0; i < itemsToRemove.size(); i++){
+		if (itemsToRemove[i]->created){
+			serverHandles.push_back(itemsToRemove[i]->getHandle());
+			positions.push_back(i);
+		}
+	}
+
+	int errorCount = 0;
+	if (!serverHandles.empty()){
+		HRESULT *itemResult;
+		HRESULT result = getItemManagementInterface()->RemoveItems((DWORD)serverHandles.size(), &serverHandles[0], &itemResult);
+		if (FAILED(result)){
+			throw OPCException("Failed to remove items", result);
+		}
+		for (unsigned j = 0; j < positions.size(); j++){
+			errors[positions[j]] = itemResult[j];
+			if (FAILED(itemResult[j])){
+				errorCount++;
+			}
+		}
+		COPCClient::comFree(itemResult);
+	}
+
+	for (unsigned i = 0; i < itemsToRemove.size(); i++){
+		// already removed from the server, the destructor only frees the client handle
+		itemsToRemove[i]->created = false;
+		delete itemsToRemove[i];
+	}
+	itemsToRemove.clear();
+	return errorCount;
+}
+
+
+
+
+int COPCGroup::setItemDeadbands(std::vector<COPCItem *>& itemsToSet, std::vector<float>& percentDeadbands, std::vector<HRESULT>& errors){
+	if (iItemDeadbandManagement == NULL){
+		throw OPCException("IOPCItemDeadbandMgt not supported", E_NOINTERFACE);
+	}
+	errors.assign(itemsToSet.size(), ERROR_SUCCESS);
+	if (itemsToSet.empty()){
+		return 0;
+	}
+
+	OPCHANDLE *serverHandles = buildServerHandleList(itemsToSet);
+	HRESULT *itemResult;
+	HRESULT result = iItemDeadbandManagement->SetItemDeadband((DWORD)itemsToSet.size(), serverHandles, &percentDeadbands[0], &itemResult);
+	delete []serverHandles;
+	if (FAILED(result)){
+		throw OPCException("Failed to set item deadbands", result);
+	}
+	return storeItemResults(itemResult, errors);
+}
+
+
+
+int COPCGroup::setItemSamplingRates(std::vector<COPCItem *>& itemsToSet, std::vector<DWORD>& samplingRates_ms, std::vector<DWORD>& revisedRates_ms, std::vector<HRESULT>& errors){
+	if (iItemSamplingManagement == NULL){
+		throw OPCException("IOPCItemSamplingMgt not supported", E_NOINTERFACE);
+	}
+	errors.assign(itemsToSet.size(), ERROR_SUCCESS);
+	revisedRates_ms.assign(itemsToSet.size(), 0);
+	if (itemsToSet.empty()){
+		return 0;
+	}
+
+	OPCHANDLE *serverHandles = buildServerHandleList(itemsToSet);
+	DWORD *revised;
+	HRESULT *itemResult;
+	HRESULT result = iItemSamplingManagement->SetItemSamplingRate((DWORD)itemsToSet.size(), serverHandles, &samplingRates_ms[0], &revised, &itemResult);
+	delete []serverHandles;
+	if (FAILED(result)){
+		throw OPCException("Failed to set item sampling rates", result);
+	}
+	for (unsigned i = 0; i < itemsToSet.size(); i++){
+		revisedRates_ms[i] = revised[i];
+	}
+	COPCClient::comFree(revised);
+	return storeItemResults(itemResult, errors);
+}
+
+
+
+int COPCGroup::setItemBufferEnable(std::vector<COPCItem *>& itemsToSet, bool enable, std::vector<HRESULT>& errors){
+	if (iItemSamplingManagement == NULL){
+		throw OPCException("IOPCItemSamplingMgt not supported", E_NOINTERFACE);
+	}
+	errors.assign(itemsToSet.size(), ERROR_SUCCESS);
+	if (itemsToSet.empty()){
+		return 0;
+	}
+
+	OPCHANDLE *serverHandles = buildServerHandleList(itemsToSet);
+	std::vector<BOOL> enables(itemsToSet.size(), enable ? TRUE : FALSE);
+	HRESULT *itemResult;
+	HRESULT result = iItemSamplingManagement->SetItemBufferEnable((DWORD)itemsToSet.size(), serverHandles, &enables[0], &itemResult);
+	delete []serverHandles;
+	if (FAILED(result)){
+		throw OPCException("Failed to set item buffering", result);
+	}
+	return storeItemResults(itemResult, errors);
+}
+
+
+
+int COPCGroup::storeItemResults(HRESULT *itemResult, std::vector<HRESULT>& errors){
+	int errorCount = 0;
+	for (unsigned i = 0; i < errors.size(); i++){
+		errors[i] = itemResult[i];
+		if (FAILED(itemResult[i])){
+			errorCount++;
+		}
+	}
+	COPCClient::comFree(itemResult);
+	return errorCount;
+}
+
+
+
+
+void COPCGroup::adviseDataCallback(){
 	if (!asynchDataCallBackHandler == false){
 		throw OPCException("Asynch already enabled");
 	}
@@ -434,13 +1059,47 @@ void COPCGroup::enableAsynch(IAsynchDataCallback &handler){
 		asynchDataCallBackHandler = NULL;
 		throw OPCException("Failed to set DataCallbackConnectionPoint");
 	}
+}
+
+
+
+
+void COPCGroup::enableAsynch(){
+	adviseDataCallback();
+}
+
 
+
+
+void COPCGroup::enableAsynch(IAsynchDataCallback &handler){
+	adviseDataCallback();
 	userAsynchCBHandler = &handler;
 }
 
 
 
 
+void COPCGroup::enableAsynch(IAsynchSampleCallback &handler){
+	if (!asynchDataCallBackHandler == false){
+		throw OPCException("Asynch already enabled");
+	}
+
+	// size the buffer now, so the callbacks do not have to allocate
+	asynchSamples.resize(items.size());
+
+	// the server may send the initial update from within Advise, so the handler has to be in place before
+	userAsynchSampleHandler = &handler;
+	try {
+		adviseDataCallback();
+	} catch (OPCException &){
+		userAsynchSampleHandler = NULL;
+		throw;
+	}
+}
+
+
+
+
 void COPCGroup::setState(DWORD reqUpdateRate_ms, DWORD &returnedUpdateRate_ms, float deadBand, BOOL active){
 	HRESULT result = iStateManagement->SetState(&reqUpdateRate_ms, &returnedUpdateRate_ms, &active,0, &deadBand,0,0);
 	if (FAILED(result))
@@ -452,6 +1111,23 @@ void COPCGroup::setState(DWORD reqUpdateRate_ms, DWORD &returnedUpdateRate_ms, f
 
 
 
+bool COPCGroup::setKeepAlive(DWORD keepAlive_ms, DWORD &revisedKeepAlive_ms){
+	revisedKeepAlive_ms = 0;
+	if (iStateManagement2 == NULL){
+		return false;
+	}
+	// OPC_S_UNSUPPORTEDRATE is a success code, the revised time tells what the server granted
+	HRESULT result = iStateManagement2->SetKeepAlive(keepAlive_ms, &revisedKeepAlive_ms);
+	if (FAILED(result))
+	{
+		throw OPCException("Failed to set keep-alive", result);
+	}
+	return true;
+}
+
+
+
+
 void COPCGroup::disableAsynch(){
 	if (asynchDataCallBackHandler == NULL){
 		throw OPCException("Asynch is not exabled");
@@ -460,4 +1136,5 @@ void COPCGroup::disableAsynch(){
 	iAsynchDataCallbackConnectionPoint = NULL;
 	asynchDataCallBackHandler = NULL;// WE DO NOT DELETE callbackHandler, let the COM ref counting take care of that
 	userAsynchCBHandler = NULL;
+	userAsynchSampleHandler = NULL;
 }
\ No newline at end of file
@@ -25,14 +25,19 @@ Boston, MA  02111-1307, USA.
 
 
 
-COPCItem::COPCItem(std::string &itemName, COPCGroup &g):
-name(itemName), group(g){
+COPCItem::COPCItem(std::string &itemName, COPCGroup &g, OPCHANDLE handle):
+name(itemName), group(g), clientHandle(handle), serversItemHandle(0), created(false){
 }
 
 
 
 COPCItem::~COPCItem()
 {
+	group.releaseClientHandle(clientHandle);
+	if (!created){
+		// the server rejected the item, its server handle is meaningless
+		return;
+	}
 	HRESULT *itemResult;
 	group.getItemManagementInterface()->RemoveItems(1, &serversItemHandle, &itemResult);
 	COPCClient::comFree(itemResult);
@@ -43,24 +48,22 @@ void COPCItem::setOPCParams(OPCHANDLE handle, VARTYPE type, DWORD dwAccess){
 	serversItemHandle	=handle; 
 	vtCanonicalDataType	=type; 
 	dwAccessRights		=dwAccess;
+	created				=true;
 }
 
 
 
 void COPCItem::writeSync(VARIANT &data){
-	HRESULT * itemWriteErrors; 
-	HRESULT result = group.getSychIOInterface()->Write(1, &serversItemHandle, &data, &itemWriteErrors);
-	if (FAILED(result))
-	{
-		throw OPCException("write failed");
-	} 
+	std::vector<COPCItem *> items;
+	items.push_back(this);
+	std::vector<VARIANT> values;
+	values.push_back(data);
+	std::vector<HRESULT> errors;
+	group.writeSync(items, values, errors);
 
-	if (FAILED(itemWriteErrors[0])){
-		COPCClient::comFree(itemWriteErrors);
-		throw OPCException("write failed");
+	if (FAILED(errors[0])){
+		throw OPCException("write failed", errors[0]);
 	}
-
-	COPCClient::comFree(itemWriteErrors);
 }
 
 
@@ -121,27 +124,11 @@ CTransaction * COPCItem::readAsynch(ITransactionComplete *transactionCB){
 
 
 CTransaction * COPCItem::writeAsynch(VARIANT &data, ITransactionComplete *transactionCB){
-	DWORD cancelID;
-	HRESULT * individualResults;
 	std::vector<COPCItem *> items;
 	items.push_back(this);
-	CTransaction * trans = new CTransaction(items,transactionCB);
-
-	HRESULT result = group.getAsych2IOInterface()->Write(1,&serversItemHandle,&data,(DWORD)trans,&cancelID,&individualResults); 
-	
-	if (FAILED(result)){
-		delete trans;
-		throw OPCException("Asynch Write failed");
-	}
-
-	trans->setCancelId(cancelID);
-	if (FAILED(individualResults[0])){
-		trans->setItemError(this,individualResults[0]);
-		trans->setCompleted(); // if all items return error then no callback will occur. p 104
-	}
-
-	COPCClient::comFree(individualResults);
-	return trans;
+	std::vector<VARIANT> values;
+	values.push_back(data);
+	return group.writeAsync(items, values, transactionCB);
 }
 
 void COPCItem::getSupportedProperties(std::vector<CPropertyDescription> &desc){
@@ -38,9 +38,18 @@ class  COPCItem
 {
 private:
 	OPCHANDLE serversItemHandle;
+	/**
+	* handle the server returns in callbacks and reads. Index of this item in the groups item table.
+	*/
+	OPCHANDLE clientHandle;
     VARTYPE vtCanonicalDataType;
     DWORD dwAccessRights;
 
+	/**
+	* true once the server accepted the item, only then does the destructor remove it from the server
+	*/
+	bool created;
+
 	COPCGroup & group;
 
 	std::string name;
@@ -51,7 +60,7 @@ protected:
 	void setOPCParams(OPCHANDLE handle, VARTYPE type, DWORD dwAccess);
 
 	// items may only be created by group.
-	COPCItem(std::string &itemName, COPCGroup &g);
+	COPCItem(std::string &itemName, COPCGroup &g, OPCHANDLE clientHandle);
 public:
 
 	virtual ~COPCItem();
@@ -82,6 +91,14 @@ public:
 		return serversItemHandle;
 	}	
 
+	OPCHANDLE getClientHandle() const{
+		return clientHandle;
+	}
+
+	VARTYPE getCanonicalDataType() const{
+		return vtCanonicalDataType;
+	}
+
 	const std::string & getName() const{
 		return name;
 	} 
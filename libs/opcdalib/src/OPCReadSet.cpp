@@ -0,0 +1,18 @@
+#include "OPCReadSet.h"
+#include "OPCItem.h"
+
+
+
+COPCReadSet::COPCReadSet(std::vector<COPCItem *>& items){
+	serverHandles.reserve(items.size());
+	clientHandles.reserve(items.size());
+	canonicalTypes.reserve(items.size());
+	for (unsigned i = 0; i < items.size(); i++){
+		if (items[i]==NULL){
+			throw OPCException("Item is NULL");
+		}
+		serverHandles.push_back(items[i]->getHandle());
+		clientHandles.push_back(items[i]->getClientHandle());
+		canonicalTypes.push_back(items[i]->getCanonicalDataType());
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+
+#include "OPCClientToolKitDLL.h"
+#include "opcda.h"
+
+class COPCItem;
+
+
+
+/**
+* A fixed set of items of one group, prepared once for repeated reads. Holds the contiguous server handle
+* array the OPC read calls expect together with the per item data needed to decode the results, so a read
+* neither allocates nor walks the items again. Made by COPCGroup::prepareRead.
+* Deleting an item of the set invalidates it, the server then reports an error for that handle.
+*/
+class COPCReadSet{
+private:
+	std::vector<OPCHANDLE> serverHandles;
+
+	std::vector<OPCHANDLE> clientHandles;
+
+	std::vector<VARTYPE> canonicalTypes;
+
+public:
+	COPCReadSet(std::vector<COPCItem *>& items);
+
+
+	DWORD size() const{
+		return (DWORD)serverHandles.size();
+	}
+
+
+	/**
+	* contiguous array of size() server handles, as passed to IOPCSyncIO::Read
+	*/
+	OPCHANDLE * getServerHandles(){
+		return serverHandles.empty() ? NULL : &serverHandles[0];
+	}
+
+
+	OPCHANDLE getClientHandle(unsigned i) const{
+		return clientHandles[i];
+	}
+
+
+	VARTYPE getCanonicalDataType(unsigned i) const{
+		return canonicalTypes[i];
+	}
+};
@@ -0,0 +1,80 @@
+#include "OPCSampleBuffer.h"
+#include "OPCClient.h"
+
+
+
+COPCSampleBuffer::COPCSampleBuffer(){
+}
+
+
+
+COPCSampleBuffer::~COPCSampleBuffer(){
+	for (unsigned i = 0; i < values.size(); i++){
+		VariantClear(&values[i]);
+	}
+}
+
+
+
+void COPCSampleBuffer::resize(size_t itemTableSize){
+	for (size_t i = itemTableSize; i < values.size(); i++){
+		VariantClear(&values[i]);
+	}
+
+	size_t oldSize = values.size();
+	values.resize(itemTableSize);
+	for (size_t i = oldSize; i < itemTableSize; i++){
+		VariantInit(&values[i]);
+	}
+
+	FILETIME noTime = {0, 0};
+	qualities.resize(itemTableSize, OPC_QUALITY_BAD);
+	timeStamps.resize(itemTableSize, noTime);
+	errors.resize(itemTableSize, S_OK);
+	updated.reserve(itemTableSize);
+}
+
+
+
+void COPCSampleBuffer::set(OPCHANDLE clientHandle, VARIANT &value, WORD quality, FILETIME &time, HRESULT error){
+	VARIANT & target = values[clientHandle];
+	if (target.vt == VT_BSTR && value.vt == VT_BSTR){
+		// SysReAllocStringLen keeps the old buffer when the new string fits
+		if (!SysReAllocStringLen(&target.bstrVal, value.bstrVal, SysStringLen(value.bstrVal))){
+			throw OPCException("SysReAllocStringLen failed");
+		}
+	} else {
+		HRESULT result = VariantCopy(&target, &value);
+		if (FAILED(result)){
+			throw OPCException("VarCopy failed");
+		}
+	}
+
+	qualities[clientHandle] = quality;
+	timeStamps[clientHandle] = time;
+	errors[clientHandle] = error;
+	updated.push_back(clientHandle);
+}
+
+
+
+void COPCSampleBuffer::take(OPCHANDLE clientHandle, VARIANT &value, WORD quality, FILETIME &time, HRESULT error){
+	VARIANT & target = values[clientHandle];
+	VariantClear(&target);
+	target = value;
+	value.vt = VT_EMPTY;
+
+	qualities[clientHandle] = quality;
+	timeStamps[clientHandle] = time;
+	errors[clientHandle] = error;
+	updated.push_back(clientHandle);
+}
+
+
+
+void COPCSampleBuffer::setError(OPCHANDLE clientHandle, HRESULT error){
+	VariantClear(&values[clientHandle]);
+	qualities[clientHandle] = OPC_QUALITY_BAD;
+	errors[clientHandle] = error;
+	updated.push_back(clientHandle);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+
+#include "OPCClientToolKitDLL.h"
+#include "opcda.h"
+
+
+
+/**
+* Reusable, column oriented storage for the results of group reads and data change callbacks.
+* Every column is indexed by the client handle of the item (its index in the groups item table),
+* so filling the buffer in place does not allocate once it has been sized to the item table.
+* VARIANTs in the value column are owned by the buffer.
+*/
+class COPCSampleBuffer{
+public:
+	std::vector<VARIANT> values;
+
+	std::vector<WORD> qualities;
+
+	std::vector<FILETIME> timeStamps;
+
+	std::vector<HRESULT> errors;
+
+	/**
+	* client handles written by the last operation, in the order the server returned them.
+	*/
+	std::vector<OPCHANDLE> updated;
+
+
+	COPCSampleBuffer();
+
+	~COPCSampleBuffer();
+
+
+	/**
+	* make room for an item table of the given size. Keeps existing values, reserves updated for a full read.
+	*/
+	void resize(size_t itemTableSize);
+
+
+	size_t size() const{
+		return values.size();
+	}
+
+
+	/**
+	* forget which items were updated, the values themselves are kept.
+	*/
+	void clearUpdated(){
+		updated.clear();
+	}
+
+
+	/**
+	* store a sample, the value is copied. Strings reuse the previous BSTR where possible.
+	*/
+	void set(OPCHANDLE clientHandle, VARIANT &value, WORD quality, FILETIME &time, HRESULT error);
+
+
+	/**
+	* store a sample and take ownership of the value, which is left VT_EMPTY.
+	* Used for COM out parameters that we would otherwise have to clear anyway.
+	*/
+	void take(OPCHANDLE clientHandle, VARIANT &value, WORD quality, FILETIME &time, HRESULT error);
+
+
+	/**
+	* store an error for an item, its value is cleared.
+	*/
+	void setError(OPCHANDLE clientHandle, HRESULT error);
+
+private:
+	// VARIANTs must not be copied bitwise, so neither may the buffer
+	COPCSampleBuffer(const COPCSampleBuffer &);
+	COPCSampleBuffer & operator=(const COPCSampleBuffer &);
+};
@@ -22,8 +22,86 @@ Boston, MA  02111-1307, USA.
 
 
 
+/**
+* Receives the shutdown request of the server and hands it to the users handler.
+* This is a fake COM object.
+*/
+class CShutdownCallback : public IOPCShutdown
+{
+private:
+	DWORD mRefCount;
+
+	/**
+	* server this is a callback for
+	*/
+	COPCServer &callbacksServer;
+
+
+public:
+	CShutdownCallback(COPCServer &server):callbacksServer(server){
+		mRefCount = 0;
+	}
+
+
+	~CShutdownCallback(){
+
+	}
+
+	/**
+	* Functions associated with IUNKNOWN
+	*/
+	STDMETHODIMP QueryInterface( REFIID iid, LPVOID* ppInterface){
+		if ( ppInterface == NULL){
+			return E_INVALIDARG;
+		}
+
+		if ( iid == IID_IUnknown ){
+			*ppInterface = (IUnknown*) this;
+		} else if ( iid == IID_IOPCShutdown){
+			*ppInterface = (IOPCShutdown*) this;
+		} else
+		{
+			*ppInterface = NULL;
+			return E_NOINTERFACE;
+		}
 
 
+		AddRef();
+		return S_OK;
+	}
+
+
+	STDMETHODIMP_(ULONG) AddRef(){
+		return ++mRefCount;
+	}
+
+
+	STDMETHODIMP_(ULONG) Release(){
+		--mRefCount; 
+
+		if ( mRefCount == 0){
+			delete this;
+		}
+		return mRefCount;
+	}
+
+	/**
+	* Functions associated with IOPCShutdown
+	*/
+	STDMETHODIMP ShutdownRequest(LPCWSTR szReason){
+		IServerShutdownCallback * usrHandler = callbacksServer.getUsrShutdownHandler();
+		if (usrHandler){
+			std::string reason;
+			if (szReason != NULL){
+				USES_CONVERSION;
+				reason = OLE2CT(szReason);
+			}
+			usrHandler->OnShutdown(callbacksServer, reason);
+		}
+		return S_OK;
+	}
+};
+
 
 
 
@@ -32,7 +110,14 @@ Boston, MA  02111-1307, USA.
 
 
 
-COPCServer::COPCServer(ATL::CComPtr<IOPCServer> &opcServerInterface){
+
+
+
+
+COPCServer::COPCServer(ATL::CComPtr<IOPCServer> &opcServerInterface):
+shutdownCallbackHandle(0),
+userShutdownHandler(NULL)
+{
 	iOpcServer = opcServerInterface;
 
 	HRESULT res = opcServerInterface->QueryInterface(IID_IOPCBrowseServerAddressSpace, (void**)&iOpcNamespace);
@@ -50,6 +135,9 @@ COPCServer::COPCServer(ATL::CComPtr<IOPCServer> &opcServerInterface){
 
 COPCServer::~COPCServer()
 {
+	if (shutdownCallBackHandler != NULL){
+		disableShutdownNotification();
+	}
 }
 
 
@@ -119,4 +207,50 @@ void COPCServer::getStatus(ServerStatus &status){
 		COPCClient::comFree(serverStatus->szVendorInfo);
 	}
 	COPCClient::comFree(serverStatus);
-}
\ No newline at end of file
+}
+
+
+
+void COPCServer::enableShutdownNotification(IServerShutdownCallback &handler){
+	if (!shutdownCallBackHandler == false){
+		throw OPCException("Shutdown notification already enabled");
+	}
+
+	ATL::CComPtr<IConnectionPointContainer> iConnectionPointContainer = 0;
+	HRESULT result = iOpcServer->QueryInterface(IID_IConnectionPointContainer, (void**)&iConnectionPointContainer);
+	if (FAILED(result))
+	{
+		throw OPCException("Could not get IID_IConnectionPointContainer", result);
+	}
+
+	result = iConnectionPointContainer->FindConnectionPoint(IID_IOPCShutdown, &iShutdownConnectionPoint);
+	if (FAILED(result))
+	{
+		throw OPCException("Could not get IID_IOPCShutdown", result);
+	}
+
+	// the server may call back from within Advise, so the handler has to be in place before
+	userShutdownHandler = &handler;
+	shutdownCallBackHandler = new CShutdownCallback(*this);
+	result = iShutdownConnectionPoint->Advise(shutdownCallBackHandler, &shutdownCallbackHandle);
+	if (FAILED(result))
+	{
+		iShutdownConnectionPoint = NULL;
+		shutdownCallBackHandler = NULL;
+		userShutdownHandler = NULL;
+		throw OPCException("Failed to set ShutdownConnectionPoint", result);
+	}
+}
+
+
+
+void COPCServer::disableShutdownNotification(){
+	if (shutdownCallBackHandler == NULL){
+		throw OPCException("Shutdown notification is not enabled");
+	}
+	// a server that already went away fails the call, the sink is released either way
+	iShutdownConnectionPoint->Unadvise(shutdownCallbackHandle);
+	iShutdownConnectionPoint = NULL;
+	shutdownCallBackHandler = NULL;// WE DO NOT DELETE the sink, let the COM ref counting take care of that
+	userShutdownHandler = NULL;
+}
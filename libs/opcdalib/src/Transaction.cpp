@@ -1,30 +1,99 @@
 #include ".\transaction.h"
+#include "OPCItem.h"
 
 
 CTransaction::CTransaction(ITransactionComplete * completeCB)
-:completed(FALSE), cancelID(0xffffffff), completeCallBack(completeCB){
+:completed(FALSE), completing(false), deletedByCallback(NULL), cancelID(0xffffffff), registry(NULL), transactionID(0), completeCallBack(completeCB), samples(NULL){
 }
 
 
 
 CTransaction::CTransaction(std::vector<COPCItem *>&items, ITransactionComplete * completeCB)
-:completed(FALSE), cancelID(0xffffffff), completeCallBack(completeCB){
+:completed(FALSE), completing(false), deletedByCallback(NULL), cancelID(0xffffffff), registry(NULL), transactionID(0), completeCallBack(completeCB), samples(NULL){
 	for (unsigned i = 0; i < items.size(); i++){
 		opcData.SetAt(items[i],NULL);
 	}
 }
 
 
+
+CTransaction::CTransaction(COPCSampleBuffer &sampleBuffer, ITransactionComplete * completeCB)
+:completed(FALSE), completing(false), deletedByCallback(NULL), cancelID(0xffffffff), registry(NULL), transactionID(0), completeCallBack(completeCB), samples(&sampleBuffer){
+	samples->clearUpdated();
+}
+
+
+
+CTransaction::~CTransaction(){
+	// remove() checks under the registry lock whether this is still pending
+	CTransactionRegistry * pending = registry;
+	if (pending){
+		pending->remove(*this);
+	}
+
+	std::unique_lock<std::recursive_mutex> guard(completionMutex);
+	waitForCompletion(guard);
+	if (completing && deletedByCallback){
+		*deletedByCallback = true;
+	}
+}
+
+
+void CTransaction::reset(ITransactionComplete * completeCB){
+	CTransactionRegistry * pending = registry;
+	if (pending){
+		pending->remove(*this);
+	}
+
+	// a callback on another thread may still read the results
+	std::unique_lock<std::recursive_mutex> guard(completionMutex);
+	waitForCompletion(guard);
+
+	POSITION pos = opcData.GetStartPosition();
+	while (pos != NULL){
+		OPCItemData * data = opcData.GetNextValue(pos);
+		if (data){
+			delete data;
+		}
+	}
+	opcData.RemoveAll();
+	if (samples){
+		samples->clearUpdated();
+	}
+
+	completed = FALSE;
+	promise.reset();
+	cancelID = 0xffffffff;
+	completeCallBack = completeCB;
+}
+
+
+
 void CTransaction::setItemError(COPCItem *item, HRESULT error){
-	CAtlMap<COPCItem *, OPCItemData *>::CPair* pair = opcData.Lookup(item);
-	opcData.SetValueAt(pair,new OPCItemData(error));
+	if (samples){
+		samples->setError(item->getClientHandle(), error);
+		return;
+	}
+	setItemData(item, new OPCItemData(error));
 }
 
 
 
 void CTransaction::setItemValue(COPCItem *item, FILETIME time, WORD qual, VARIANT & val, HRESULT err){
+	setItemData(item, new OPCItemData(time, qual, val, err));
+}
+
+
+
+void CTransaction::setItemData(COPCItem *item, OPCItemData *data){
+	// a recycled transaction does not know its items in advance
 	CAtlMap<COPCItem *, OPCItemData *>::CPair* pair = opcData.Lookup(item);
-	opcData.SetValueAt(pair,new OPCItemData(time, qual, val, err));
+	if (pair == NULL){
+		opcData.SetAt(item, data);
+		return;
+	}
+	delete pair->m_value;
+	opcData.SetValueAt(pair, data);
 }
 
 
@@ -35,9 +104,81 @@ const OPCItemData * CTransaction::getItemValue(COPCItem *item) const{
 	return pair->m_value;
 }
 
+bool CTransaction::isCompeleted() const{
+	std::lock_guard<std::recursive_mutex> guard(completionMutex);
+	return completed;
+}
+
+
+
+std::future<void> CTransaction::getFuture(){
+	std::lock_guard<std::recursive_mutex> guard(completionMutex);
+	if (promise){
+		throw OPCException("Future already taken");
+	}
+	promise.reset(new std::promise<void>());
+	if (completed){
+		promise->set_value();
+	}
+	return promise->get_future();
+}
+
+
+
 void CTransaction::setCompleted(){
+	beginCompletion();
+	finishCompletion();
+}
+
+
+
+void CTransaction::beginCompletion(){
+	std::lock_guard<std::recursive_mutex> guard(completionMutex);
 	completed = TRUE;
-	if (completeCallBack){
-		completeCallBack->complete(*this);
+	completing = true;
+	completingThread = std::this_thread::get_id();
+}
+
+
+
+void CTransaction::finishCompletion(){
+	ITransactionComplete * callBack;
+	bool deleted = false;
+	// a callback may start another operation on its transaction that completes right away, its completion ends first
+	bool * outerDeleted;
+	{
+		std::lock_guard<std::recursive_mutex> guard(completionMutex);
+		if (promise){
+			promise->set_value();
+		}
+		callBack = completeCallBack;
+		outerDeleted = deletedByCallback;
+		deletedByCallback = &deleted;
+	}
+
+	// called without a lock, so the callback can reset or delete the transaction
+	if (callBack){
+		callBack->complete(*this);
+	}
+	if (deleted){
+		if (outerDeleted){
+			*outerDeleted = true;
+		}
+		return;
 	}
+
+	std::lock_guard<std::recursive_mutex> guard(completionMutex);
+	deletedByCallback = outerDeleted;
+	if (outerDeleted == NULL){
+		completing = false;
+		completionDone.notify_all();
+	}
+}
+
+
+
+void CTransaction::waitForCompletion(std::unique_lock<std::recursive_mutex> &guard){
+	completionDone.wait(guard, [this](){
+		return !completing || completingThread == std::this_thread::get_id();
+	});
 }
@@ -0,0 +1,80 @@
+#include "TransactionPool.h"
+
+#include <chrono>
+
+
+
+CTransactionPool::~CTransactionPool(){
+	for (unsigned i = 0; i < entries.size(); i++){
+		delete entries[i];
+	}
+}
+
+
+
+CTransaction * CTransactionPool::acquire(ITransactionComplete * completeCB){
+	CTransaction * transaction = NULL;
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		if (idle.empty()){
+			Entry * entry = new Entry();
+			entries.push_back(entry);
+			transaction = &entry->transaction;
+		} else {
+			transaction = idle.back();
+			idle.pop_back();
+		}
+	}
+	transaction->reset(completeCB);
+	return transaction;
+}
+
+
+
+void CTransactionPool::release(CTransaction * transaction){
+	// drop the callback and leave the registry now rather than when the transaction is handed out again
+	transaction->reset();
+	std::lock_guard<std::mutex> guard(mutex);
+	idle.push_back(transaction);
+}
+
+
+
+size_t CTransactionPool::size(){
+	std::lock_guard<std::mutex> guard(mutex);
+	return entries.size();
+}
+
+
+
+void CTransactionQueue::complete(CTransaction &transaction){
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		completed.push_back(&transaction);
+	}
+	ready.notify_one();
+}
+
+
+
+CTransaction * CTransactionQueue::waitNext(DWORD timeout_ms){
+	std::unique_lock<std::mutex> guard(mutex);
+	if (!ready.wait_for(guard, std::chrono::milliseconds(timeout_ms), [this](){ return !completed.empty(); })){
+		return NULL;
+	}
+	CTransaction * transaction = completed.front();
+	completed.pop_front();
+	return transaction;
+}
+
+
+
+CTransaction * CTransactionQueue::next(){
+	std::lock_guard<std::mutex> guard(mutex);
+	if (completed.empty()){
+		return NULL;
+	}
+	CTransaction * transaction = completed.front();
+	completed.pop_front();
+	return transaction;
+}
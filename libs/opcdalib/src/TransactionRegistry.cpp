@@ -0,0 +1,97 @@
+#include "TransactionRegistry.h"
+#include "Transaction.h"
+
+
+
+CTransactionRegistry::Completion::Completion(CTransactionRegistry &registry, DWORD transactionId):
+registry(registry), guard(registry.mutex), transaction(NULL), transactionId(transactionId){
+	DWORD index = transactionId & 0xffff;
+	if (index >= registry.slots.size() || registry.slots[index].transaction == NULL ||
+		registry.slots[index].generation != (transactionId >> 16)){
+		// cancelled, timed out or never ours
+		return;
+	}
+	transaction = registry.slots[index].transaction;
+}
+
+
+
+CTransactionRegistry::Completion::~Completion(){
+	// released only now, so whoever resets or deletes the transaction meanwhile waits in remove() until the results
+	// are in
+	if (transaction){
+		registry.release(transactionId);
+	}
+}
+
+
+
+void CTransactionRegistry::Completion::complete(){
+	CTransaction * completed = transaction;
+	transaction = NULL;
+	registry.release(transactionId);
+	// marked while still locked, so a reset or delete that finds it out of the registry waits for the callback
+	completed->beginCompletion();
+	guard.unlock();
+	completed->finishCompletion();
+}
+
+
+
+CTransactionRegistry::~CTransactionRegistry(){
+	for (unsigned i = 0; i < slots.size(); i++){
+		if (slots[i].transaction){
+			slots[i].transaction->registry = NULL;
+		}
+	}
+}
+
+
+
+DWORD CTransactionRegistry::add(CTransaction &transaction){
+	std::lock_guard<std::mutex> guard(mutex);
+	if (freeSlots.empty()){
+		if (slots.size() > 0xffff){
+			throw OPCException("Too many pending transactions");
+		}
+		Slot slot = {NULL, 1};
+		slots.push_back(slot);
+		freeSlots.push_back((WORD)(slots.size() - 1));
+	}
+	WORD index = freeSlots.back();
+	freeSlots.pop_back();
+	slots[index].transaction = &transaction;
+	transaction.registry = this;
+	transaction.transactionID = ((DWORD)slots[index].generation << 16) | index;
+	return transaction.transactionID;
+}
+
+
+
+bool CTransactionRegistry::remove(CTransaction &transaction){
+	std::lock_guard<std::mutex> guard(mutex);
+	if (transaction.registry != this){
+		return false;
+	}
+	release(transaction.transactionID);
+	return true;
+}
+
+
+
+size_t CTransactionRegistry::size(){
+	std::lock_guard<std::mutex> guard(mutex);
+	return slots.size() - freeSlots.size();
+}
+
+
+
+void CTransactionRegistry::release(DWORD transactionId){
+	WORD index = (WORD)(transactionId & 0xffff);
+	Slot &slot = slots[index];
+	slot.transaction->registry = NULL;
+	slot.transaction = NULL;
+	// the next transaction in this slot gets a new id, generation 0 is skipped so an id is never 0
+	slot.generation = slot.generation == 0xffff ? 1 : slot.generation + 1;
+	freeSlots.push_back(index);
+}
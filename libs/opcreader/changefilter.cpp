@@ -0,0 +1,235 @@
+#include "changefilter.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+// tags checked in one pass over the columns, the pass results live on the stack
+constexpr std::size_t compare_block = 256;
+
+// tags whose flags are tested at once when looking for candidates
+constexpr std::size_t flag_word = sizeof(std::uint64_t);
+
+constexpr double never = std::numeric_limits<double>::infinity();
+
+double to_ms(std::chrono::steady_clock::time_point time) {
+  return std::chrono::duration<double, std::milli>(time.time_since_epoch()).count();
+}
+
+// number of consecutive tag indices at the start of indices, at most count
+std::size_t run_length(std::uint32_t const* indices, std::size_t count) {
+  // a whole block of consecutive indices is the common case of a poll, it is checked without a branch per index.
+  // Scattered indices fail the test of the last one.
+  if (indices[count - 1] == indices[0] + count - 1) {
+    std::uint32_t mismatch = 0;
+    for (std::size_t j = 0; j < count; j++) {
+      mismatch |= indices[j] ^ (indices[0] + static_cast<std::uint32_t>(j));
+    }
+    if (mismatch == 0) {
+      return count;
+    }
+  }
+  std::size_t length = 1;
+  while (length < count && indices[length] == indices[0] + length) {
+    length++;
+  }
+  return length;
+}
+
+// true if one of the count tags is flagged, the flags are or-ed without a branch per tag
+bool any_flagged(double const* moved, std::uint8_t const* changed, std::size_t count) {
+  std::uint64_t any = 0;
+  for (std::size_t j = 0; j < count; j++) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &moved[j], sizeof(bits));
+    any |= bits | changed[j];
+  }
+  return any != 0;
+}
+
+}  // namespace
+
+void change_filter::configure(std::vector<opc_data_point> const& data_points, unsigned long t_default_max_publish_ms) {
+  std::unique_lock lock(mutex);
+  default_max_publish_ms = t_default_max_publish_ms;
+  auto tag_count = data_points.size();
+  deadband.assign(tag_count, 0.0);
+  is_text.assign(tag_count, 0);
+  max_publish_ms.assign(tag_count, 0.0);
+  published.assign(tag_count, 0.0);
+  published_text.assign(tag_count, std::string());
+  published_quality.assign(tag_count, 0);
+  published_error.assign(tag_count, 0);
+  published_timestamp.assign(tag_count, {});
+  republish_due_ms.assign(tag_count, -never);
+  for (std::size_t i = 0; i < tag_count; i++) {
+    set_tag(i, data_points[i]);
+  }
+  shortest_max_publish_ms = tag_count != 0 ? *std::min_element(max_publish_ms.begin(), max_publish_ms.end()) : never;
+}
+
+void change_filter::update(std::vector<opc_data_point> const& data_points, std::vector<std::uint32_t> const& changed) {
+  std::unique_lock lock(mutex);
+  auto tag_count = data_points.size();
+  deadband.resize(tag_count, 0.0);
+  is_text.resize(tag_count, 0);
+  max_publish_ms.resize(tag_count, 0.0);
+  published.resize(tag_count, 0.0);
+  published_text.resize(tag_count);
+  published_quality.resize(tag_count, 0);
+  published_error.resize(tag_count, 0);
+  published_timestamp.resize(tag_count);
+  republish_due_ms.resize(tag_count, -never);
+  for (auto i : changed) {
+    set_tag(i, data_points[i]);
+  }
+  shortest_max_publish_ms = tag_count != 0 ? *std::min_element(max_publish_ms.begin(), max_publish_ms.end()) : never;
+}
+
+void change_filter::set_tag(std::size_t index, opc_data_point const& data_point) {
+  is_text[index] = data_point.dataType == opc_data_types::STRING ? 1 : 0;
+  // text tags have no numeric value, a negative deadband makes each of them a candidate for the string compare
+  deadband[index] = is_text[index] ? -1.0 : data_point.deadband;
+  auto max_publish = data_point.max_publish_ms != 0 ? data_point.max_publish_ms : default_max_publish_ms;
+  max_publish_ms[index] = max_publish != 0 ? static_cast<double>(max_publish) : never;
+  // due right away, so the next value passes
+  republish_due_ms[index] = -never;
+}
+
+void change_filter::mark_candidates(sample_buffer const& samples,
+                                    std::size_t first,
+                                    std::size_t count,
+                                    double now_ms,
+                                    double* moved,
+                                    std::uint8_t* changed) const {
+  // plain pointers and branch free bodies, so the compiler vectorises the loops. Each loop compares columns of one
+  // width, which plain SSE2 can do.
+  auto const* value = &samples.numeric[first];
+  auto const* last_value = &published[first];
+  auto const* band = &deadband[first];
+  auto const* due = &republish_due_ms[first];
+  for (std::size_t j = 0; j < count; j++) {
+    // a NaN difference counts as a move
+    moved[j] = (!(std::abs(value[j] - last_value[j]) <= band[j]) | (now_ms >= due[j])) ? 1.0 : 0.0;
+  }
+  auto const* quality = &samples.quality[first];
+  auto const* error = &samples.error[first];
+  auto const* last_quality = &published_quality[first];
+  auto const* last_error = &published_error[first];
+  for (std::size_t j = 0; j < count; j++) {
+    changed[j] = static_cast<std::uint8_t>((quality[j] != last_quality[j]) | (error[j] != last_error[j]));
+  }
+}
+
+void change_filter::apply(sample_buffer& samples, std::chrono::steady_clock::time_point now) {
+  std::shared_lock lock(mutex);
+  auto& updated = samples.updated;
+  auto tag_count = published.size();
+  auto now_ms = to_ms(now);
+  std::array<double, compare_block> moved;
+  std::array<std::uint8_t, compare_block> changed;
+  std::size_t kept = 0;
+  std::size_t k = 0;
+  while (k < updated.size()) {
+    // polls deliver the tags of a group in runs of consecutive indices, each run is checked in one pass
+    std::size_t first = updated[k];
+    // a tag a reload added after the batch was read is passed on unfiltered
+    if (first >= tag_count) {
+      updated[kept++] = static_cast<std::uint32_t>(first);
+      k++;
+      continue;
+    }
+    auto count = run_length(&updated[k], std::min({compare_block, updated.size() - k, tag_count - first}));
+    k += count;
+    mark_candidates(samples, first, count, now_ms, moved.data(), changed.data());
+
+    for (std::size_t word = 0; word < count; word += flag_word) {
+      // most tags did not change, so their flags are tested a word at a time
+      auto word_end = std::min(word + flag_word, count);
+      if (!any_flagged(&moved[word], &changed[word], word_end - word)) {
+        continue;
+      }
+      for (auto j = word; j < word_end; j++) {
+        if (changed[j] == 0 && moved[j] == 0.0) {
+          continue;
+        }
+        auto i = first + j;
+        auto publish = changed[j] != 0 || now_ms >= republish_due_ms[i];
+        if (!publish && is_text[i]) {
+          publish = samples.text[i] != published_text[i];
+        } else if (!publish) {
+          // a value turning into NaN or back is a change, NaN staying NaN is not
+          publish = std::abs(samples.numeric[i] - published[i]) > deadband[i] ||
+                    std::isnan(samples.numeric[i]) != std::isnan(published[i]);
+        }
+        if (!publish) {
+          continue;
+        }
+        published[i] = samples.numeric[i];
+        if (is_text[i]) {
+          published_text[i] = samples.text[i];
+        }
+        published_quality[i] = samples.quality[i];
+        published_error[i] = samples.error[i];
+        published_timestamp[i] = samples.timestamp[i];
+        republish_due_ms[i] = now_ms + max_publish_ms[i];
+        updated[kept++] = static_cast<std::uint32_t>(i);
+      }
+    }
+  }
+  received_count.fetch_add(updated.size(), std::memory_order_relaxed);
+  passed_count.fetch_add(kept, std::memory_order_relaxed);
+  updated.resize(kept);
+}
+
+std::chrono::steady_clock::time_point change_filter::republish_due(sample_buffer& samples,
+                                                                  std::chrono::steady_clock::time_point now) {
+  std::unique_lock lock(mutex);
+  auto now_ms = to_ms(now);
+  // the first value of a tag a reload changed may arrive after this pass, it is due again at most this late
+  auto next_due_ms = now_ms + shortest_max_publish_ms;
+  samples.updated.clear();
+  for (std::size_t i = 0; i < republish_due_ms.size(); i++) {
+    // nothing was published yet, or the tag is never republished
+    if (republish_due_ms[i] == -never || republish_due_ms[i] == never) {
+      continue;
+    }
+    if (now_ms < republish_due_ms[i]) {
+      next_due_ms = std::min(next_due_ms, republish_due_ms[i]);
+      continue;
+    }
+    samples.numeric[i] = published[i];
+    if (is_text[i]) {
+      samples.text[i] = published_text[i];
+    }
+    samples.quality[i] = published_quality[i];
+    samples.error[i] = published_error[i];
+    samples.timestamp[i] = published_timestamp[i];
+    republish_due_ms[i] = now_ms + max_publish_ms[i];
+    next_due_ms = std::min(next_due_ms, republish_due_ms[i]);
+    samples.updated.push_back(static_cast<std::uint32_t>(i));
+  }
+  if (next_due_ms == never) {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  auto next_due = std::chrono::duration<double, std::milli>(next_due_ms);
+  return std::chrono::steady_clock::time_point(
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(next_due));
+}
+
+void change_filter::report(std::string_view name) {
+  auto received = received_count.exchange(0, std::memory_order_relaxed);
+  auto passed = passed_count.exchange(0, std::memory_order_relaxed);
+  if (received == 0) {
+    return;
+  }
+  spdlog::info("opc_reader: {} change filter passed {} of {} values ({:.1f}%)", name, passed, received,
+               100.0 * static_cast<double>(passed) / static_cast<double>(received));
+}
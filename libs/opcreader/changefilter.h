@@ -0,0 +1,82 @@
+#ifndef CHANGEFILTER_H
+#define CHANGEFILTER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "tagsource.h"
+
+// client side exception reporting. Many servers ignore the deadband of a group and deliver every value of every poll,
+// the filter drops the values that did not change before they are published.
+// A tag passes if its numeric value moved by more than its deadband from the value published last, its text, quality
+// or error changed, or it was not published for max_publish_ms. The first value of a tag always passes.
+class change_filter {
+ public:
+  // sets up the tags of data_points, tags without a max_publish_ms of their own use default_max_publish_ms. 0 never
+  // republishes an unchanged value.
+  void configure(std::vector<opc_data_point> const& data_points, unsigned long t_default_max_publish_ms);
+
+  // after a reload: grows to data_points and takes the settings of the changed tags, their next value passes
+  void update(std::vector<opc_data_point> const& data_points, std::vector<std::uint32_t> const& changed);
+
+  // removes the tags that did not change from samples.updated and keeps the order of the others. Batches of different
+  // groups may be filtered concurrently, they never share a tag.
+  void apply(sample_buffer& samples, std::chrono::steady_clock::time_point now);
+
+  // a subscribed tag whose value does not change gets no data change that apply could pass again. Lists the tags
+  // whose republish is due in samples.updated with the values published last, as if they had been read again, and
+  // returns when the next tag is due. samples has to be sized to the tags.
+  std::chrono::steady_clock::time_point republish_due(sample_buffer& samples,
+                                                      std::chrono::steady_clock::time_point now);
+
+  // logs and resets the number of values received and passed
+  void report(std::string_view name);
+
+ private:
+  // flags the tags of the run first .. first + count that may have to be published, in one pass over the contiguous
+  // columns. moved[j] is set if the numeric value of tag first + j moved by more than its deadband or its republish is
+  // due, which includes the first value, changed[j] if its quality or error changed. Text tags always count as moved,
+  // the caller compares their strings.
+  void mark_candidates(sample_buffer const& samples,
+                       std::size_t first,
+                       std::size_t count,
+                       double now_ms,
+                       double* moved,
+                       std::uint8_t* changed) const;
+
+  // sets the columns of tag index from data_point and forgets what was published for it, called with mutex held
+  void set_tag(std::size_t index, opc_data_point const& data_point);
+
+  // apply holds it shared, configure, update and republish_due exclusively
+  std::shared_mutex mutex;
+  unsigned long default_max_publish_ms{0};
+
+  // columns by tag index. is_text holds bytes rather than a vector<bool>, whose bits would be shared by neighbouring
+  // tags.
+  std::vector<double> deadband;
+  std::vector<std::uint8_t> is_text;
+  // infinite for tags that are never republished
+  std::vector<double> max_publish_ms;
+  // the smallest of max_publish_ms, a tag a reload changed is due again at most this long after its first value
+  double shortest_max_publish_ms{std::numeric_limits<double>::infinity()};
+
+  // what was published last, and the steady clock time in ms at which an unchanged value is due again. A tag without
+  // a published value is due at minus infinity. Times are doubles, so the check runs in the same pass as the values.
+  std::vector<double> published;
+  std::vector<std::string> published_text;
+  std::vector<std::uint16_t> published_quality;
+  std::vector<std::int32_t> published_error;
+  std::vector<std::chrono::system_clock::time_point> published_timestamp;
+  std::vector<double> republish_due_ms;
+
+  std::atomic<std::uint64_t> received_count{0};
+  std::atomic<std::uint64_t> passed_count{0};
+};
+
+#endif  // CHANGEFILTER_H
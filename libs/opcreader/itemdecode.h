@@ -0,0 +1,44 @@
+#ifndef ITEMDECODE_H
+#define ITEMDECODE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "tagsource.h"
+
+// copies the items a server delivered into the tag indexed samples. Free of COM, so the mapping can be tested on any
+// platform with plain values.
+// The count client handles name the items, values, qualities, times and errors are indexed by client handle, as are
+// vec_tag_index and vec_data_type. decode_value(data_type, value, samples, index) stores a value, to_time(time)
+// converts a timestamp. An item with a failed error keeps its last value and timestamp but is listed in
+// samples.updated, so its quality and error are published.
+template <typename Handle, typename Value, typename Time, typename Error, typename Decode_Value, typename To_Time>
+void decode_item_samples(std::size_t count,
+                         Handle const* handles,
+                         Value const* values,
+                         std::uint16_t const* qualities,
+                         Time const* times,
+                         Error const* errors,
+                         std::vector<std::size_t> const& vec_tag_index,
+                         std::vector<opc_data_types> const& vec_data_type,
+                         sample_buffer& samples,
+                         Decode_Value&& decode_value,
+                         To_Time&& to_time) {
+  samples.updated.clear();
+  for (std::size_t i = 0; i < count; i++) {
+    auto client_handle = handles[i];
+    auto index = vec_tag_index[client_handle];
+    samples.error[index] = static_cast<std::int32_t>(errors[client_handle]);
+    samples.quality[index] = qualities[client_handle];
+    if (samples.error[index] < 0) {
+      samples.updated.push_back(static_cast<std::uint32_t>(index));
+      continue;
+    }
+    decode_value(vec_data_type[client_handle], values[client_handle], samples, index);
+    samples.timestamp[index] = to_time(times[client_handle]);
+    samples.updated.push_back(static_cast<std::uint32_t>(index));
+  }
+}
+
+#endif  // ITEMDECODE_H
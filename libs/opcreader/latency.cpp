@@ -0,0 +1,86 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include <spdlog/spdlog.h>
+
+std::size_t latency_histogram::bucket_index(std::uint64_t us) {
+  us = std::min(us, (std::uint64_t{1} << max_value_bits) - 1);
+  // the top sub_bucket_bits + 1 bits select the bucket, values below 2 * sub_bucket_count get a bucket each
+  unsigned width = static_cast<unsigned>(std::bit_width(us));
+  unsigned shift = width > sub_bucket_bits + 1 ? width - sub_bucket_bits - 1 : 0;
+  return shift * sub_bucket_count + (us >> shift);
+}
+
+std::uint64_t latency_histogram::bucket_upper_bound(std::size_t index) {
+  if (index < 2 * sub_bucket_count) {
+    return index;
+  }
+  auto shift = index / sub_bucket_count - 1;
+  auto top = index % sub_bucket_count + sub_bucket_count;
+  return ((top + 1) << shift) - 1;
+}
+
+void latency_histogram::record(std::chrono::nanoseconds duration) {
+  auto us = static_cast<std::uint64_t>(std::max<std::int64_t>(
+    std::chrono::duration_cast<std::chrono::microseconds>(duration).count(), 0));
+  buckets[bucket_index(us)].fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(1, std::memory_order_relaxed);
+
+  auto current = max_us.load(std::memory_order_relaxed);
+  while (us > current && !max_us.compare_exchange_weak(current, us, std::memory_order_relaxed)) {
+  }
+}
+
+std::chrono::microseconds latency_histogram::percentile(double p) const {
+  auto n = count();
+  if (n == 0) {
+    return std::chrono::microseconds(0);
+  }
+  auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(p * static_cast<double>(n))));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < bucket_count; i++) {
+    seen += buckets[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      // the bucket bound can lie above the largest value actually seen
+      return std::min(std::chrono::microseconds(bucket_upper_bound(i)), max());
+    }
+  }
+  return max();
+}
+
+void latency_histogram::reset() {
+  for (auto& bucket : buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  total.store(0, std::memory_order_relaxed);
+  max_us.store(0, std::memory_order_relaxed);
+}
+
+void cycle_latency::log(std::string_view name) const {
+  auto log_phase = [name](std::string_view phase, latency_histogram const& h) {
+    if (h.count() == 0) {
+      return;
+    }
+    spdlog::info("opc_reader: {} {:<7} n {:>7} p50 {:>8}us p99 {:>8}us p999 {:>8}us max {:>8}us", name, phase,
+                 h.count(), h.percentile(0.5).count(), h.percentile(0.99).count(), h.percentile(0.999).count(),
+                 h.max().count());
+  };
+  log_phase("read", read);
+  log_phase("cache", cache_read);
+  log_phase("device", device_read);
+  log_phase("decode", decode);
+  log_phase("publish", publish);
+  log_phase("cycle", cycle);
+}
+
+void cycle_latency::reset() {
+  read.reset();
+  cache_read.reset();
+  device_read.reset();
+  decode.reset();
+  publish.reset();
+  cycle.reset();
+}
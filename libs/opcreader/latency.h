@@ -0,0 +1,57 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+// fixed bucket histogram of durations in microseconds. Buckets are linear within each power of two (log-linear),
+// so the relative error of a percentile is below 1/16 from 32us up to the largest bucket at about 12 days.
+// record() is a few relaxed atomic adds, so it can be called from any thread without a lock.
+class latency_histogram {
+ public:
+  static constexpr unsigned sub_bucket_bits = 4;
+  static constexpr std::uint64_t sub_bucket_count = 1 << sub_bucket_bits;
+  static constexpr unsigned max_value_bits = 40;
+  static constexpr std::size_t bucket_count = (max_value_bits - sub_bucket_bits + 1) * sub_bucket_count;
+
+  void record(std::chrono::nanoseconds duration);
+
+  std::uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+  // upper bound of the bucket holding the p-th fraction of the recorded values, p in [0, 1]
+  std::chrono::microseconds percentile(double p) const;
+
+  std::chrono::microseconds max() const { return std::chrono::microseconds(max_us.load(std::memory_order_relaxed)); }
+
+  void reset();
+
+  static std::size_t bucket_index(std::uint64_t us);
+  static std::uint64_t bucket_upper_bound(std::size_t index);
+
+ private:
+  std::array<std::atomic<std::uint64_t>, bucket_count> buckets{};
+  std::atomic<std::uint64_t> total{0};
+  std::atomic<std::uint64_t> max_us{0};
+};
+
+// phases of one acquisition cycle of a group: the server call, converting its result into the sample buffer,
+// handing the samples on, and the whole cycle. The server calls are also split by where the server took the values
+// from, to compare cache and device reads.
+struct cycle_latency {
+  latency_histogram read;
+  latency_histogram cache_read;
+  latency_histogram device_read;
+  latency_histogram decode;
+  latency_histogram publish;
+  latency_histogram cycle;
+
+  // logs p50/p99/p999/max of every phase that has samples
+  void log(std::string_view name) const;
+
+  void reset();
+};
+
+#endif  // LATENCY_H
@@ -0,0 +1,42 @@
+#ifndef OPCDACONFIG_H
+#define OPCDACONFIG_H
+
+#include <cstddef>
+#include <map>
+
+// where the reads of a group take their values from. DEVICE makes the server ask the device on every read, CACHE
+// returns what the server last acquired at the update rate of the group. CACHE_VERIFY reads the cache and goes to the
+// device at least every verify_interval_ms, so values the cache got wrong do not stay unnoticed.
+enum struct group_read_mode { DEVICE, CACHE, CACHE_VERIFY };
+
+struct group_read_config {
+  group_read_mode mode{group_read_mode::DEVICE};
+  unsigned long verify_interval_ms{60000};
+};
+
+// tuning of the OPC DA source, read from the opcDa object of the ini file. Kept free of COM headers so the reader
+// can parse it on every platform.
+struct opc_da_config {
+  // asynchronous reads a poll group keeps outstanding, 0 reads synchronously
+  std::size_t read_pipeline_depth{0};
+  // an asynchronous read not completed after this long is cancelled
+  unsigned long read_timeout_ms{10000};
+  // items added to a group per AddItems call
+  std::size_t add_items_chunk_size{1000};
+  // check the item ids with ValidateItems before adding them
+  bool validate_items{false};
+  // subscribed groups ask the server for a data change callback at least every keep_alive_ms, even without changes,
+  // so a silent group shows a dead connection. 0 turns it off, only DA 3.0 servers support it.
+  unsigned long keep_alive_ms{0};
+  // reads of the groups without an entry in group_reads
+  group_read_config reads;
+  // by requested update rate of the group in ms
+  std::map<unsigned long, group_read_config> group_reads;
+
+  group_read_config const& reads_for(unsigned long rate_ms) const {
+    auto it = group_reads.find(rate_ms);
+    return it != group_reads.end() ? it->second : reads;
+  }
+};
+
+#endif  // OPCDACONFIG_H
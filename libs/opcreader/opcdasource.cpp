@@ -0,0 +1,939 @@
+#include "opcdasource.h"
+
+#include <algorithm>
+#include <map>
+#include <unordered_set>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <asio/ip/host_name.hpp>
+
+#include "itemdecode.h"
+
+void decode_opc_value(opc_data_types data_type, VARIANT const& value, sample_buffer& samples, std::size_t index) {
+  if (data_type == opc_data_types::STRING) {
+    auto& str = samples.text[index];
+    if (value.vt != VT_BSTR) {
+      str.clear();
+      return;
+    }
+    int wslen = ::SysStringLen(value.bstrVal);
+    int len = ::WideCharToMultiByte(CP_ACP, 0, (wchar_t*)value.bstrVal, wslen, NULL, 0, NULL, NULL);
+    str.resize(len);
+    ::WideCharToMultiByte(CP_ACP, 0, (wchar_t*)value.bstrVal, wslen, str.data(), len, NULL, NULL);
+    return;
+  }
+
+  // the server delivers the canonical type of the item, which need not match the configured one
+  double& num = samples.numeric[index];
+  switch (value.vt) {
+    case VT_I1:
+      num = value.cVal;
+      break;
+    case VT_UI1:
+      num = value.bVal;
+      break;
+    case VT_I2:
+      num = value.iVal;
+      break;
+    case VT_UI2:
+      num = value.uiVal;
+      break;
+    case VT_I4:
+      num = value.lVal;
+      break;
+    case VT_UI4:
+      num = value.ulVal;
+      break;
+    case VT_INT:
+      num = value.intVal;
+      break;
+    case VT_UINT:
+      num = value.uintVal;
+      break;
+    case VT_R4:
+      num = value.fltVal;
+      break;
+    case VT_R8:
+      num = value.dblVal;
+      break;
+    case VT_BOOL:
+      num = value.boolVal == VARIANT_FALSE ? 0.0 : 1.0;
+      break;
+    default:
+      num = 0.0;
+      break;
+  }
+}
+
+HRESULT encode_opc_value(opc_value const& value, VARTYPE canonical_type, VARIANT& variant) {
+  ::VariantInit(&variant);
+  if (auto const* str = std::get_if<std::string>(&value)) {
+    int wslen = ::MultiByteToWideChar(CP_ACP, 0, str->data(), static_cast<int>(str->size()), NULL, 0);
+    variant.vt = VT_BSTR;
+    variant.bstrVal = ::SysAllocStringLen(NULL, wslen);
+    if (variant.bstrVal == NULL) {
+      variant.vt = VT_EMPTY;
+      return E_OUTOFMEMORY;
+    }
+    ::MultiByteToWideChar(CP_ACP, 0, str->data(), static_cast<int>(str->size()), variant.bstrVal, wslen);
+  } else if (auto const* num = std::get_if<int>(&value)) {
+    variant.vt = VT_I4;
+    variant.lVal = *num;
+  } else {
+    variant.vt = VT_R8;
+    variant.dblVal = std::get<double>(value);
+  }
+
+  // servers may reject values that are not of the canonical type, so the conversion is done here where its error can
+  // be reported per item
+  if (canonical_type == VT_EMPTY || canonical_type == variant.vt) {
+    return S_OK;
+  }
+  HRESULT result = ::VariantChangeType(&variant, &variant, 0, canonical_type);
+  if (FAILED(result)) {
+    ::VariantClear(&variant);
+  }
+  return result;
+}
+
+std::chrono::system_clock::time_point filetime_to_time_point(FILETIME const& ft) {
+  // FILETIME counts 100ns ticks since 1601-01-01, system_clock counts since 1970-01-01
+  constexpr std::uint64_t epoch_offset_ticks = 116444736000000000ULL;
+  std::uint64_t ticks = (static_cast<std::uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+  if (ticks < epoch_offset_ticks) {
+    return {};
+  }
+  auto since_epoch = std::chrono::duration<std::int64_t, std::ratio<1, 10000000>>(ticks - epoch_offset_ticks);
+  return std::chrono::system_clock::time_point(
+    std::chrono::duration_cast<std::chrono::system_clock::duration>(since_epoch));
+}
+
+void decode_opc_samples(COPCSampleBuffer const& raw,
+                        std::vector<std::size_t> const& vec_tag_index,
+                        std::vector<opc_data_types> const& vec_data_type,
+                        sample_buffer& samples) {
+  decode_item_samples(raw.updated.size(), raw.updated.data(), raw.values.data(), raw.qualities.data(),
+                      raw.timeStamps.data(), raw.errors.data(), vec_tag_index, vec_data_type, samples,
+                      decode_opc_value, filetime_to_time_point);
+}
+
+opc_data_change_handler::opc_data_change_handler(std::size_t t_group,
+                                                 std::size_t tag_count,
+                                                 std::vector<std::size_t> const& t_vec_tag_index,
+                                                 std::vector<opc_data_types> const& t_vec_data_type,
+                                                 sample_callback t_callback)
+    : group(t_group),
+      vec_tag_index(t_vec_tag_index),
+      vec_data_type(t_vec_data_type),
+      callback(std::move(t_callback)),
+      last_callback_ticks(std::chrono::steady_clock::now().time_since_epoch().count()) {
+  samples.resize(tag_count);
+  samples.group = group;
+}
+
+std::chrono::steady_clock::time_point opc_data_change_handler::last_callback() const {
+  return std::chrono::steady_clock::time_point(
+    std::chrono::steady_clock::duration(last_callback_ticks.load(std::memory_order_relaxed)));
+}
+
+void opc_data_change_handler::OnDataChange(COPCGroup& group, COPCSampleBuffer& changes) {
+  last_callback_ticks.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+  spdlog::debug("opc_reader: {} data changes in group {}", changes.updated.size(), group.getName());
+
+  auto start = std::chrono::steady_clock::now();
+  decode_opc_samples(changes, vec_tag_index, vec_data_type, samples);
+  samples.decode_time = std::chrono::steady_clock::now() - start;
+  if (!samples.updated.empty()) {
+    callback(samples);
+  }
+}
+
+void opc_da_source::shutdown_sink::OnShutdown(COPCServer& /*server*/, std::string const& reason) {
+  spdlog::warn("opc_reader: OPC server {} is shutting down, reason: {}", source.opc_server_name, reason);
+  source.shutdown_requested = true;
+  if (source.connection_lost_handler) {
+    source.connection_lost_handler(fmt::format("OPC server {} is shutting down", source.opc_server_name));
+  }
+}
+
+void opc_da_source::pending_read::complete(CTransaction& /*transaction*/) {
+  std::lock_guard lock(mutex);
+  completed = std::chrono::steady_clock::now();
+  done = true;
+}
+
+bool opc_da_source::pending_read::is_done() {
+  std::lock_guard lock(mutex);
+  return done;
+}
+
+opc_da_source::opc_da_source(std::string t_opc_server_name,
+                             unsigned long t_query_interval_ms,
+                             bool t_free_threaded,
+                             opc_da_config t_config)
+    : opc_server_name(std::move(t_opc_server_name)),
+      query_interval_ms(t_query_interval_ms),
+      free_threaded(t_free_threaded),
+      config(t_config) {}
+
+opc_da_source::~opc_da_source() {
+  disconnect();
+}
+
+bool opc_da_source::connect() {
+  spdlog::info("opc_reader trying to establish connection to server {}", opc_server_name);
+  // with a subscription or pipelined reads the server calls back on its own rpc threads, so we need the free threaded
+  // apartment. The poll loop has no message pump that could deliver callbacks into a single threaded one.
+  COPCClient::init(free_threaded || config.read_pipeline_depth > 0 ? MULTITHREADED : APARTMENTTHREADED);
+
+  // wir verbinden uns immer zu einem server der auf demselben rechner läuft
+  std::string hostname = asio::ip::host_name();
+  ptr_host.reset(COPCClient::makeHost(hostname));
+
+  // list available opc servers
+  std::vector<std::string> vec_local_servers;
+  try {
+    ptr_host->getListOfDAServers(IID_CATID_OPCDAServer20, vec_local_servers);
+  } catch (OPCException& ex) {
+    spdlog::warn("opc_reader could not connect to OPC server: {}", ex.reasonString());
+    return false;
+  }
+
+  if (vec_local_servers.empty()) {
+    spdlog::error("opc_reader no opc DA servers available on {}", hostname);
+    return false;
+  }
+
+  // gibt es unseren server
+  if (std::ranges::find(vec_local_servers, opc_server_name) == vec_local_servers.end()) {
+    spdlog::warn("opc_reader: OPC server {} is not registered on {}", opc_server_name, hostname);
+    return false;
+  }
+
+  // connect to opc server
+  shutdown_requested = false;
+  try {
+    ptr_opc_server.reset(ptr_host->connectDAServer(opc_server_name));
+  } catch (OPCException& ex) {
+    spdlog::warn("opc_reader: could not connect to OPC server {}", ex.reasonString());
+    return false;
+  }
+  return server_connected();
+}
+
+bool opc_da_source::connect(ATL::CComPtr<IOPCServer> server) {
+  spdlog::info("opc_reader: using the server object of OPC server {}", opc_server_name);
+  shutdown_requested = false;
+  try {
+    ptr_opc_server = std::make_unique<COPCServer>(server);
+  } catch (OPCException& ex) {
+    spdlog::warn("opc_reader: could not connect to OPC server {}", ex.reasonString());
+    return false;
+  }
+  return server_connected();
+}
+
+bool opc_da_source::server_connected() {
+  // a server going down for a restart tells its clients, then the reader reconnects without waiting for a read to fail
+  try {
+    ptr_opc_server->enableShutdownNotification(shutdown);
+  } catch (OPCException& ex) {
+    spdlog::warn("opc_reader: OPC server {} sends no shutdown notification, reason: {}", opc_server_name,
+                 ex.reasonString());
+  }
+
+  // the groups are made by add_items, one for every distinct item rate
+  return check_status();
+}
+
+bool opc_da_source::check_status() {
+  if (!ptr_opc_server || shutdown_requested) {
+    return false;
+  }
+
+  // a group with keep-alive calls back at least every keep-alive time, so its silence shows a dead connection
+  // without a round trip to the server
+  auto now = std::chrono::steady_clock::now();
+  bool all_kept_alive = !vec_groups.empty();
+  for (auto const& group : vec_groups) {
+    if (!group->data_change_handler || group->keep_alive == 0) {
+      all_kept_alive = false;
+      continue;
+    }
+    auto silence = now - group->data_change_handler->last_callback();
+    if (silence > 2 * std::chrono::milliseconds(group->keep_alive)) {
+      spdlog::error("opc_reader: group {} sent no callback for {} ms, its keep-alive is {} ms",
+                    group->ptr_group->getName(),
+                    std::chrono::duration_cast<std::chrono::milliseconds>(silence).count(), group->keep_alive);
+      return false;
+    }
+  }
+  if (all_kept_alive) {
+    return true;
+  }
+
+  ServerStatus status;
+  try {
+    ptr_opc_server->getStatus(status);
+  } catch (OPCException& ex) {
+    spdlog::warn("opc_reader: could not get the status of OPC server {}, reason: {}", opc_server_name,
+                 ex.reasonString());
+    return false;
+  }
+  spdlog::debug("{}: server state is {}", opc_server_name, status.dwServerState);
+  if (status.dwServerState != OPCSERVERSTATE::OPC_STATUS_RUNNING) {
+    spdlog::error("opc_reader: opc server state is {}, not RUNNING", status.dwServerState);
+    return false;
+  }
+  return true;
+}
+
+void opc_da_source::disconnect() {
+  unsubscribe();
+  remove_groups();
+  ptr_opc_server.reset();
+  if (ptr_host) {
+    ptr_host.reset();
+    COPCClient::stop();
+  }
+}
+
+void opc_da_source::remove_groups() {
+  vec_tag_items.clear();
+  for (auto& group : vec_groups) {
+    cancel_reads(*group);
+    group->read_set.reset();
+    // items have to go before their group, one RemoveItems call takes all of them
+    remove_items(*group, group->vec_opc_items);
+  }
+  vec_groups.clear();
+}
+
+void opc_da_source::remove_items(opc_da_group& grp, std::vector<COPCItem*>& items) {
+  if (items.empty()) {
+    return;
+  }
+  auto count = items.size();
+  std::vector<HRESULT> errors;
+  try {
+    auto failed = grp.ptr_group->removeItems(items, errors);
+    if (failed > 0) {
+      spdlog::warn("opc_reader: server failed to remove {} of {} items of group {}", failed, count,
+                   grp.ptr_group->getName());
+    }
+  } catch (OPCException& ex) {
+    spdlog::warn("opc_reader could not remove {} OPC items of group {}, reason: {}", count, grp.ptr_group->getName(),
+                 ex.reasonString());
+    // deleted one by one, every item removes itself from the server
+    for (auto* item : items) {
+      delete item;
+    }
+    items.clear();
+  }
+}
+
+std::unique_ptr<opc_da_source::opc_da_group> opc_da_source::make_group(unsigned long rate_ms) {
+  auto group = std::make_unique<opc_da_group>();
+  group->requested_rate = rate_ms;
+  try {
+    group->ptr_group.reset(
+      ptr_opc_server->makeGroup(fmt::format("Group_{}ms", rate_ms), true, rate_ms, group->update_rate, 0.0));
+  } catch (OPCException& ex) {
+    spdlog::warn("opc_reader could not create group for rate {} ms, reason: {}", rate_ms, ex.reasonString());
+    return nullptr;
+  }
+  if (group->update_rate != rate_ms) {
+    spdlog::warn("opc_reader: {} requested update rate was {} but got {}", opc_server_name, rate_ms,
+                 group->update_rate);
+  }
+  spdlog::info("opc_reader: group {} DA 3.0 item deadband {}, item sampling {}, max age reads {}",
+               group->ptr_group->getName(), group->ptr_group->supportsItemDeadband(),
+               group->ptr_group->supportsItemSampling(), group->ptr_group->supportsMaxAgeRead());
+  group->reads = config.reads_for(rate_ms);
+  if (group->reads.mode == group_read_mode::CACHE) {
+    spdlog::info("opc_reader: group {} reads from the server cache", group->ptr_group->getName());
+  } else if (group->reads.mode == group_read_mode::CACHE_VERIFY) {
+    spdlog::info("opc_reader: group {} reads from the server cache and from the device every {} ms",
+                 group->ptr_group->getName(), group->reads.verify_interval_ms);
+  }
+  return group;
+}
+
+std::size_t opc_da_source::add_items(std::vector<opc_data_point> const& data_points) {
+  remove_groups();
+  vec_opc_data = data_points;
+  vec_tag_items.assign(vec_opc_data.size(), tag_item{});
+
+  std::size_t item_count = 0;
+  for (auto const& tags : group_by_rate(vec_opc_data, query_interval_ms)) {
+    auto group = make_group(tags.rate_ms);
+    if (!group) {
+      continue;
+    }
+    // the group is appended to vec_groups once all its items are added
+    auto added = add_tags(*group, vec_groups.size(), tags.tag_indices);
+    if (added == 0) {
+      continue;
+    }
+    prepare_reads(*group);
+    item_count += added;
+    vec_groups.push_back(std::move(group));
+  }
+  return item_count;
+}
+
+std::size_t opc_da_source::update_items(std::vector<opc_data_point> const& data_points,
+                                        std::vector<std::uint32_t> const& changed) {
+  // a tag keeps its item unless it was added, removed or moved to another rate, type or DA 3.0 setting. A new label
+  // needs nothing from the server.
+  auto keeps_item = [&](std::uint32_t i) {
+    return i < vec_opc_data.size() && !vec_opc_data[i].removed && !data_points[i].removed &&
+           effective_rate_ms(vec_opc_data[i], query_interval_ms) ==
+             effective_rate_ms(data_points[i], query_interval_ms) &&
+           vec_opc_data[i].dataType == data_points[i].dataType && same_item_settings(vec_opc_data[i], data_points[i]);
+  };
+  std::vector<std::vector<COPCItem*>> removed_items(vec_groups.size());
+  std::map<unsigned long, std::vector<std::uint32_t>> added_by_rate;
+  for (auto i : changed) {
+    if (keeps_item(i)) {
+      continue;
+    }
+    if (i < vec_tag_items.size() && vec_tag_items[i].item) {
+      removed_items[vec_tag_items[i].group].push_back(vec_tag_items[i].item);
+      vec_tag_items[i] = tag_item{};
+    }
+    if (!data_points[i].removed) {
+      added_by_rate[effective_rate_ms(data_points[i], query_interval_ms)].push_back(i);
+    }
+  }
+  vec_opc_data = data_points;
+  vec_tag_items.resize(vec_opc_data.size());
+
+  // a new rate gets a new group at the end, the numbers of the existing groups stay as they are
+  std::vector<std::vector<std::uint32_t>> added_items(vec_groups.size());
+  for (auto& [rate, indices] : added_by_rate) {
+    auto it = std::ranges::find_if(vec_groups, [rate](auto const& grp) { return grp->requested_rate == rate; });
+    if (it == vec_groups.end()) {
+      auto group = make_group(rate);
+      if (!group) {
+        continue;
+      }
+      vec_groups.push_back(std::move(group));
+      removed_items.emplace_back();
+      added_items.emplace_back();
+      it = vec_groups.end() - 1;
+    }
+    added_items[static_cast<std::size_t>(it - vec_groups.begin())] = std::move(indices);
+  }
+
+  std::size_t item_count = 0;
+  for (std::size_t g = 0; g < vec_groups.size(); g++) {
+    if (removed_items[g].empty() && added_items[g].empty()) {
+      continue;
+    }
+    // only this group pauses while its items change, the other groups keep reading and delivering data changes
+    auto& grp = *vec_groups[g];
+    cancel_reads(grp);
+    unsubscribe_group(grp);
+
+    auto removed_count = removed_items[g].size();
+    std::unordered_set<COPCItem*> removing(removed_items[g].begin(), removed_items[g].end());
+    std::erase_if(grp.vec_opc_items, [&removing](auto* item) { return removing.contains(item); });
+    remove_items(grp, removed_items[g]);
+    auto added = add_tags(grp, g, added_items[g]);
+    item_count += added;
+
+    prepare_reads(grp);
+    if (subscription_callback) {
+      subscribe_group(g);
+    }
+    spdlog::info("opc_reader: group {} updated, {} items removed and {} added, {} items in the group",
+                 grp.ptr_group->getName(), removed_count, added, grp.vec_opc_items.size());
+  }
+  return item_count;
+}
+
+std::size_t opc_da_source::add_tags(opc_da_group& grp,
+                                    std::size_t group,
+                                    std::vector<std::uint32_t> const& tag_indices) {
+  if (tag_indices.empty()) {
+    return 0;
+  }
+  auto items_before = grp.vec_opc_items.size();
+  // one AddItems call per chunk instead of one per item, startup with many tags is dominated by these round trips
+  auto chunk_size = std::max<std::size_t>(config.add_items_chunk_size, 1);
+  std::vector<std::size_t> chunk;
+  for (std::size_t first = 0; first < tag_indices.size(); first += chunk_size) {
+    auto last = std::min(first + chunk_size, tag_indices.size());
+    chunk.assign(tag_indices.begin() + static_cast<std::ptrdiff_t>(first),
+                 tag_indices.begin() + static_cast<std::ptrdiff_t>(last));
+    add_chunk(grp, group, chunk);
+  }
+
+  auto added = grp.vec_opc_items.size() - items_before;
+  if (added != tag_indices.size()) {
+    spdlog::warn("opc_reader only {} out of {} items created in group {}", added, tag_indices.size(),
+                 grp.ptr_group->getName());
+  } else {
+    spdlog::info("opc_reader {} out of {} items created in group {}", added, tag_indices.size(),
+                 grp.ptr_group->getName());
+  }
+  return added;
+}
+
+void opc_da_source::add_chunk(opc_da_group& grp, std::size_t group, std::vector<std::size_t>& chunk) {
+  std::vector<std::string> names;
+  names.reserve(chunk.size());
+  for (auto i : chunk) {
+    names.push_back(vec_opc_data[i].name);
+  }
+
+  std::vector<HRESULT> errors;
+  if (config.validate_items) {
+    try {
+      if (grp.ptr_group->validateItems(names, errors) > 0) {
+        std::size_t kept = 0;
+        for (std::size_t k = 0; k < chunk.size(); k++) {
+          if (FAILED(errors[k])) {
+            spdlog::warn("opc_reader: invalid OPC item <<{}>> error {:#010x}", names[k],
+                         static_cast<std::uint32_t>(errors[k]));
+            continue;
+          }
+          chunk[kept] = chunk[k];
+          names[kept] = std::move(names[k]);
+          kept++;
+        }
+        chunk.resize(kept);
+        names.resize(kept);
+      }
+    } catch (OPCException& ex) {
+      // AddItems reports the invalid items as well, so the chunk is added anyway
+      spdlog::warn("opc_reader could not validate items of group {}, reason: {}", grp.ptr_group->getName(),
+                   ex.reasonString());
+    }
+  }
+
+  std::vector<COPCItem*> created;
+  try {
+    grp.ptr_group->addItems(names, created, errors, true);
+  } catch (OPCException& ex) {
+    spdlog::warn("opc_reader could not add {} OPC items to group {}, reason: {}", names.size(),
+                 grp.ptr_group->getName(), ex.reasonString());
+    return;
+  }
+  for (std::size_t k = 0; k < chunk.size(); k++) {
+    auto* new_item = created[k];
+    if (new_item == nullptr) {
+      spdlog::warn("opc_reader could not add OPC item <<{}>> error {:#010x}", names[k],
+                   static_cast<std::uint32_t>(errors[k]));
+      continue;
+    }
+    grp.vec_opc_items.push_back(new_item);
+    if (grp.vec_tag_index.size() <= new_item->getClientHandle()) {
+      grp.vec_tag_index.resize(new_item->getClientHandle() + 1);
+      grp.vec_data_type.resize(new_item->getClientHandle() + 1, opc_data_types::UNKNOWN);
+    }
+    grp.vec_tag_index[new_item->getClientHandle()] = chunk[k];
+    grp.vec_data_type[new_item->getClientHandle()] = vec_opc_data[chunk[k]].dataType;
+    vec_tag_items[chunk[k]] = tag_item{group, new_item};
+  }
+  apply_item_settings(grp, created, chunk);
+}
+
+void opc_da_source::apply_item_settings(opc_da_group& grp,
+                                        std::vector<COPCItem*> const& created,
+                                        std::vector<std::size_t> const& chunk) {
+  std::vector<COPCItem*> deadband_items;
+  std::vector<float> deadbands;
+  std::vector<COPCItem*> sampled_items;
+  std::vector<DWORD> sampling_rates;
+  std::vector<COPCItem*> buffered_items;
+  for (std::size_t k = 0; k < chunk.size(); k++) {
+    if (created[k] == nullptr) {
+      continue;
+    }
+    auto const& data_point = vec_opc_data[chunk[k]];
+    if (data_point.server_deadband_percent > 0) {
+      deadband_items.push_back(created[k]);
+      deadbands.push_back(data_point.server_deadband_percent);
+    }
+    if (data_point.sampling_ms > 0) {
+      sampled_items.push_back(created[k]);
+      sampling_rates.push_back(data_point.sampling_ms);
+    }
+    if (data_point.buffer_samples) {
+      buffered_items.push_back(created[k]);
+    }
+  }
+
+  // a DA 2.0 server filters with the deadband of the group and samples at its update rate, the items work as before
+  auto log_failures = [&grp](char const* setting, std::vector<COPCItem*> const& items,
+                             std::vector<HRESULT> const& errors) {
+    for (std::size_t k = 0; k < items.size(); k++) {
+      if (FAILED(errors[k])) {
+        spdlog::warn("opc_reader: could not set the {} of OPC item <<{}>> in group {} error {:#010x}", setting,
+                     items[k]->getName(), grp.ptr_group->getName(), static_cast<std::uint32_t>(errors[k]));
+      }
+    }
+  };
+  std::vector<HRESULT> errors;
+  if (!deadband_items.empty()) {
+    if (!grp.ptr_group->supportsItemDeadband()) {
+      spdlog::warn("opc_reader: group {} ignores the deadband of {} items, the server does not implement DA 3.0",
+                   grp.ptr_group->getName(), deadband_items.size());
+    } else {
+      try {
+        if (grp.ptr_group->setItemDeadbands(deadband_items, deadbands, errors) > 0) {
+          log_failures("deadband", deadband_items, errors);
+        }
+      } catch (OPCException& ex) {
+        spdlog::warn("opc_reader: could not set item deadbands of group {}, reason: {}", grp.ptr_group->getName(),
+                     ex.reasonString());
+      }
+    }
+  }
+
+  if (sampled_items.empty() && buffered_items.empty()) {
+    return;
+  }
+  if (!grp.ptr_group->supportsItemSampling()) {
+    spdlog::warn("opc_reader: group {} ignores the sampling rate of {} and the buffering of {} items, the server "
+                 "does not implement DA 3.0",
+                 grp.ptr_group->getName(), sampled_items.size(), buffered_items.size());
+    return;
+  }
+  try {
+    if (!sampled_items.empty()) {
+      std::vector<DWORD> revised;
+      if (grp.ptr_group->setItemSamplingRates(sampled_items, sampling_rates, revised, errors) > 0) {
+        log_failures("sampling rate", sampled_items, errors);
+      }
+      for (std::size_t k = 0; k < sampled_items.size(); k++) {
+        if (SUCCEEDED(errors[k]) && revised[k] != sampling_rates[k]) {
+          spdlog::warn("opc_reader: OPC item <<{}>> requested sampling rate was {} ms but got {} ms",
+                       sampled_items[k]->getName(), sampling_rates[k], revised[k]);
+        }
+      }
+    }
+    if (!buffered_items.empty() && grp.ptr_group->setItemBufferEnable(buffered_items, true, errors) > 0) {
+      log_failures("buffering", buffered_items, errors);
+    }
+  } catch (OPCException& ex) {
+    spdlog::warn("opc_reader: could not set item sampling of group {}, reason: {}", grp.ptr_group->getName(),
+                 ex.reasonString());
+  }
+}
+
+void opc_da_source::prepare_reads(opc_da_group& grp) {
+  grp.read_set.reset();
+  if (!grp.vec_opc_items.empty()) {
+    grp.read_set.reset(grp.ptr_group->prepareRead(grp.vec_opc_items));
+  }
+  grp.raw_samples.resize(grp.ptr_group->getItemTableSize());
+}
+
+bool opc_da_source::read(std::size_t group, sample_buffer& samples) {
+  auto& grp = *vec_groups[group];
+  if (!grp.read_set) {
+    // a reload removed every item of the group, which reads nothing without asking the server
+    samples.updated.clear();
+    samples.group = group;
+    samples.read_time = std::chrono::nanoseconds(0);
+    samples.decode_time = std::chrono::nanoseconds(0);
+    return true;
+  }
+  if (config.read_pipeline_depth > 0) {
+    return read_pipelined(group, samples);
+  }
+  // a DA 3.0 server verifies the cache itself: ReadMaxAge takes the cached value of an item unless it is older than
+  // the verify interval, so no read of the group has to wait for the device of every item
+  auto max_age_read = grp.reads.mode == group_read_mode::CACHE_VERIFY && grp.ptr_group->supportsMaxAgeRead();
+  auto from = max_age_read ? read_source::CACHE : next_read_source(grp);
+  auto start = std::chrono::steady_clock::now();
+  // SYNCED read on Group
+  try {
+    if (max_age_read) {
+      grp.ptr_group->readSyncMaxAge(*grp.read_set, grp.reads.verify_interval_ms, grp.raw_samples);
+    } else {
+      grp.ptr_group->readSync(*grp.read_set, grp.raw_samples,
+                              from == read_source::CACHE ? OPC_DS_CACHE : OPC_DS_DEVICE);
+    }
+  } catch (OPCException& ex) {
+    spdlog::warn("reading opc items of group {} failed, reason: {}", grp.ptr_group->getName(), ex.reasonString());
+    return false;
+  }
+  auto received = std::chrono::steady_clock::now();
+
+  decode_opc_samples(grp.raw_samples, grp.vec_tag_index, grp.vec_data_type, samples);
+  samples.group = group;
+  samples.read_time = received - start;
+  samples.decode_time = std::chrono::steady_clock::now() - received;
+  samples.read_from = from;
+  return true;
+}
+
+bool opc_da_source::read_pipelined(std::size_t group, sample_buffer& samples) {
+  auto& grp = *vec_groups[group];
+  if (!grp.asynch_enabled) {
+    try {
+      grp.ptr_group->enableAsynch();
+    } catch (OPCException& ex) {
+      spdlog::warn("opc_reader: could not enable asynch reads of group {}, reason: {}", grp.ptr_group->getName(),
+                   ex.reasonString());
+      return false;
+    }
+    grp.asynch_enabled = true;
+  }
+  auto timeout = std::chrono::milliseconds(config.read_timeout_ms);
+
+  // the newest completed read wins, the reads issued before it could only deliver older values
+  auto completed = grp.in_flight.size();
+  for (auto i = grp.in_flight.size(); i-- > 0;) {
+    if (grp.in_flight[i]->is_done()) {
+      completed = i;
+      break;
+    }
+  }
+  if (completed == grp.in_flight.size() && grp.in_flight.size() >= config.read_pipeline_depth) {
+    // the pipeline is full and nothing arrived. The tick is skipped rather than waited for, so the query loop stays
+    // responsive to stop, writes and reloads and the other groups keep their schedule. The timeout below frees a
+    // stalled pipeline, the watchdog catches a server that stopped answering.
+    spdlog::debug("opc_reader: {} reads of group {} outstanding, tick skipped", grp.in_flight.size(),
+                  grp.ptr_group->getName());
+  }
+
+  std::unique_ptr<pending_read> result;
+  if (completed < grp.in_flight.size()) {
+    result = std::move(grp.in_flight[completed]);
+    for (std::size_t i = 0; i < completed; i++) {
+      recycle_read(grp, std::move(grp.in_flight[i]));
+    }
+    if (completed > 0) {
+      spdlog::debug("opc_reader: {} reads of group {} superseded", completed, grp.ptr_group->getName());
+    }
+    grp.in_flight.erase(grp.in_flight.begin(), grp.in_flight.begin() + static_cast<std::ptrdiff_t>(completed) + 1);
+  }
+
+  // reads are issued in order, so the ones past their timeout are at the front
+  auto now = std::chrono::steady_clock::now();
+  while (!grp.in_flight.empty() && now - grp.in_flight.front()->issued > timeout) {
+    spdlog::warn("opc_reader: read of group {} timed out after {} ms", grp.ptr_group->getName(),
+                 config.read_timeout_ms);
+    recycle_read(grp, std::move(grp.in_flight.front()));
+    grp.in_flight.pop_front();
+  }
+
+  if (grp.in_flight.size() < config.read_pipeline_depth) {
+    issue_read(grp);
+  }
+  if (!result) {
+    return false;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  decode_opc_samples(*result->transaction->samples, grp.vec_tag_index, grp.vec_data_type, samples);
+  samples.group = group;
+  samples.read_time = result->completed - result->issued;
+  samples.decode_time = std::chrono::steady_clock::now() - start;
+  samples.read_from = result->from;
+  recycle_read(grp, std::move(result));
+  return true;
+}
+
+bool opc_da_source::issue_read(opc_da_group& grp) {
+  std::unique_ptr<pending_read> next;
+  if (grp.idle_reads.empty()) {
+    next = std::make_unique<pending_read>();
+  } else {
+    next = std::move(grp.idle_reads.back());
+    grp.idle_reads.pop_back();
+  }
+  // not registered with the group yet, so no completion can race with the reset
+  next->done = false;
+  next->issued = std::chrono::steady_clock::now();
+  next->transaction = grp.read_transactions.acquire(next.get());
+  next->from = next_read_source(grp);
+  try {
+    if (next->from == read_source::CACHE) {
+      // IOPCAsyncIO2::Read always goes to the device, a refresh of the group can take the cache
+      grp.ptr_group->refresh(OPC_DS_CACHE, *next->transaction);
+    } else {
+      grp.ptr_group->readAsync(*grp.read_set, *next->transaction);
+    }
+  } catch (OPCException& ex) {
+    spdlog::warn("reading opc items of group {} failed, reason: {}", grp.ptr_group->getName(), ex.reasonString());
+    grp.read_transactions.release(next->transaction);
+    next->transaction = nullptr;
+    grp.idle_reads.push_back(std::move(next));
+    return false;
+  }
+  grp.in_flight.push_back(std::move(next));
+  return true;
+}
+
+read_source opc_da_source::next_read_source(opc_da_group& grp) {
+  switch (grp.reads.mode) {
+    case group_read_mode::DEVICE:
+      return read_source::DEVICE;
+    case group_read_mode::CACHE:
+      return read_source::CACHE;
+    case group_read_mode::CACHE_VERIFY:
+      break;
+  }
+  // next_verify starts in the past, so the first read goes to the device while the cache of the new group fills
+  auto now = std::chrono::steady_clock::now();
+  if (now < grp.next_verify) {
+    return read_source::CACHE;
+  }
+  grp.next_verify = now + std::chrono::milliseconds(grp.reads.verify_interval_ms);
+  return read_source::DEVICE;
+}
+
+void opc_da_source::recycle_read(opc_da_group& grp, std::unique_ptr<pending_read> read) {
+  // once cancel returned a late completion finds no transaction, so the transaction can be reused right away
+  grp.ptr_group->cancel(*read->transaction);
+  grp.read_transactions.release(read->transaction);
+  read->transaction = nullptr;
+  grp.idle_reads.push_back(std::move(read));
+}
+
+void opc_da_source::cancel_reads(opc_da_group& grp) {
+  while (!grp.in_flight.empty()) {
+    recycle_read(grp, std::move(grp.in_flight.front()));
+    grp.in_flight.pop_front();
+  }
+  grp.idle_reads.clear();
+  if (grp.asynch_enabled) {
+    try {
+      grp.ptr_group->disableAsynch();
+    } catch (OPCException& ex) {
+      spdlog::warn("opc_reader: could not disable asynch reads of group {}, reason: {}", grp.ptr_group->getName(),
+                   ex.reasonString());
+    }
+    grp.asynch_enabled = false;
+  }
+}
+
+bool opc_da_source::write(std::vector<tag_write> const& writes, std::vector<std::int32_t>& errors) {
+  errors.assign(writes.size(), write_error_unknown_item);
+
+  // the writes of a group go to the server in one call
+  std::vector<std::vector<std::size_t>> by_group(vec_groups.size());
+  for (std::size_t k = 0; k < writes.size(); k++) {
+    if (writes[k].index < vec_tag_items.size() && vec_tag_items[writes[k].index].item) {
+      by_group[vec_tag_items[writes[k].index].group].push_back(k);
+    }
+  }
+
+  bool success = true;
+  std::vector<COPCItem*> items;
+  std::vector<VARIANT> values;
+  std::vector<std::size_t> positions;
+  std::vector<HRESULT> item_errors;
+  for (std::size_t g = 0; g < by_group.size(); g++) {
+    items.clear();
+    values.clear();
+    positions.clear();
+    for (auto k : by_group[g]) {
+      auto* item = vec_tag_items[writes[k].index].item;
+      VARIANT variant;
+      HRESULT result = encode_opc_value(writes[k].value, item->getCanonicalDataType(), variant);
+      if (FAILED(result)) {
+        errors[k] = result;
+        continue;
+      }
+      items.push_back(item);
+      values.push_back(variant);
+      positions.push_back(k);
+    }
+    if (items.empty()) {
+      continue;
+    }
+
+    auto& grp = *vec_groups[g];
+    try {
+      grp.ptr_group->writeSync(items, values, item_errors);
+      for (std::size_t j = 0; j < positions.size(); j++) {
+        errors[positions[j]] = item_errors[j];
+      }
+    } catch (OPCException& ex) {
+      spdlog::warn("writing {} opc items of group {} failed, reason: {}", items.size(), grp.ptr_group->getName(),
+                   ex.reasonString());
+      for (auto k : positions) {
+        errors[k] = write_error_failed;
+      }
+      success = false;
+    }
+    for (auto& variant : values) {
+      ::VariantClear(&variant);
+    }
+  }
+  return success;
+}
+
+bool opc_da_source::subscribe(sample_callback callback) {
+  subscription_callback = std::move(callback);
+  for (std::size_t g = 0; g < vec_groups.size(); g++) {
+    if (!subscribe_group(g)) {
+      unsubscribe();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool opc_da_source::subscribe_group(std::size_t group) {
+  auto& grp = *vec_groups[group];
+  grp.data_change_handler = std::make_unique<opc_data_change_handler>(group, vec_opc_data.size(), grp.vec_tag_index,
+                                                                      grp.vec_data_type, subscription_callback);
+  try {
+    grp.ptr_group->enableAsynch(*grp.data_change_handler);
+  } catch (OPCException& ex) {
+    spdlog::warn("opc_reader: could not subscribe to group {}, reason: {}", grp.ptr_group->getName(),
+                 ex.reasonString());
+    grp.data_change_handler.reset();
+    return false;
+  }
+
+  grp.keep_alive = 0;
+  if (config.keep_alive_ms > 0) {
+    DWORD revised = 0;
+    try {
+      if (!grp.ptr_group->setKeepAlive(config.keep_alive_ms, revised)) {
+        spdlog::info("opc_reader: group {} has no keep-alive, the server does not implement DA 3.0",
+                     grp.ptr_group->getName());
+      } else if (revised != config.keep_alive_ms) {
+        spdlog::warn("opc_reader: group {} requested keep-alive was {} ms but got {} ms", grp.ptr_group->getName(),
+                     config.keep_alive_ms, revised);
+      }
+    } catch (OPCException& ex) {
+      spdlog::warn("opc_reader: could not set the keep-alive of group {}, reason: {}", grp.ptr_group->getName(),
+                   ex.reasonString());
+    }
+    grp.keep_alive = revised;
+  }
+  return true;
+}
+
+void opc_da_source::unsubscribe() {
+  for (auto& group : vec_groups) {
+    unsubscribe_group(*group);
+  }
+  subscription_callback = nullptr;
+}
+
+void opc_da_source::unsubscribe_group(opc_da_group& grp) {
+  if (!grp.data_change_handler) {
+    return;
+  }
+  try {
+    grp.ptr_group->disableAsynch();
+  } catch (OPCException& ex) {
+    spdlog::warn("opc_reader: could not unsubscribe from group {}, reason: {}", grp.ptr_group->getName(),
+                 ex.reasonString());
+  }
+  grp.data_change_handler.reset();
+  grp.keep_alive = 0;
+}
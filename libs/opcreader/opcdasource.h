@@ -0,0 +1,235 @@
+#ifndef OPCDASOURCE_H
+#define OPCDASOURCE_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <OPCClient.h>
+#include <OPCGroup.h>
+#include <OPCHost.h>
+#include <OPCItem.h>
+#include <OPCServer.h>
+#include <TransactionPool.h>
+#include <opcda.h>
+
+#include "opcdaconfig.h"
+#include "tagsource.h"
+
+// converts a VARIANT into the numeric or text column of samples, reusing the string buffer of the previous value
+void decode_opc_value(opc_data_types data_type, VARIANT const& value, sample_buffer& samples, std::size_t index);
+
+// converts a value to write into a VARIANT of the canonical type of the item, returns the HRESULT of the conversion
+HRESULT encode_opc_value(opc_value const& value, VARTYPE canonical_type, VARIANT& variant);
+
+std::chrono::system_clock::time_point filetime_to_time_point(FILETIME const& ft);
+
+// copies the raw samples listed in raw.updated into the tag indexed samples with decode_item_samples, vec_tag_index
+// and vec_data_type are indexed by client handle
+void decode_opc_samples(COPCSampleBuffer const& raw,
+                        std::vector<std::size_t> const& vec_tag_index,
+                        std::vector<opc_data_types> const& vec_data_type,
+                        sample_buffer& samples);
+
+// receives OnDataChange notifications of a group with enabled asynch IO
+class opc_data_change_handler : public IAsynchSampleCallback {
+ public:
+  opc_data_change_handler(std::size_t t_group,
+                          std::size_t tag_count,
+                          std::vector<std::size_t> const& t_vec_tag_index,
+                          std::vector<opc_data_types> const& t_vec_data_type,
+                          sample_callback t_callback);
+
+  void OnDataChange(COPCGroup& group, COPCSampleBuffer& changes) override;
+
+  // time of the last callback, keep-alive callbacks without items included
+  std::chrono::steady_clock::time_point last_callback() const;
+
+ private:
+  std::size_t group;
+  std::vector<std::size_t> const& vec_tag_index;
+  std::vector<opc_data_types> const& vec_data_type;
+  sample_callback callback;
+  sample_buffer samples;
+  // steady clock ticks, written by the callback thread and read by check_status
+  std::atomic<std::int64_t> last_callback_ticks;
+};
+
+// tag source backed by an OPC DA server reached through the OPCClientToolKit
+class opc_da_source : public tag_source {
+ public:
+  opc_da_source(std::string t_opc_server_name,
+                unsigned long t_query_interval_ms,
+                bool t_free_threaded,
+                opc_da_config t_config);
+  ~opc_da_source() override;
+
+  bool connect() override;
+  // uses a server object created elsewhere, e.g. in-process, instead of the one registered as opc_server_name
+  bool connect(ATL::CComPtr<IOPCServer> server);
+  void disconnect() override;
+
+  // false once the server announced its shutdown or a group with keep-alive went silent, the server is only asked
+  // for its status if some group has no keep-alive
+  bool check_status() override;
+
+  void set_connection_lost_handler(connection_lost_callback handler) override {
+    connection_lost_handler = std::move(handler);
+  }
+
+  std::size_t add_items(std::vector<opc_data_point> const& data_points) override;
+
+  std::size_t update_items(std::vector<opc_data_point> const& data_points,
+                           std::vector<std::uint32_t> const& changed) override;
+
+  std::size_t group_count() const override { return vec_groups.size(); }
+
+  bool read(std::size_t group, sample_buffer& samples) override;
+
+  bool subscribe(sample_callback callback) override;
+  void unsubscribe() override;
+
+  unsigned long update_rate_ms(std::size_t group) const override { return vec_groups[group]->update_rate; }
+
+  bool write(std::vector<tag_write> const& writes, std::vector<std::int32_t>& errors) override;
+
+ private:
+  // an asynchronous read of a group, kept for the next read once it was delivered, superseded or cancelled
+  struct pending_read : ITransactionComplete {
+    // called by the toolkit on a COM thread when the server sent the results
+    void complete(CTransaction& transaction) override;
+
+    bool is_done();
+
+    // taken from the read_transactions of the group, its sample buffer is filled in place by the completion
+    CTransaction* transaction{nullptr};
+
+    std::chrono::steady_clock::time_point issued;
+    std::chrono::steady_clock::time_point completed;
+    read_source from{read_source::DEVICE};
+
+    std::mutex mutex;
+    bool done{false};
+  };
+
+  // IOPCShutdown sink of the server, forwards the shutdown request to the reader
+  struct shutdown_sink : IServerShutdownCallback {
+    explicit shutdown_sink(opc_da_source& t_source) : source(t_source) {}
+
+    // called by the toolkit on a COM thread
+    void OnShutdown(COPCServer& server, std::string const& reason) override;
+
+    opc_da_source& source;
+  };
+
+  // one OPC group per distinct item rate
+  struct opc_da_group {
+    unsigned long requested_rate{0};
+    unsigned long update_rate{0};
+    // keep-alive the server granted while subscribed, 0 without
+    unsigned long keep_alive{0};
+
+    // where polls read from, a CACHE_VERIFY group reads the device once next_verify has passed
+    group_read_config reads;
+    std::chrono::steady_clock::time_point next_verify;
+
+    std::unique_ptr<COPCGroup> ptr_group;
+
+    // tag index and data type for every client handle of the group, so decoding a result is a plain array lookup.
+    // Data change handlers only read these, never the data points a reload replaces.
+    std::vector<std::size_t> vec_tag_index;
+    std::vector<opc_data_types> vec_data_type;
+    std::vector<COPCItem*> vec_opc_items;
+
+    // prepared once the items are added, so a read passes the handle array straight to the server. Null while the
+    // group has no items.
+    std::unique_ptr<COPCReadSet> read_set;
+
+    // raw read results indexed by client handle, reused for every read
+    COPCSampleBuffer raw_samples;
+
+    std::unique_ptr<opc_data_change_handler> data_change_handler;
+
+    // asynchronous reads in the order they were issued, at most read_pipeline_depth of them
+    std::deque<std::unique_ptr<pending_read>> in_flight;
+    std::vector<std::unique_ptr<pending_read>> idle_reads;
+    CTransactionPool read_transactions;
+    bool asynch_enabled{false};
+  };
+
+  // enables the shutdown notification of the server just connected and checks that it is running
+  bool server_connected();
+
+  void remove_groups();
+
+  // removes the items from the server in one call and deletes them, items is empty afterwards
+  void remove_items(opc_da_group& grp, std::vector<COPCItem*>& items);
+
+  // null if the server refused to create the group
+  std::unique_ptr<opc_da_group> make_group(unsigned long rate_ms);
+
+  // adds the tags to the group with one AddItems call per chunk, returns the number the server accepted
+  std::size_t add_tags(opc_da_group& grp, std::size_t group, std::vector<std::uint32_t> const& tag_indices);
+
+  // adds the tags of one chunk to a group in one call, dropping tags the server rejects
+  void add_chunk(opc_da_group& grp, std::size_t group, std::vector<std::size_t>& chunk);
+
+  // sets the DA 3.0 deadbands, sampling rates and buffering of the items created for chunk, created[k] is the item of
+  // chunk[k] or null. Warns and leaves the items as they are if the server only implements DA 2.0.
+  void apply_item_settings(opc_da_group& grp,
+                           std::vector<COPCItem*> const& created,
+                           std::vector<std::size_t> const& chunk);
+
+  // prepares the read set and sizes the sample buffer for the current items of the group
+  void prepare_reads(opc_da_group& grp);
+
+  // subscribes the group to data changes delivered to subscription_callback
+  bool subscribe_group(std::size_t group);
+
+  void unsubscribe_group(opc_da_group& grp);
+
+  // delivers the newest completed asynchronous read of the group and keeps the pipeline filled, returns false without
+  // waiting if none completed
+  bool read_pipelined(std::size_t group, sample_buffer& samples);
+
+  bool issue_read(opc_da_group& grp);
+
+  // source of the next read of the group according to its read mode
+  read_source next_read_source(opc_da_group& grp);
+
+  // cancels the read if it is still pending and keeps it for reuse
+  void recycle_read(opc_da_group& grp, std::unique_ptr<pending_read> read);
+
+  void cancel_reads(opc_da_group& grp);
+
+  std::string opc_server_name;
+  unsigned long query_interval_ms;
+  bool free_threaded;
+  opc_da_config config;
+
+  std::unique_ptr<COPCHost> ptr_host;
+  std::unique_ptr<COPCServer> ptr_opc_server;
+
+  shutdown_sink shutdown{*this};
+  std::atomic<bool> shutdown_requested{false};
+  connection_lost_callback connection_lost_handler;
+
+  // group and item of every tag index, item is null for tags the server did not accept
+  struct tag_item {
+    std::size_t group{0};
+    COPCItem* item{nullptr};
+  };
+
+  std::vector<opc_data_point> vec_opc_data;
+  std::vector<std::unique_ptr<opc_da_group>> vec_groups;
+  std::vector<tag_item> vec_tag_items;
+
+  // set while subscribed, groups changed by update_items are subscribed again with it
+  sample_callback subscription_callback;
+};
+
+#endif  // OPCDASOURCE_H
@@ -4,9 +4,17 @@
 #include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <optional>
+#include <random>
+#include <thread>
+#include <unordered_map>
 #include <variant>
 
-#include <asio/ip/host_name.hpp>
+#include <fmt/format.h>
+
+#ifdef _WIN32
+#include "opcdasource.h"
+#endif
 
 opc_reader::opc_reader(std::string t_init_file_name) : init_file_name(t_init_file_name) {}
 
@@ -14,6 +22,16 @@ bool opc_reader::init() {
   if (!read_ini_file(init_file_name)) {
     return false;
   }
+  source = make_tag_source();
+  if (!source) {
+    return false;
+  }
+  source->set_connection_lost_handler([this](std::string const& reason) { connection_lost(reason); });
+  if (change_filter_enabled) {
+    filter.configure(vec_opc_data, max_publish_ms);
+    spdlog::info("opc_reader: change filter enabled, unchanged values are published again after {} ms",
+                 max_publish_ms);
+  }
   // if (!connect_to_server()) {
   //   return false;
   // }
@@ -27,23 +45,14 @@ bool opc_reader::read_ini_file(std::string init_file_name) {
     path = wd / path;
   }
 
-  if (!std::filesystem::exists(path)) {
-    spdlog::error("opc_reader: ini file does not exists: {}", path.generic_string());
-    return false;
-  }
-
-  std::ifstream ifs(path);
+  // a reload reads the same file, even if the working directory changed meanwhile
+  std::error_code ec;
+  ini_path = path;
+  ini_write_time = std::filesystem::last_write_time(path, ec);
 
   nlohmann::json jall;
-  try {
-    jall = nlohmann::json::parse(ifs);
-  } catch (const nlohmann::json::parse_error& e) {
-    spdlog::error("opc_reader: error reading json file");
-    spdlog::error("===============================");
-    spdlog::error("message: {0}", e.what());
-    spdlog::error("exception id:{0}", e.id);
-    spdlog::error("byte position of error: {0}", e.byte);
-    spdlog::error("===============================");
+  if (!read_ini_json(path, jall)) {
+    return false;
   }
 
   if (jall.contains("hostname")) {
@@ -60,44 +69,134 @@ bool opc_reader::read_ini_file(std::string init_file_name) {
     return false;
   }
 
+  if (jall.contains("mode")) {
+    auto str_mode = jall["mode"].get<std::string>();
+    query_mode = match_opc_query_mode(str_mode);
+    spdlog::info("opc_reader: query mode is {}", str_mode);
+  }
+
+  if (jall.contains("reportResponseTime")) {
+    report_response_time = jall["reportResponseTime"].get<bool>();
+  }
+  report_interval_ms = jall.value("reportIntervalMs", report_interval_ms);
+
+  if (jall.contains("overrunPolicy")) {
+    auto str_policy = jall["overrunPolicy"].get<std::string>();
+    overrun = match_overrun_policy(str_policy);
+    spdlog::info("opc_reader: overrun policy is {}", str_policy);
+  }
+
+  if (jall.contains("demoMode")) {
+    demo_mode = jall["demoMode"].get<bool>();
+  }
+
+  if (jall.contains("simulation")) {
+    auto jsim = jall.at("simulation");
+    simulation.tag_count = jsim.value("tagCount", simulation.tag_count);
+    simulation.change_rate = jsim.value("changeRate", simulation.change_rate);
+    simulation.seed = jsim.value("seed", simulation.seed);
+    simulation.outage_interval_ms = jsim.value("outageIntervalMs", simulation.outage_interval_ms);
+    simulation.outage_ms = jsim.value("outageMs", simulation.outage_ms);
+    if (jsim.contains("types")) {
+      simulation.types.clear();
+      for (auto const& jtype : jsim.at("types")) {
+        auto str_type = jtype.get<std::string>();
+        auto data_type = match_opc_data_types(str_type);
+        if (data_type == opc_data_types::UNKNOWN) {
+          spdlog::error("opc_reader: invalid entry for data type in simulation types {}", str_type);
+          return false;
+        }
+        simulation.types.push_back(data_type);
+      }
+    }
+  }
+
+  if (jall.contains("opcDa")) {
+    auto jda = jall.at("opcDa");
+    opc_da.read_pipeline_depth = jda.value("readPipelineDepth", opc_da.read_pipeline_depth);
+    opc_da.read_timeout_ms = jda.value("readTimeoutMs", opc_da.read_timeout_ms);
+    opc_da.add_items_chunk_size = jda.value("addItemsChunkSize", opc_da.add_items_chunk_size);
+    opc_da.validate_items = jda.value("validateItems", opc_da.validate_items);
+    opc_da.keep_alive_ms = jda.value("keepAliveMs", opc_da.keep_alive_ms);
+    if (!read_group_reads(jda, opc_da.reads)) {
+      return false;
+    }
+    if (jda.contains("groups")) {
+      for (auto const& jgroup : jda.at("groups")) {
+        if (!jgroup.contains("rateMs")) {
+          spdlog::error("opc_reader: no entry for rateMs in opcDa groups object {}", jgroup.dump());
+          return false;
+        }
+        // a group without its own settings reads like the default
+        auto reads = opc_da.reads;
+        if (!read_group_reads(jgroup, reads)) {
+          return false;
+        }
+        opc_da.group_reads[jgroup["rateMs"].get<unsigned long>()] = reads;
+      }
+    }
+  }
+
+  if (jall.contains("changeFilter")) {
+    auto jfilter = jall.at("changeFilter");
+    change_filter_enabled = jfilter.value("enabled", change_filter_enabled);
+    max_publish_ms = jfilter.value("maxPublishMs", max_publish_ms);
+  }
+
+  reload_check_ms = jall.value("reloadCheckMs", reload_check_ms);
+  retry_interval_ms = jall.value("retryIntervalMs", retry_interval_ms);
+  retry_max_ms = jall.value("retryMaxMs", retry_max_ms);
+  watchdog_timeout_ms = jall.value("watchdogTimeoutMs", watchdog_timeout_ms);
+
+  return read_opc_items(jall, vec_opc_data);
+}
+
+bool opc_reader::read_ini_json(std::filesystem::path const& path, nlohmann::json& jall) {
+  if (!std::filesystem::exists(path)) {
+    spdlog::error("opc_reader: ini file does not exists: {}", path.generic_string());
+    return false;
+  }
+
+  std::ifstream ifs(path);
+  try {
+    jall = nlohmann::json::parse(ifs);
+  } catch (const nlohmann::json::parse_error& e) {
+    spdlog::error("opc_reader: error reading json file");
+    spdlog::error("===============================");
+    spdlog::error("message: {0}", e.what());
+    spdlog::error("exception id:{0}", e.id);
+    spdlog::error("byte position of error: {0}", e.byte);
+    spdlog::error("===============================");
+    return false;
+  }
+  return true;
+}
+
+bool opc_reader::read_opc_items(nlohmann::json const& jall, std::vector<opc_data_point>& data_points) {
   if (!jall.contains("opcItems")) {
     spdlog::error("opc_reader: no entry for opcItems");
     return false;
   }
 
-  auto jarr = jall.at("opcItems");
+  auto const& jarr = jall.at("opcItems");
   if (!jarr.is_array()) {
     spdlog::error("opcItems must be array");
     return false;
   }
 
+  data_points.clear();
+  data_points.reserve(jarr.size());
   for (auto const& entry : jarr) {
-    if (!entry.is_object()) {
-      spdlog::error("entries in opcItems must be json objects");
-      return false;
-    }
-    if (!entry.contains("name")) {
-      spdlog::error("opc_reader: no entry for name in opcItems object {}", entry.dump());
-      return false;
-    }
-    if (!entry.contains("label")) {
-      spdlog::error("opc_reader: no entry for name in opcItems object {}", entry.dump());
-      return false;
-    }
-    if (!entry.contains("type")) {
-      spdlog::error("opc_reader: no entry for name in opcItems object {}", entry.dump());
-      return false;
-    }
     opc_data_point pt;
-    pt.name = entry["name"].get<std::string>();
-    pt.label = entry["label"].get<std::string>();
-    auto str_type = entry["type"].get<std::string>();
-    pt.dataType = match_opc_data_types(str_type);
-    if (pt.dataType == opc_data_types::UNKNOWN) {
-      spdlog::error("opc_reader: invalid entry for data type in opcItems object {}", str_type);
+    if (!read_opc_item(entry, pt)) {
       return false;
     }
-    vec_opc_data.push_back(pt);
+    data_points.push_back(pt);
+  }
+
+  if (demo_mode) {
+    auto sim_points = make_sim_data_points(simulation);
+    data_points.insert(data_points.end(), sim_points.begin(), sim_points.end());
   }
   return true;
 }
@@ -195,148 +294,662 @@ bool opc_reader::read_ini_file(std::string init_file_name) {
 // }
 
 void opc_reader::query_server() {
-  spdlog::info("starting server query loop with interval {} milliseconds", query_interval_ms);
+  spdlog::info("starting server query loop with default interval {} milliseconds", query_interval_ms);
+
+  reconnect_backoff backoff(retry_interval_ms, retry_max_ms, std::random_device{}());
+  auto wait_for_retry = [&]() {
+    auto delay = backoff.next_delay();
+    spdlog::warn("opc_reader: connection attempt {} failed, retrying in {} ms", backoff.attempts(), delay.count());
+    std::unique_lock lock(stop_mutex);
+    stop_cv.wait_for(lock, delay, [this]() { return stop_querry_loop.load(); });
+  };
+  while (!stop_querry_loop) {
+    {
+      std::lock_guard lock(stop_mutex);
+      connection_lost_reported = false;
+    }
+    session_received_data = false;
+    connection_health.set_state(connection_state::CONNECTING);
+    if (!source->connect() || !start_session()) {
+      source->disconnect();
+      connection_health.set_state(connection_state::DISCONNECTED);
+      wait_for_retry();
+      continue;
+    }
 
-  COPCHost* ptr_host{nullptr};
-  COPCServer* ptr_opc_server{nullptr};
-  COPCGroup* ptr_group{nullptr};
+    auto lost = session_mode == opc_query_mode::SUBSCRIBE ? run_subscription() : run_polling();
+    if (lost) {
+      connection_health.outage_started(std::chrono::steady_clock::now());
+    }
+    end_session();
+    connection_health.set_state(connection_state::DISCONNECTED);
+    if (!lost) {
+      continue;
+    }
+    publish_connection_loss();
+    spdlog::warn("opc_reader: connection to {} lost, rebuilding its groups and items", opc_server_name);
+    // only data shows the server works. A server that accepts the items and drops the connection before sending
+    // anything is retried with a growing delay like one that refuses the connection.
+    if (session_received_data) {
+      backoff.reset();
+    } else {
+      wait_for_retry();
+    }
+  }
+}
 
-  std::map<COPCItem*, opc_data_point> map_opc_items;
-  std::vector<COPCItem*> vec_opc_items;
+bool opc_reader::start_session() {
+  connection_health.set_state(connection_state::SUBSCRIBING);
+  auto add_start = std::chrono::steady_clock::now();
+  auto item_count = source->add_items(vec_opc_data);
+  auto add_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - add_start);
+  spdlog::info("opc_reader: {} of {} items added in {} ms", item_count, vec_opc_data.size(), add_time.count());
+  if (item_count == 0) {
+    // a server that is still starting may not know its items yet, so this is retried like a failed connect
+    spdlog::error("opc_reader: non of the querry items is available on server!");
+    return false;
+  }
+  samples.resize(vec_opc_data.size());
+
+  // every group is read on its own schedule, at the rate the server granted for it. The groups are numbered anew by
+  // every session.
+  scan_classes.clear();
+  auto now = std::chrono::steady_clock::now();
+  for (std::size_t group = 0; group < source->group_count(); group++) {
+    auto interval = std::chrono::milliseconds(source->update_rate_ms(group));
+    scan_classes.push_back(scan_class{.group = group, .interval = interval, .next_read = now, .last_success = now});
+    spdlog::info("opc_reader: group {} is read every {} milliseconds", group, interval.count());
+  }
 
-  spdlog::info("opc_reader trying to establish connection to server {}", opc_server_name);
-  COPCClient::init();
+  {
+    std::lock_guard lock(latency_mutex);
+    group_latency.clear();
+    for (std::size_t group = 0; group < source->group_count(); group++) {
+      group_latency.push_back(std::make_unique<cycle_latency>());
+    }
+  }
+  server_latency.reset();
+  next_reload_check = now + std::chrono::milliseconds(reload_check_ms);
+
+  session_mode = query_mode;
+  if (session_mode == opc_query_mode::SUBSCRIBE) {
+    auto on_change = [this](sample_buffer& changes) {
+      auto start = std::chrono::steady_clock::now();
+      data_received(start);
+      process_samples(changes);
+      auto publish_time = std::chrono::steady_clock::now() - start;
+      record_latency(changes, publish_time, changes.decode_time + publish_time);
+    };
+    if (source->subscribe(on_change)) {
+      spdlog::info("opc_reader: subscribed to {} items, waiting for data changes", vec_opc_data.size());
+    } else {
+      spdlog::warn("opc_reader: subscription failed, polling until the connection is rebuilt");
+      session_mode = opc_query_mode::POLL;
+    }
+  }
 
-  // wir verbinden uns immer zu einem server der auf demselben rechner läuft
-  std::string hostname = asio::ip::host_name();
-  ptr_host = COPCClient::makeHost(hostname);
+  {
+    std::lock_guard lock(stop_mutex);
+    accepting_writes = true;
+  }
+  connection_health.set_state(connection_state::RUNNING);
+  return true;
+}
 
-  // list available opc servers
-  std::vector<std::string> vec_local_servers;
-  try {
-    ptr_host->getListOfDAServers(IID_CATID_OPCDAServer20, vec_local_servers);
-  } catch (OPCException& ex) {
-    spdlog::warn("opc_reader could not connect to OPC server: {}", ex.reasonString());
-    return;
+bool opc_reader::run_subscription() {
+  auto now = std::chrono::steady_clock::now();
+  auto report_interval = std::chrono::milliseconds(report_interval_ms);
+  auto next_report = now + report_interval;
+  auto watchdog_interval = std::chrono::milliseconds(watchdog_timeout_ms);
+  if (watchdog_timeout_ms > 0 && opc_da.keep_alive_ms > 0 && !demo_mode) {
+    // with keep-alive the status check only looks at the time of the last callbacks, so it can run as often
+    watchdog_interval = std::min(watchdog_interval, std::chrono::milliseconds(opc_da.keep_alive_ms));
+  }
+  auto next_status_check = now + watchdog_interval;
+  // unchanged values raise no data change, their republish is due from the time they were published
+  auto next_republish = std::chrono::steady_clock::time_point::max();
+  if (change_filter_enabled) {
+    next_republish = republish_unchanged(now);
   }
 
-  if (vec_local_servers.empty()) {
-    spdlog::error("opc_reader no opc DA servers available on {}", hostname);
+  // values arrive through process_samples, we only have to keep the subscription alive, watch the server, execute the
+  // writes and apply reloads
+  std::unique_lock lock(stop_mutex);
+  while (!stop_querry_loop) {
+    auto wakeup = std::chrono::steady_clock::time_point::max();
+    if (report_response_time) {
+      wakeup = next_report;
+    }
+    if (watchdog_timeout_ms > 0) {
+      wakeup = std::min(wakeup, next_status_check);
+    }
+    wakeup = reload_wakeup(std::min(wakeup, next_republish));
+    if (wakeup == std::chrono::steady_clock::time_point::max()) {
+      stop_cv.wait(lock, [this]() { return wake_requested(); });
+    } else {
+      stop_cv.wait_until(lock, wakeup, [this]() { return wake_requested(); });
+    }
+    if (connection_lost_reported) {
+      return true;
+    }
+    lock.unlock();
+    now = std::chrono::steady_clock::now();
+    if (report_response_time && next_report <= now) {
+      report_latency();
+      next_report += report_interval;
+    }
+    // a server without changing values sends nothing, so silence alone says nothing about the connection
+    if (watchdog_timeout_ms > 0 && next_status_check <= now) {
+      next_status_check = now + watchdog_interval;
+      if (!source->check_status()) {
+        spdlog::error("opc_reader: server {} stopped answering", opc_server_name);
+        return true;
+      }
+    }
+    check_reload(now);
+    execute_writes();
+    // also after a reload, whose tags may be due sooner
+    if (change_filter_enabled) {
+      next_republish = republish_unchanged(now);
+    }
+    lock.lock();
+  }
+  return false;
+}
+
+bool opc_reader::run_polling() {
+  auto report_interval = std::chrono::milliseconds(report_interval_ms);
+  auto next_report = std::chrono::steady_clock::now() + report_interval;
+
+  while (!stop_querry_loop) {
+    if (connection_lost_reported) {
+      return true;
+    }
+    // writes go before the reads that are due, the values read afterwards already reflect them
+    execute_writes();
+
+    auto now = std::chrono::steady_clock::now();
+    check_reload(now);
+    for (auto& scan : scan_classes) {
+      if (scan.next_read > now) {
+        continue;
+      }
+      spdlog::debug("new opc server query of group {}", scan.group);
+
+      auto start = std::chrono::steady_clock::now();
+      if (source->read(scan.group, samples)) {
+        auto publish_start = std::chrono::steady_clock::now();
+        scan.last_success = publish_start;
+        // a group a reload emptied reads nothing, there is nothing to publish but the group is healthy
+        if (!samples.updated.empty()) {
+          data_received(publish_start);
+          process_samples(samples);
+          auto done = std::chrono::steady_clock::now();
+          record_latency(samples, done - publish_start, done - start);
+        }
+      }
+      scan.advance(std::chrono::steady_clock::now(), overrun);
+    }
+    if (!check_watchdog(std::chrono::steady_clock::now())) {
+      return true;
+    }
+
+    auto next_wakeup = std::ranges::min(scan_classes, {}, &scan_class::next_read).next_read;
+    if (report_response_time) {
+      if (next_report <= now) {
+        report_latency();
+        next_report += report_interval;
+      }
+      next_wakeup = std::min(next_wakeup, next_report);
+    }
+    std::unique_lock lock(stop_mutex);
+    stop_cv.wait_until(lock, reload_wakeup(next_wakeup), [this]() { return wake_requested(); });
+  }
+  return false;
+}
+
+void opc_reader::end_session() {
+  close_writes();
+
+  for (auto const& scan : scan_classes) {
+    if (scan.overruns > 0) {
+      spdlog::info("opc_reader: group {} overran {} times, {} ticks missed", scan.group, scan.overruns,
+                   scan.missed_ticks);
+    }
+  }
+  source->disconnect();
+}
+
+bool opc_reader::check_watchdog(std::chrono::steady_clock::time_point now) {
+  auto watchdog_timeout = std::chrono::milliseconds(watchdog_timeout_ms);
+  bool any_late = false;
+  bool newly_late = false;
+  for (auto& scan : scan_classes) {
+    auto silence = now - scan.last_success;
+    if (watchdog_timeout_ms > 0 && silence > std::max(watchdog_timeout, 4 * scan.interval)) {
+      spdlog::error("opc_reader: group {} delivered no data for {} ms, rebuilding the connection", scan.group,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(silence).count());
+      return false;
+    }
+    // a group that missed a whole cycle is late, pipelined reads and slow servers stay below that
+    auto late = silence > 2 * scan.interval;
+    if (late && !scan.late) {
+      spdlog::warn("opc_reader: group {} is late, no data for {} ms", scan.group,
+                   std::chrono::duration_cast<std::chrono::milliseconds>(silence).count());
+      newly_late = true;
+    }
+    scan.late = late;
+    any_late = any_late || late;
+  }
+
+  // a late group is often the first sign of a server that went away, its status tells that from a slow server
+  // without waiting for the watchdog
+  if (newly_late && !source->check_status()) {
+    spdlog::error("opc_reader: server {} stopped answering", opc_server_name);
+    return false;
+  }
+  connection_health.set_state(any_late ? connection_state::DEGRADED : connection_state::RUNNING);
+  return true;
+}
+
+void opc_reader::data_received(std::chrono::steady_clock::time_point time) {
+  if (!session_received_data.load(std::memory_order_relaxed)) {
+    session_received_data.store(true, std::memory_order_relaxed);
+  }
+  auto outage = connection_health.data_received(time);
+  if (outage.count() > 0) {
+    spdlog::info("opc_reader: data received again {} ms after the connection to {} was lost",
+                 std::chrono::duration_cast<std::chrono::milliseconds>(outage).count(), opc_server_name);
+  }
+}
+
+void opc_reader::publish_connection_loss() {
+  // in subscribe mode the data changes are decoded into buffers of the source, the values of samples are not the last
+  // ones published. A failed error publishes the bad quality without a value, so clients and the snapshot do not take
+  // these values for real ones.
+  auto now = std::chrono::system_clock::now();
+  samples.updated.clear();
+  for (std::size_t i = 0; i < vec_opc_data.size(); i++) {
+    if (vec_opc_data[i].removed) {
+      continue;
+    }
+    samples.quality[i] = 0x18;  // OPC_QUALITY_COMM_FAILURE
+    samples.timestamp[i] = now;
+    samples.error[i] = write_error_failed;
+    samples.updated.push_back(static_cast<std::uint32_t>(i));
+  }
+  samples.group = 0;
+  samples.read_time = std::chrono::nanoseconds(0);
+  samples.decode_time = std::chrono::nanoseconds(0);
+  process_samples(samples);
+}
+
+std::chrono::steady_clock::time_point opc_reader::reload_wakeup(std::chrono::steady_clock::time_point wakeup) const {
+  // the loops wake up for the next reload check unless reloads only happen on request
+  return reload_check_ms > 0 ? std::min(wakeup, next_reload_check) : wakeup;
+}
+
+bool opc_reader::wake_requested() const {
+  return stop_querry_loop.load() || connection_lost_reported.load() || !write_queue.empty() || reload_requested;
+}
+
+void opc_reader::connection_lost(std::string const& reason) {
+  spdlog::error("opc_reader: connection lost, {}", reason);
+  {
+    std::lock_guard lock(stop_mutex);
+    connection_lost_reported = true;
+  }
+  stop_cv.notify_all();
+}
+
+void opc_reader::record_latency(sample_buffer const& changes,
+                                std::chrono::nanoseconds publish_time,
+                                std::chrono::nanoseconds cycle_time) {
+  cycle_latency* group;
+  {
+    std::lock_guard lock(latency_mutex);
+    while (group_latency.size() <= changes.group) {
+      group_latency.push_back(std::make_unique<cycle_latency>());
+    }
+    group = group_latency[changes.group].get();
+  }
+  for (auto* latency : {group, &server_latency}) {
+    // data changes pushed by the server have no read call to time
+    if (session_mode == opc_query_mode::POLL) {
+      latency->read.record(changes.read_time);
+      auto& by_source = changes.read_from == read_source::CACHE ? latency->cache_read : latency->device_read;
+      by_source.record(changes.read_time);
+    }
+    latency->decode.record(changes.decode_time);
+    latency->publish.record(publish_time);
+    latency->cycle.record(cycle_time);
+  }
+}
+
+void opc_reader::report_latency() {
+  std::lock_guard lock(latency_mutex);
+  for (std::size_t group = 0; group < group_latency.size(); group++) {
+    group_latency[group]->log(fmt::format("group {}", group));
+    group_latency[group]->reset();
+  }
+  server_latency.log(fmt::format("server {}", opc_server_name));
+  server_latency.reset();
+  connection_health.log(fmt::format("server {}", opc_server_name));
+  if (change_filter_enabled) {
+    filter.report(fmt::format("server {}", opc_server_name));
+  }
+}
+
+void opc_reader::request_reload() {
+  {
+    std::lock_guard lock(stop_mutex);
+    reload_requested = true;
+  }
+  stop_cv.notify_all();
+}
+
+void opc_reader::check_reload(std::chrono::steady_clock::time_point now) {
+  bool requested;
+  {
+    std::lock_guard lock(stop_mutex);
+    requested = reload_requested;
+    reload_requested = false;
+  }
+  auto check_due = reload_check_ms > 0 && next_reload_check <= now;
+  if (!requested && !check_due) {
     return;
   }
+  if (check_due) {
+    next_reload_check = now + std::chrono::milliseconds(reload_check_ms);
+  }
 
-  // gibt es unseren server
-  if (std::ranges::find(vec_local_servers, opc_server_name) == vec_local_servers.end()) {
+  std::error_code ec;
+  auto write_time = std::filesystem::last_write_time(ini_path, ec);
+  if (!requested && (ec || write_time == ini_write_time)) {
     return;
   }
+  if (!ec) {
+    ini_write_time = write_time;
+  }
+  spdlog::info("opc_reader: reloading the items of {}", ini_path.generic_string());
+  reload_items();
+}
 
-  // connect to opc server
+void opc_reader::reload_items() {
+  nlohmann::json jall;
+  std::vector<opc_data_point> items;
   try {
-    ptr_opc_server = ptr_host->connectDAServer(opc_server_name);
-  } catch (OPCException& ex) {
-    spdlog::warn("opc_reader: could not connect to OPC server {}", ex.reasonString());
+    if (!read_ini_json(ini_path, jall) || !read_opc_items(jall, items)) {
+      spdlog::warn("opc_reader: reload failed, keeping the current items");
+      return;
+    }
+  } catch (nlohmann::json::exception const& e) {
+    spdlog::warn("opc_reader: reload failed, keeping the current items, reason: {}", e.what());
     return;
   }
-
-  // Check status
-  ServerStatus status;
-  ptr_opc_server->getStatus(status);
-  spdlog::info("{}: server state is {}", opc_server_name, status.dwServerState);
-  if (status.dwServerState != OPCSERVERSTATE::OPC_STATUS_RUNNING) {
-    spdlog::error("opc_reader: opc server state != RUNNING");
+  spdlog::info("opc_reader: settings other than opcItems take effect after a restart");
+
+  // items are matched by name. A new name is appended, a known one keeps its index even if it was removed before, and
+  // a name that is no longer configured becomes a tombstone.
+  auto data_points = vec_opc_data;
+  std::unordered_map<std::string, std::uint32_t> index_by_name;
+  index_by_name.reserve(data_points.size());
+  for (std::size_t i = 0; i < data_points.size(); i++) {
+    index_by_name.emplace(data_points[i].name, static_cast<std::uint32_t>(i));
+  }
+  std::vector<bool> configured(data_points.size(), false);
+  std::vector<std::uint32_t> changed;
+  std::size_t added = 0;
+  std::size_t removed = 0;
+  for (auto& item : items) {
+    auto [it, inserted] = index_by_name.emplace(item.name, static_cast<std::uint32_t>(data_points.size()));
+    if (inserted) {
+      data_points.push_back(std::move(item));
+      configured.push_back(true);
+      changed.push_back(it->second);
+      added++;
+      continue;
+    }
+    if (configured[it->second]) {
+      spdlog::warn("opc_reader: item {} is configured more than once, the first entry is used", item.name);
+      continue;
+    }
+    configured[it->second] = true;
+    auto& current = data_points[it->second];
+    if (current.removed || current.label != item.label || current.dataType != item.dataType ||
+        current.rate_ms != item.rate_ms || !same_item_settings(current, item) || current.deadband != item.deadband ||
+        current.max_publish_ms != item.max_publish_ms) {
+      added += current.removed ? 1 : 0;
+      current = std::move(item);
+      changed.push_back(it->second);
+    }
+  }
+  for (std::size_t i = 0; i < configured.size(); i++) {
+    if (!configured[i] && !data_points[i].removed) {
+      data_points[i].removed = true;
+      changed.push_back(static_cast<std::uint32_t>(i));
+      removed++;
+    }
+  }
+  if (changed.empty()) {
+    spdlog::info("opc_reader: reload found no changed items");
     return;
   }
+  std::ranges::sort(changed);
 
-  // make group
-  unsigned long refresh_rate;
-  ptr_group = ptr_opc_server->makeGroup("Group", true, query_interval_ms, refresh_rate, 0.0);
-  if (refresh_rate != query_interval_ms) {
-    spdlog::warn("opc_reader: {} requested update rate was {} but got {}", opc_server_name, query_interval_ms,
-                 refresh_rate);
+  // subscribers learn the new tags before the first of their values arrives
+  if (data_points_handler) {
+    data_points_handler(data_points, changed);
+  }
+  if (change_filter_enabled) {
+    filter.update(data_points, changed);
+  }
+  auto group_count = source->group_count();
+  auto item_count = source->update_items(data_points, changed);
+  {
+    std::lock_guard lock(data_points_mutex);
+    vec_opc_data = std::move(data_points);
+  }
+  samples.resize(vec_opc_data.size());
 
-    if (refresh_rate > query_interval_ms) {
-      query_interval_ms = refresh_rate;
-      spdlog::info("opc_reader: adjusting query interval time to {} milliseconds", query_interval_ms);
-    }
+  auto now = std::chrono::steady_clock::now();
+  for (auto group = group_count; group < source->group_count(); group++) {
+    auto interval = std::chrono::milliseconds(source->update_rate_ms(group));
+    scan_classes.push_back(scan_class{.group = group, .interval = interval, .next_read = now, .last_success = now});
+    spdlog::info("opc_reader: group {} added, it is read every {} milliseconds", group, interval.count());
   }
+  spdlog::info("opc_reader: reload added {}, removed {} and modified {} items, {} items registered with the source",
+               added, removed, changed.size() - added - removed, item_count);
+}
 
-  // add our items to group
-  for (auto data_point : vec_opc_data) {
-    try {
-      COPCItem* new_item = ptr_group->addItem(data_point.name, true);
-      vec_opc_items.push_back(new_item);
-      map_opc_items[new_item] = data_point;
-    } catch (OPCException& ex) {
-      spdlog::warn("opc_reader could not add OPC item <<{}>> reason: {}", data_point.name, ex.reasonString());
+void opc_reader::write(std::vector<tag_write> writes, write_callback done) {
+  auto count = writes.size();
+  {
+    std::lock_guard lock(stop_mutex);
+    if (accepting_writes) {
+      write_queue.push_back(pending_write{std::move(writes), std::move(done)});
+      done = nullptr;
     }
   }
-
-  if (vec_opc_data.size() != vec_opc_data.size()) {
-    spdlog::warn("opc_reader only {} out of {} items created", vec_opc_data.size(), vec_opc_data.size());
-  } else {
-    spdlog::info("opc_reader only {} out of {} items created", vec_opc_data.size(), vec_opc_data.size());
+  if (done) {
+    done(std::vector<std::int32_t>(count, write_error_failed));
+    return;
   }
+  stop_cv.notify_all();
+}
 
-  if (vec_opc_items.empty()) {
-    spdlog::error("opc_reader: non of the querry items is available on server!");
-    spdlog::error("opc_reader: shutting down!");
-    return;
+void opc_reader::execute_writes() {
+  std::deque<pending_write> pending;
+  {
+    std::lock_guard lock(stop_mutex);
+    pending.swap(write_queue);
   }
 
-  // actual thread loop
-  while (!stop_querry_loop) {
-    spdlog::info("new opc server query");
-
-    // SYNCED read on Group
-    COPCItem_DataMap opcData;
-    try {
-      spdlog::info("opc group read of {} items", vec_opc_items.size());
-      ptr_group->readSync(vec_opc_items, opcData, OPC_DS_DEVICE);
-    } catch (OPCException& ex) {
-      spdlog::warn("reading opc items failed, reason: {}", ex.reasonString());
-    }
-
-    POSITION pos = opcData.GetStartPosition();
-    while (pos != nullptr) {
-      COPCItem* item = opcData.GetKeyAt(pos);
-      // std::string itemName = item->getName();
-      opc_data_point pt = map_opc_items.at(item);
-      OPCItemData* data = opcData.GetNextValue(pos);
-      std::variant<int, double, std::string> var;
-      switch (pt.dataType) {
-        case opc_data_types::BYTE:
-        case opc_data_types::WORD:
-        case opc_data_types::INT:
-          var = data->vDataValue.iVal;
-          spdlog::trace("name: {} --> value: {}", item->getName(), std::get<int>(var));
-          break;
-        case opc_data_types::STRING: {
-          int wslen = ::SysStringLen(data->vDataValue.bstrVal);
-          int len = ::WideCharToMultiByte(CP_ACP, 0, (wchar_t*)data->vDataValue.bstrVal, wslen, NULL, 0, NULL, NULL);
-
-          std::string dblstr(len, '\0');
-          len =
-            ::WideCharToMultiByte(CP_ACP, 0, (wchar_t*)data->vDataValue.bstrVal, wslen, &dblstr[0], len, NULL, NULL);
-          var = dblstr;
-        }
-          spdlog::info("name: {} --> value: {}", item->getName(), std::get<std::string>(var));
-          break;
-          case opc_data_types::FLOAT:
-          var = data->vDataValue.fltVal;
-          spdlog::info("name: {} --> value: {}", item->getName(), std::get<double>(var));
+  std::vector<tag_write> unique;
+  std::vector<std::size_t> slots;
+  std::unordered_map<std::uint32_t, std::size_t> slot_by_index;
+  std::vector<std::int32_t> unique_errors;
+  for (auto& p : pending) {
+    // a tag written more than once in one request is written once with its last value, all its writes get the result
+    unique.clear();
+    slots.resize(p.writes.size());
+    slot_by_index.clear();
+    for (std::size_t k = 0; k < p.writes.size(); k++) {
+      auto [it, inserted] = slot_by_index.emplace(p.writes[k].index, unique.size());
+      if (inserted) {
+        unique.push_back(p.writes[k]);
+      } else {
+        unique[it->second].value = p.writes[k].value;
       }
+      slots[k] = it->second;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (!source->write(unique, unique_errors)) {
+      spdlog::warn("opc_reader: a server call writing {} values failed", unique.size());
     }
+    auto write_time = std::chrono::steady_clock::now() - start;
+    spdlog::debug("opc_reader: wrote {} values for {} writes in {} us", unique.size(), p.writes.size(),
+                  std::chrono::duration_cast<std::chrono::microseconds>(write_time).count());
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(query_interval_ms));
+    std::vector<std::int32_t> errors(p.writes.size());
+    for (std::size_t k = 0; k < p.writes.size(); k++) {
+      errors[k] = unique_errors[slots[k]];
+    }
+    p.done(errors);
+  }
+}
+
+void opc_reader::close_writes() {
+  std::deque<pending_write> pending;
+  {
+    std::lock_guard lock(stop_mutex);
+    accepting_writes = false;
+    pending.swap(write_queue);
+  }
+  for (auto& p : pending) {
+    p.done(std::vector<std::int32_t>(p.writes.size(), write_error_failed));
   }
 }
 
 void opc_reader::stop_query() {
-  stop_querry_loop = true;
+  {
+    std::lock_guard lock(stop_mutex);
+    stop_querry_loop = true;
+  }
+  stop_cv.notify_all();
+}
+
+void scan_class::advance(std::chrono::steady_clock::time_point done, overrun_policy policy) {
+  auto following = next_read + interval;
+  if (following > done) {
+    next_read = following;
+    return;
+  }
+
+  // the read took longer than the interval, done - next_read spans at least one tick
+  auto missed = static_cast<std::uint64_t>((done - next_read) / interval);
+  overruns++;
+  missed_ticks += missed;
+  spdlog::debug("opc_reader: group {} overran by {} ticks", group, missed);
+
+  switch (policy) {
+    case overrun_policy::SKIP:
+      next_read += interval * (missed + 1);
+      break;
+    case overrun_policy::COALESCE:
+      next_read = done;
+      break;
+    case overrun_policy::CATCH_UP:
+      next_read = following;
+      break;
+  }
 }
 
 bool opc_reader::read_opc_item(nlohmann::json const& obj, opc_data_point& dp) {
-  return false;
+  if (!obj.is_object()) {
+    spdlog::error("entries in opcItems must be json objects");
+    return false;
+  }
+  if (!obj.contains("name")) {
+    spdlog::error("opc_reader: no entry for name in opcItems object {}", obj.dump());
+    return false;
+  }
+  if (!obj.contains("label")) {
+    spdlog::error("opc_reader: no entry for label in opcItems object {}", obj.dump());
+    return false;
+  }
+  if (!obj.contains("type")) {
+    spdlog::error("opc_reader: no entry for type in opcItems object {}", obj.dump());
+    return false;
+  }
+  dp.name = obj["name"].get<std::string>();
+  dp.label = obj["label"].get<std::string>();
+  auto str_type = obj["type"].get<std::string>();
+  dp.dataType = match_opc_data_types(str_type);
+  if (dp.dataType == opc_data_types::UNKNOWN) {
+    spdlog::error("opc_reader: invalid entry for data type in opcItems object {}", str_type);
+    return false;
+  }
+  // items without rateMs are read with the query interval
+  dp.rate_ms = obj.value("rateMs", 0UL);
+  dp.server_deadband_percent = obj.value("serverDeadbandPercent", 0.0F);
+  dp.sampling_ms = obj.value("samplingMs", 0UL);
+  dp.buffer_samples = obj.value("bufferSamples", false);
+  return read_change_filter(obj, dp);
+}
+
+bool opc_reader::read_change_filter(nlohmann::json const& obj, opc_data_point& dp) {
+  dp.deadband = obj.value("deadband", 0.0);
+  dp.max_publish_ms = obj.value("maxPublishMs", 0UL);
+  if (!obj.contains("deadbandPercent")) {
+    return true;
+  }
+  // like an OPC percent deadband it is relative to the engineering unit range of the item
+  if (obj.contains("deadband")) {
+    spdlog::error("opc_reader: set either deadband or deadbandPercent in opcItems object {}", obj.dump());
+    return false;
+  }
+  if (!obj.contains("euLow") || !obj.contains("euHigh")) {
+    spdlog::error("opc_reader: deadbandPercent needs euLow and euHigh in opcItems object {}", obj.dump());
+    return false;
+  }
+  auto eu_low = obj["euLow"].get<double>();
+  auto eu_high = obj["euHigh"].get<double>();
+  if (!(eu_high > eu_low)) {
+    spdlog::error("opc_reader: euHigh must be above euLow in opcItems object {}", obj.dump());
+    return false;
+  }
+  dp.deadband = obj["deadbandPercent"].get<double>() / 100.0 * (eu_high - eu_low);
+  return true;
+}
+
+bool opc_reader::read_group_reads(nlohmann::json const& obj, group_read_config& reads) {
+  if (obj.contains("dataSource")) {
+    auto str_mode = obj["dataSource"].get<std::string>();
+    auto mode = match_group_read_mode(str_mode);
+    if (!mode) {
+      spdlog::error("opc_reader: invalid entry for dataSource {}", str_mode);
+      return false;
+    }
+    reads.mode = *mode;
+  }
+  reads.verify_interval_ms = obj.value("deviceVerifyMs", reads.verify_interval_ms);
+  return true;
+}
+
+std::optional<group_read_mode> opc_reader::match_group_read_mode(std::string smode) {
+  std::transform(smode.begin(), smode.end(), smode.begin(), [](unsigned char c) { return std::toupper(c); });
+  if (smode.compare("DEVICE") == 0) {
+    return group_read_mode::DEVICE;
+  }
+  if (smode.compare("CACHE") == 0) {
+    return group_read_mode::CACHE;
+  }
+  if (smode.compare("CACHEVERIFY") == 0) {
+    return group_read_mode::CACHE_VERIFY;
+  }
+  return std::nullopt;
 }
 
 opc_data_types opc_reader::match_opc_data_types(std::string sdt) {
@@ -360,6 +973,86 @@ opc_data_types opc_reader::match_opc_data_types(std::string sdt) {
   return opc_data_types::UNKNOWN;
 }
 
+std::unique_ptr<tag_source> opc_reader::make_tag_source() const {
+  if (demo_mode) {
+    return std::make_unique<sim_source>(simulation, query_interval_ms);
+  }
+#ifdef _WIN32
+  return std::make_unique<opc_da_source>(opc_server_name, query_interval_ms, query_mode == opc_query_mode::SUBSCRIBE,
+                                         opc_da);
+#else
+  spdlog::error("opc_reader: OPC DA servers are only reachable on windows, set demoMode to use the simulation");
+  return nullptr;
+#endif
+}
+
+std::vector<opc_data_point> opc_reader::data_points() const {
+  std::lock_guard lock(data_points_mutex);
+  return vec_opc_data;
+}
+
+void opc_reader::process_samples(sample_buffer& changes) {
+  spdlog::debug("opc_reader: {} values received", changes.updated.size());
+  if (change_filter_enabled) {
+    filter.apply(changes, std::chrono::steady_clock::now());
+    if (changes.updated.empty()) {
+      return;
+    }
+  }
+  if (spdlog::should_log(spdlog::level::trace)) {
+    std::lock_guard lock(data_points_mutex);
+    for (auto index : changes.updated) {
+      auto const& pt = vec_opc_data[index];
+      std::visit([&](auto const& v) { spdlog::trace("name: {} --> value: {}", pt.name, v); },
+                 changes.value(index, pt.dataType));
+    }
+  }
+  if (batch_handler) {
+    batch_handler(changes);
+  }
+}
+
+std::chrono::steady_clock::time_point opc_reader::republish_unchanged(std::chrono::steady_clock::time_point now) {
+  auto next_due = filter.republish_due(samples, now);
+  if (samples.updated.empty()) {
+    return next_due;
+  }
+  spdlog::debug("opc_reader: {} unchanged values republished", samples.updated.size());
+  // the values may come from every group and were not read now
+  samples.group = 0;
+  samples.read_time = std::chrono::nanoseconds(0);
+  samples.decode_time = std::chrono::nanoseconds(0);
+  if (batch_handler) {
+    batch_handler(samples);
+  }
+  return next_due;
+}
+
+opc_query_mode opc_reader::match_opc_query_mode(std::string smode) {
+  std::transform(smode.begin(), smode.end(), smode.begin(), [](unsigned char c) { return std::toupper(c); });
+  if (smode.compare("SUBSCRIBE") == 0) {
+    return opc_query_mode::SUBSCRIBE;
+  }
+  if (smode.compare("POLL") != 0) {
+    spdlog::warn("opc_reader: unknown query mode {}, using poll", smode);
+  }
+  return opc_query_mode::POLL;
+}
+
+overrun_policy opc_reader::match_overrun_policy(std::string spolicy) {
+  std::transform(spolicy.begin(), spolicy.end(), spolicy.begin(), [](unsigned char c) { return std::toupper(c); });
+  if (spolicy.compare("COALESCE") == 0) {
+    return overrun_policy::COALESCE;
+  }
+  if (spolicy.compare("CATCHUP") == 0) {
+    return overrun_policy::CATCH_UP;
+  }
+  if (spolicy.compare("SKIP") != 0) {
+    spdlog::warn("opc_reader: unknown overrun policy {}, using skip", spolicy);
+  }
+  return overrun_policy::SKIP;
+}
+
 // OPCReader::OPCReader() {
 //   readerConnected = false;
 //   group = nullptr;
@@ -7,42 +7,176 @@
 #include <string>
 #include <string_view>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 
 #include <spdlog/spdlog.h>
 
 #include <nlohmann/json.hpp>
 
-#include <OPCClient.h>
-#include <OPCGroup.h>
-#include <OPCHost.h>
-#include <OPCItem.h>
-#include <OPCServer.h>
-#include <opcda.h>
+#include "changefilter.h"
+#include "latency.h"
+#include "opcdaconfig.h"
+#include "simsource.h"
+#include "supervisor.h"
+#include "tagsource.h"
 
-enum struct opc_data_types { UNKNOWN, STRING, FLOAT, BYTE, WORD, INT };
+// POLL reads every item each cycle, SUBSCRIBE lets the source push changed items
+enum struct opc_query_mode { POLL, SUBSCRIBE };
 
-struct opc_data_point {
-  std::string name;
-  std::string label;
-  opc_data_types dataType;
+// what the poll loop does with ticks that passed while a read was still running.
+// SKIP drops them and stays on the original grid, COALESCE reads once right away and restarts the grid from there,
+// CATCH_UP reads every missed tick back to back.
+enum struct overrun_policy { SKIP, COALESCE, CATCH_UP };
+
+// poll schedule of one group of the tag source, deadlines are absolute so the period does not drift with the read time
+struct scan_class {
+  std::size_t group{0};
+  std::chrono::milliseconds interval{0};
+  std::chrono::steady_clock::time_point next_read;
+
+  // cycles that ended after the following deadline, and the number of ticks they missed
+  std::uint64_t overruns{0};
+  std::uint64_t missed_ticks{0};
+
+  // end of the last read that delivered data, and whether the watchdog found the group late
+  std::chrono::steady_clock::time_point last_success;
+  bool late{false};
+
+  // moves next_read to the following deadline once the read due at next_read finished at done
+  void advance(std::chrono::steady_clock::time_point done, overrun_policy policy);
 };
 
+// receives the complete data point list after a configuration reload and the indices of the added, removed and
+// modified data points. Indices are never reused, removed data points stay in the list as tombstones.
+using data_points_callback =
+  std::function<void(std::vector<opc_data_point> const& data_points, std::vector<std::uint32_t> const& changed)>;
+
 class opc_reader {
  public:
   explicit opc_reader(std::string t_init_file_name);
   bool init();
+
+  // connects to the server and delivers data until stop_query. A lost connection is rebuilt with all its groups and
+  // items, failed attempts are retried with a backoff starting at retry_interval_ms. A session lost before it
+  // delivered data counts as a failed attempt.
   void query_server();
   void stop_query();
 
+  // state of the connection and its outages, may be read from any thread
+  connection_metrics const& connection() const { return connection_health; }
+
+  // receives every read or data change batch after the reader processed it. Set before query_server, may be called
+  // from several threads at once in subscribe mode.
+  void set_batch_handler(sample_callback handler) { batch_handler = std::move(handler); }
+
+  // a copy of the current data points, the ones read by init or by the last reload. Reloads replace them on the query
+  // thread, the data points handler learns of each.
+  std::vector<opc_data_point> data_points() const;
+
+  // called by the query loop with the new data points of a reload, before the source registers them. Set before
+  // query_server.
+  void set_data_points_handler(data_points_callback handler) { data_points_handler = std::move(handler); }
+
+  // makes the query loop reload the opcItems of the ini file, whether the file changed or not
+  void request_reload();
+
+  // queues writes for the query loop, which executes them between reads on the thread that owns the connection.
+  // done is called exactly once, from the query loop or right away if the loop is not running.
+  void write(std::vector<tag_write> writes, write_callback done);
+
  protected:
   bool read_ini_file(std::string init_file_name);
 
+  // parses the ini file, false if it is missing or not valid json
+  bool read_ini_json(std::filesystem::path const& path, nlohmann::json& jall);
+
   // bool connect_to_server();
 
   bool read_opc_item(nlohmann::json const& obj, opc_data_point& dp);
 
+  // the deadband, deadbandPercent, euLow, euHigh and maxPublishMs of an opcItems object
+  bool read_change_filter(nlohmann::json const& obj, opc_data_point& dp);
+
+  // the opcItems of the ini file, followed by the simulated tags in demo mode
+  bool read_opc_items(nlohmann::json const& jall, std::vector<opc_data_point>& data_points);
+
+  // reloads the items if a reload was requested or the ini file changed since it was read last
+  void check_reload(std::chrono::steady_clock::time_point now);
+
+  // applies the difference between the items of the ini file and the current ones to the source, only the changed
+  // items are added to or removed from the server
+  void reload_items();
+
+  // the dataSource and deviceVerifyMs of an opcDa or opcDa groups object
+  bool read_group_reads(nlohmann::json const& obj, group_read_config& reads);
+
   opc_data_types match_opc_data_types(std::string sdt);
 
+  std::optional<group_read_mode> match_group_read_mode(std::string smode);
+
+  opc_query_mode match_opc_query_mode(std::string smode);
+
+  overrun_policy match_overrun_policy(std::string spolicy);
+
+  std::unique_ptr<tag_source> make_tag_source() const;
+
+  // drops the unchanged values if the change filter is enabled and hands the rest to the batch handler
+  void process_samples(sample_buffer& samples);
+
+  // hands the values whose max_publish_ms ran out without a data change to the batch handler, returns when the next
+  // one is due
+  std::chrono::steady_clock::time_point republish_unchanged(std::chrono::steady_clock::time_point now);
+
+  // adds the items, sets up the scan classes and subscribes, false if no item could be added
+  bool start_session();
+
+  // the loops of a running session, true if the connection was lost and false if the loop was stopped
+  bool run_polling();
+  bool run_subscription();
+
+  // fails the pending writes and disconnects the source
+  void end_session();
+
+  // false if a group stalled or the server stopped answering, then the connection has to be rebuilt. Switches
+  // between RUNNING and DEGRADED as groups fall behind and catch up.
+  bool check_watchdog(std::chrono::steady_clock::time_point now);
+
+  // closes an open outage once data arrives again and marks the session as healthy
+  void data_received(std::chrono::steady_clock::time_point time);
+
+  // called by the source when it learns the connection is gone, ends the running session right away
+  void connection_lost(std::string const& reason);
+
+  // publishes a bad quality and a failed error without a value for all tags after the connection was lost
+  void publish_connection_loss();
+
+  // wakeup, or the next reload check if it comes first
+  std::chrono::steady_clock::time_point reload_wakeup(std::chrono::steady_clock::time_point wakeup) const;
+
+  // true if the query loop has to run before its next deadline, called with stop_mutex held
+  bool wake_requested() const;
+
+  // executes the queued writes, called by the query loop without holding stop_mutex
+  void execute_writes();
+
+  // fails the queued writes and every later one, called when the query loop ends
+  void close_writes();
+
+  // records the phases of one cycle for its group and for the server
+  void record_latency(sample_buffer const& changes,
+                      std::chrono::nanoseconds publish_time,
+                      std::chrono::nanoseconds cycle_time);
+
+  // logs and resets the latency histograms
+  void report_latency();
+
  private:
   bool init_ok{false};
 
@@ -52,13 +186,81 @@ class opc_reader {
   std::string opc_server_name;
 
   unsigned long query_interval_ms{2000};
+  // the delay before reconnecting doubles from retry_interval_ms up to retry_max_ms
   unsigned long retry_interval_ms{2000};
+  unsigned long retry_max_ms{60000};
+  // a poll group without data for watchdog_timeout_ms, and at least four of its intervals, makes the reader
+  // reconnect. In subscribe mode the server status is checked at this interval, or at the keep-alive time if that
+  // is shorter. 0 disables the watchdog.
+  unsigned long watchdog_timeout_ms{10000};
 
-  bool report_response_time;
+  // the ini file is checked for changes every reload_check_ms, 0 only reloads on request
+  unsigned long reload_check_ms{2000};
+  std::filesystem::path ini_path;
+  std::filesystem::file_time_type ini_write_time;
+  std::chrono::steady_clock::time_point next_reload_check;
 
+  // the configured mode, and the mode of the running session. A session whose subscription failed polls, the next
+  // session tries to subscribe again.
+  opc_query_mode query_mode{opc_query_mode::POLL};
+  opc_query_mode session_mode{opc_query_mode::POLL};
+  overrun_policy overrun{overrun_policy::SKIP};
+
+  // demo mode replaces the OPC server by the simulated tag source
+  bool demo_mode{false};
+  sim_config simulation;
+
+  opc_da_config opc_da;
+
+  // client side change detection, changeFilter in the ini file. Off unless enabled, then every tag is filtered with
+  // its own deadband, unchanged values are published again after max_publish_ms. A poll reads them again, a
+  // subscription has the query loop republish the values published last.
+  bool change_filter_enabled{false};
+  unsigned long max_publish_ms{0};
+  change_filter filter;
+
+  std::unique_ptr<tag_source> source;
+
+  // read target of the poll loop and of the republish of a subscription, sized once after the items are added
+  sample_buffer samples;
+
+  std::vector<scan_class> scan_classes;
+
+  // log latency percentiles every report_interval_ms
+  bool report_response_time{false};
+  unsigned long report_interval_ms{60000};
+
+  // grows when a reload adds a group, data changes of the new group may be recorded before the reload returned
+  std::mutex latency_mutex;
+  std::vector<std::unique_ptr<cycle_latency>> group_latency;
+  cycle_latency server_latency;
+
+  connection_metrics connection_health;
+
+  // replaced by a reload under data_points_mutex, data changes read it concurrently to trace their values
+  mutable std::mutex data_points_mutex;
   std::vector<opc_data_point> vec_opc_data;
 
+  sample_callback batch_handler;
+  data_points_callback data_points_handler;
+
+  struct pending_write {
+    std::vector<tag_write> writes;
+    write_callback done;
+  };
+
   std::atomic<bool> stop_querry_loop{false};
+  // set by the source between two status checks, like stop_querry_loop it is written under stop_mutex
+  std::atomic<bool> connection_lost_reported{false};
+  // set by the first data of a session, the reconnect backoff starts over only after a session delivered data
+  std::atomic<bool> session_received_data{false};
+  // lets stop_query, write and request_reload wake the query loop instead of waiting for the next deadline, guards
+  // the write queue and reload_requested
+  std::mutex stop_mutex;
+  std::condition_variable stop_cv;
+  std::deque<pending_write> write_queue;
+  bool accepting_writes{false};
+  bool reload_requested{false};
 };
 
 #endif  // OPCREADER_H
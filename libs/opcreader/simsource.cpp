@@ -0,0 +1,314 @@
+#include "simsource.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+std::vector<opc_data_point> make_sim_data_points(sim_config const& config) {
+  std::vector<opc_data_point> data_points;
+  if (config.types.empty()) {
+    return data_points;
+  }
+  data_points.reserve(config.tag_count);
+  for (std::size_t i = 0; i < config.tag_count; i++) {
+    opc_data_point pt;
+    pt.name = fmt::format("sim.tag.{}", i);
+    pt.label = fmt::format("simulated tag {}", i);
+    pt.dataType = config.types[i % config.types.size()];
+    data_points.push_back(pt);
+  }
+  return data_points;
+}
+
+namespace {
+
+// numeric value of a write, strings are parsed like VariantChangeType would
+bool to_number(opc_value const& value, double& num) {
+  if (auto const* str = std::get_if<std::string>(&value)) {
+    auto [end, ec] = std::from_chars(str->data(), str->data() + str->size(), num);
+    return ec == std::errc() && end == str->data() + str->size();
+  }
+  num = std::holds_alternative<int>(value) ? std::get<int>(value) : std::get<double>(value);
+  return true;
+}
+
+std::string to_text(opc_value const& value) {
+  return std::visit(
+    [](auto const& v) -> std::string {
+      if constexpr (std::is_same_v<std::decay_t<decltype(v)>, std::string>) {
+        return v;
+      } else {
+        return fmt::format("{}", v);
+      }
+    },
+    value);
+}
+
+}  // namespace
+
+sim_source::sim_source(sim_config t_config, unsigned long t_query_interval_ms)
+    : config(std::move(t_config)),
+      query_interval_ms(t_query_interval_ms),
+      created(std::chrono::steady_clock::now()),
+      rng_state(config.seed | 1) {}
+
+sim_source::~sim_source() {
+  disconnect();
+}
+
+bool sim_source::connect() {
+  spdlog::info("opc_reader: using simulated tag source, change rate {}", config.change_rate);
+  if (in_outage()) {
+    spdlog::warn("opc_reader: simulated server is unavailable");
+    return false;
+  }
+  return true;
+}
+
+void sim_source::disconnect() {
+  unsubscribe();
+}
+
+std::size_t sim_source::add_items(std::vector<opc_data_point> const& data_points) {
+  std::lock_guard lock(sim_mutex);
+  vec_opc_data = data_points;
+  groups = group_by_rate(vec_opc_data, query_interval_ms);
+  state.resize(vec_opc_data.size());
+  initial.assign(vec_opc_data.size(), true);
+  written.assign(vec_opc_data.size(), false);
+
+  std::size_t item_count = 0;
+  for (auto const& group : groups) {
+    spdlog::info("opc_reader {} simulated items created with rate {} ms", group.tag_indices.size(), group.rate_ms);
+    item_count += group.tag_indices.size();
+  }
+  return item_count;
+}
+
+std::size_t sim_source::update_items(std::vector<opc_data_point> const& data_points,
+                                     std::vector<std::uint32_t> const& changed) {
+  std::lock_guard lock(sim_mutex);
+  // changed tags leave their group and join the group of their new rate, unless they were removed
+  std::vector<bool> is_changed(data_points.size(), false);
+  for (auto i : changed) {
+    is_changed[i] = true;
+  }
+  for (auto& group : groups) {
+    std::erase_if(group.tag_indices, [&is_changed](auto i) { return is_changed[i]; });
+  }
+
+  vec_opc_data = data_points;
+  state.resize(vec_opc_data.size());
+  initial.resize(vec_opc_data.size(), true);
+  written.resize(vec_opc_data.size(), false);
+
+  std::size_t item_count = 0;
+  for (auto i : changed) {
+    written[i] = false;
+    if (vec_opc_data[i].removed) {
+      continue;
+    }
+    auto rate = effective_rate_ms(vec_opc_data[i], query_interval_ms);
+    auto group = std::ranges::find(groups, rate, &tag_group::rate_ms);
+    if (group == groups.end()) {
+      spdlog::info("opc_reader: simulated group for rate {} ms created", rate);
+      group = groups.insert(groups.end(), tag_group{rate, {}});
+    }
+    group->tag_indices.push_back(i);
+    // a modified tag may have changed its type, so it starts over like a new one
+    state.text[i].clear();
+    initial[i] = true;
+    item_count++;
+  }
+  return item_count;
+}
+
+bool sim_source::read(std::size_t group, sample_buffer& samples) {
+  if (in_outage()) {
+    spdlog::warn("reading simulated items of group {} failed, the server is unavailable", group);
+    return false;
+  }
+  std::lock_guard lock(sim_mutex);
+  auto start = std::chrono::steady_clock::now();
+  step(group);
+  auto stepped = std::chrono::steady_clock::now();
+
+  // a poll returns every item of the group, changed or not. The copies reuse the capacity of samples, so they do not
+  // allocate.
+  samples.updated.clear();
+  for (auto i : groups[group].tag_indices) {
+    samples.numeric[i] = state.numeric[i];
+    samples.quality[i] = state.quality[i];
+    samples.timestamp[i] = state.timestamp[i];
+    samples.error[i] = state.error[i];
+    if (vec_opc_data[i].dataType == opc_data_types::STRING) {
+      samples.text[i] = state.text[i];
+    }
+    samples.updated.push_back(i);
+  }
+  samples.group = group;
+  samples.read_time = stepped - start;
+  samples.decode_time = std::chrono::steady_clock::now() - stepped;
+  // the simulated tags only exist in memory, like values in the cache of a server
+  samples.read_from = read_source::CACHE;
+  return true;
+}
+
+bool sim_source::subscribe(sample_callback callback) {
+  unsubscribe();
+  if (groups.empty()) {
+    return false;
+  }
+  stop_subscription = false;
+  subscription_thread = std::thread([this, callback = std::move(callback)]() {
+    // one thread serves all groups, each group is stepped when its own rate has elapsed
+    std::vector<std::chrono::steady_clock::time_point> next_step;
+    bool was_unavailable = false;
+    while (!stop_subscription) {
+      auto now = std::chrono::steady_clock::now();
+      // an unavailable server sends no data changes, it announces the outage once
+      auto unavailable = in_outage();
+      if (unavailable && !was_unavailable && connection_lost_handler) {
+        connection_lost_handler("simulated server shut down");
+      }
+      was_unavailable = unavailable;
+      {
+        std::lock_guard lock(sim_mutex);
+        // groups created by update_items start right away
+        next_step.resize(groups.size(), now);
+        for (std::size_t g = 0; g < groups.size(); g++) {
+          if (next_step[g] > now) {
+            continue;
+          }
+          if (unavailable) {
+            next_step[g] = now + std::chrono::milliseconds(groups[g].rate_ms);
+            continue;
+          }
+          // like a server, only the changed items are reported
+          auto start = std::chrono::steady_clock::now();
+          step(g);
+          state.group = g;
+          state.decode_time = std::chrono::steady_clock::now() - start;
+          if (!state.updated.empty()) {
+            callback(state);
+          }
+          next_step[g] = now + std::chrono::milliseconds(groups[g].rate_ms);
+        }
+      }
+
+      std::unique_lock lock(subscription_mutex);
+      subscription_cv.wait_until(lock, *std::min_element(next_step.begin(), next_step.end()),
+                                 [this]() { return stop_subscription.load(); });
+    }
+  });
+  return true;
+}
+
+void sim_source::unsubscribe() {
+  {
+    std::lock_guard lock(subscription_mutex);
+    stop_subscription = true;
+  }
+  subscription_cv.notify_all();
+  if (subscription_thread.joinable()) {
+    subscription_thread.join();
+  }
+}
+
+bool sim_source::write(std::vector<tag_write> const& writes, std::vector<std::int32_t>& errors) {
+  std::lock_guard lock(sim_mutex);
+  errors.assign(writes.size(), 0);
+  auto now = std::chrono::system_clock::now();
+  for (std::size_t k = 0; k < writes.size(); k++) {
+    auto i = writes[k].index;
+    if (i >= vec_opc_data.size() || vec_opc_data[i].removed) {
+      errors[k] = write_error_unknown_item;
+      continue;
+    }
+    if (vec_opc_data[i].dataType == opc_data_types::STRING) {
+      state.text[i] = to_text(writes[k].value);
+    } else {
+      double num;
+      if (!to_number(writes[k].value, num)) {
+        errors[k] = write_error_bad_type;
+        continue;
+      }
+      state.numeric[i] = vec_opc_data[i].dataType == opc_data_types::FLOAT ? num : std::round(num);
+    }
+    state.quality[i] = 0xC0;  // OPC_QUALITY_GOOD
+    state.timestamp[i] = now;
+    state.error[i] = 0;
+    written[i] = true;
+  }
+  return true;
+}
+
+void sim_source::step(std::size_t group) {
+  static constexpr char random_source[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  constexpr std::size_t str_len = (sizeof(random_source) - 1) / 4;
+
+  auto const& tag_indices = groups[group].tag_indices;
+  state.updated.clear();
+  auto threshold =
+    static_cast<std::uint64_t>(config.change_rate * static_cast<double>(std::numeric_limits<std::uint64_t>::max()));
+  for (auto i : tag_indices) {
+    if (written[i]) {
+      // a written value is reported as it is, not replaced by a random one
+      written[i] = false;
+      initial[i] = false;
+      written_tags.push_back(i);
+    } else if (initial[i] || next_random() < threshold) {
+      initial[i] = false;
+      state.updated.push_back(i);
+    }
+  }
+
+  auto now = std::chrono::system_clock::now();
+  for (auto i : state.updated) {
+    switch (vec_opc_data[i].dataType) {
+      case opc_data_types::INT:
+      case opc_data_types::BYTE:
+      case opc_data_types::WORD:
+        state.numeric[i] = static_cast<double>(next_random() % 255);
+        break;
+      case opc_data_types::FLOAT:
+        state.numeric[i] = static_cast<double>(next_random() >> 11) * 0x1.0p-53;
+        break;
+      case opc_data_types::STRING: {
+        auto& str = state.text[i];
+        str.resize(str_len);
+        for (auto& c : str) {
+          c = random_source[next_random() % (sizeof(random_source) - 1)];
+        }
+      } break;
+      case opc_data_types::UNKNOWN:
+        break;
+    }
+    state.quality[i] = 0xC0;  // OPC_QUALITY_GOOD
+    state.timestamp[i] = now;
+  }
+  state.updated.insert(state.updated.end(), written_tags.begin(), written_tags.end());
+  written_tags.clear();
+}
+
+bool sim_source::in_outage() const {
+  if (config.outage_interval_ms == 0 || config.outage_ms == 0) {
+    return false;
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - created);
+  auto phase = static_cast<unsigned long>(elapsed.count()) % config.outage_interval_ms;
+  return phase + config.outage_ms >= config.outage_interval_ms;
+}
+
+std::uint64_t sim_source::next_random() {
+  // xorshift64*, cheap enough to draw one number per tag and cycle for 100k tags
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545F4914F6CDD1DULL;
+}
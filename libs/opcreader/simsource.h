@@ -0,0 +1,101 @@
+#ifndef SIMSOURCE_H
+#define SIMSOURCE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "tagsource.h"
+
+struct sim_config {
+  // number of tags to generate in addition to the configured opcItems
+  std::size_t tag_count{0};
+  // probability that a tag changes its value between two cycles
+  double change_rate{0.1};
+  // data types assigned round robin to the generated tags
+  std::vector<opc_data_types> types{opc_data_types::FLOAT, opc_data_types::INT, opc_data_types::STRING};
+  std::uint64_t seed{42};
+  // the simulated server is unreachable for outage_ms at the end of every outage_interval_ms, 0 never fails. Lets
+  // demo mode exercise the reconnection of the reader.
+  unsigned long outage_interval_ms{0};
+  unsigned long outage_ms{0};
+};
+
+// generates sim_config::tag_count data points named sim.tag.<n>
+std::vector<opc_data_point> make_sim_data_points(sim_config const& config);
+
+// in-process replacement for an OPC DA server, used in demo mode and for load tests without a real server
+class sim_source : public tag_source {
+ public:
+  sim_source(sim_config t_config, unsigned long t_query_interval_ms);
+  ~sim_source() override;
+
+  bool connect() override;
+  void disconnect() override;
+
+  bool check_status() override { return !in_outage(); }
+
+  // called by the subscription thread when a simulated outage starts, like a server announcing its shutdown
+  void set_connection_lost_handler(connection_lost_callback handler) override {
+    connection_lost_handler = std::move(handler);
+  }
+
+  std::size_t add_items(std::vector<opc_data_point> const& data_points) override;
+
+  std::size_t update_items(std::vector<opc_data_point> const& data_points,
+                           std::vector<std::uint32_t> const& changed) override;
+
+  std::size_t group_count() const override { return groups.size(); }
+
+  bool read(std::size_t group, sample_buffer& samples) override;
+
+  bool subscribe(sample_callback callback) override;
+  void unsubscribe() override;
+
+  unsigned long update_rate_ms(std::size_t group) const override { return groups[group].rate_ms; }
+
+  // stores the values like a server would, they are reported as changed by the next cycle of their group
+  bool write(std::vector<tag_write> const& writes, std::vector<std::int32_t>& errors) override;
+
+ private:
+  // advances the tags of one group by one cycle, state.updated holds the indices of the changed tags afterwards
+  void step(std::size_t group);
+
+  std::uint64_t next_random();
+
+  bool in_outage() const;
+
+  sim_config config;
+  unsigned long query_interval_ms;
+  // the outages are timed from here
+  std::chrono::steady_clock::time_point created;
+
+  std::vector<opc_data_point> vec_opc_data;
+  std::vector<tag_group> groups;
+  // current value of every tag, plays the role of the servers cache
+  sample_buffer state;
+  // per tag, not delivered since it was added. The first step after add_items or update_items reports it.
+  std::vector<bool> initial;
+  // per tag, written since the last step of its group
+  std::vector<bool> written;
+  std::vector<std::uint32_t> written_tags;
+
+  std::uint64_t rng_state;
+
+  // step() and the groups are shared between read(), update_items() and the subscription thread
+  std::mutex sim_mutex;
+
+  connection_lost_callback connection_lost_handler;
+
+  std::thread subscription_thread;
+  std::atomic<bool> stop_subscription{false};
+  // wakes the subscription thread for unsubscribe, slow groups would otherwise delay it by a full cycle
+  std::mutex subscription_mutex;
+  std::condition_variable subscription_cv;
+};
+
+#endif  // SIMSOURCE_H
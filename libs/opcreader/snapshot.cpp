@@ -0,0 +1,75 @@
+#include "snapshot.h"
+
+#include <algorithm>
+
+snapshot_store::snapshot_store(std::size_t tag_count) {
+  auto initial = std::make_shared<tag_snapshot>();
+  initial->tag_count = tag_count;
+  auto empty_block = std::make_shared<snapshot_block const>();
+  initial->blocks.assign((tag_count + snapshot_block::size - 1) / snapshot_block::size, empty_block);
+  copied.resize(initial->blocks.size());
+  snapshot.store(std::move(initial), std::memory_order_release);
+}
+
+void snapshot_store::update(sample_buffer const& samples, std::uint64_t sequence) {
+  if (samples.updated.empty()) {
+    return;
+  }
+  std::lock_guard lock(update_mutex);
+  auto old_snapshot = snapshot.load(std::memory_order_relaxed);
+  auto next = std::make_shared<tag_snapshot>(*old_snapshot);
+
+  for (auto index : samples.updated) {
+    if (index >= next->tag_count) {
+      continue;
+    }
+    auto& block = writable_block(*next, index / snapshot_block::size);
+    auto i = index % snapshot_block::size;
+    block.numeric[i] = samples.numeric[index];
+    block.quality[i] = samples.quality[index];
+    block.timestamp[i] = samples.timestamp[index];
+    block.error[i] = samples.error[index];
+    block.text[i] = samples.text[index];
+    block.valid[i] = true;
+  }
+  for (auto b : touched) {
+    copied[b].reset();
+  }
+  touched.clear();
+
+  // callbacks of different groups may publish out of order, the snapshot keeps the newest sequence
+  next->last_sequence = std::max(old_snapshot->last_sequence, sequence);
+  snapshot.store(std::move(next), std::memory_order_release);
+}
+
+void snapshot_store::resize(std::size_t tag_count, std::vector<std::uint32_t> const& invalidated) {
+  std::lock_guard lock(update_mutex);
+  auto next = std::make_shared<tag_snapshot>(*snapshot.load(std::memory_order_relaxed));
+  if (tag_count > next->tag_count) {
+    // the new tags of the last block are already invalid, every further block starts empty
+    next->tag_count = tag_count;
+    next->blocks.resize((tag_count + snapshot_block::size - 1) / snapshot_block::size,
+                        std::make_shared<snapshot_block const>());
+    copied.resize(next->blocks.size());
+  }
+  for (auto index : invalidated) {
+    if (index < next->tag_count) {
+      writable_block(*next, index / snapshot_block::size).valid[index % snapshot_block::size] = false;
+    }
+  }
+  for (auto b : touched) {
+    copied[b].reset();
+  }
+  touched.clear();
+  snapshot.store(std::move(next), std::memory_order_release);
+}
+
+snapshot_block& snapshot_store::writable_block(tag_snapshot& next, std::size_t b) {
+  auto& block = copied[b];
+  if (!block) {
+    block = std::make_shared<snapshot_block>(*next.blocks[b]);
+    next.blocks[b] = block;
+    touched.push_back(b);
+  }
+  return *block;
+}
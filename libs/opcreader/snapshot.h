@@ -0,0 +1,84 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tagsource.h"
+
+// latest values of a block of consecutive tags, in the columns of sample_buffer. Small blocks keep the copy for a
+// few changed tags cheap, 100k tags with 0.1% changes per cycle cost about 0.1 ms per update.
+struct snapshot_block {
+  static constexpr std::size_t size = 64;
+
+  std::array<double, size> numeric{};
+  std::array<std::string, size> text;
+  std::array<std::uint16_t, size> quality{};
+  std::array<std::chrono::system_clock::time_point, size> timestamp{};
+  std::array<std::int32_t, size> error{};
+  // false until the tag was read for the first time
+  std::array<bool, size> valid{};
+};
+
+// immutable view of the latest value of every tag. Unchanged blocks are shared with older and newer snapshots.
+class tag_snapshot {
+ public:
+  std::size_t size() const { return tag_count; }
+
+  // sequence of the last batch contained in the snapshot
+  std::uint64_t sequence() const { return last_sequence; }
+
+  bool valid(std::size_t index) const { return block(index).valid[index % snapshot_block::size]; }
+  double numeric(std::size_t index) const { return block(index).numeric[index % snapshot_block::size]; }
+  std::string const& text(std::size_t index) const { return block(index).text[index % snapshot_block::size]; }
+  std::uint16_t quality(std::size_t index) const { return block(index).quality[index % snapshot_block::size]; }
+  std::chrono::system_clock::time_point timestamp(std::size_t index) const {
+    return block(index).timestamp[index % snapshot_block::size];
+  }
+  std::int32_t error(std::size_t index) const { return block(index).error[index % snapshot_block::size]; }
+
+ private:
+  friend class snapshot_store;
+
+  snapshot_block const& block(std::size_t index) const { return *blocks[index / snapshot_block::size]; }
+
+  std::vector<std::shared_ptr<snapshot_block const>> blocks;
+  std::size_t tag_count{0};
+  std::uint64_t last_sequence{0};
+};
+
+// latest-value table written by the acquisition thread and read by rpc threads. update() copies the blocks touched
+// by a cycle and swaps in a new snapshot (read-copy-update), readers take the current one with a single atomic load
+// and never wait for an update in progress. Old snapshots are freed by the last reader holding them.
+class snapshot_store {
+ public:
+  explicit snapshot_store(std::size_t tag_count);
+
+  // applies the tags listed in samples.updated. Concurrent updates are serialized, readers are not blocked.
+  void update(sample_buffer const& samples, std::uint64_t sequence);
+
+  // grows the table to tag_count after a configuration reload and marks the invalidated tags as never read, so the
+  // last value of a removed tag is not served as its current one. Serialized with update().
+  void resize(std::size_t tag_count, std::vector<std::uint32_t> const& invalidated);
+
+  std::shared_ptr<tag_snapshot const> current() const { return snapshot.load(std::memory_order_acquire); }
+
+ private:
+  // block b of next, copied on its first write by the running update
+  snapshot_block& writable_block(tag_snapshot& next, std::size_t b);
+
+  std::mutex update_mutex;
+  // blocks copied by the running update, indexed by block, reused to avoid an allocation per cycle
+  std::vector<std::shared_ptr<snapshot_block>> copied;
+  std::vector<std::size_t> touched;
+
+  std::atomic<std::shared_ptr<tag_snapshot const>> snapshot;
+};
+
+#endif  // SNAPSHOT_H
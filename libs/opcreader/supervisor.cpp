@@ -0,0 +1,75 @@
+#include "supervisor.h"
+
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+std::string_view to_string(connection_state state) {
+  switch (state) {
+    case connection_state::DISCONNECTED:
+      return "disconnected";
+    case connection_state::CONNECTING:
+      return "connecting";
+    case connection_state::SUBSCRIBING:
+      return "subscribing";
+    case connection_state::RUNNING:
+      return "running";
+    case connection_state::DEGRADED:
+      return "degraded";
+  }
+  return "unknown";
+}
+
+reconnect_backoff::reconnect_backoff(unsigned long t_initial_ms, unsigned long t_max_ms, std::uint64_t seed)
+    : initial_ms(std::max<unsigned long>(t_initial_ms, 1)),
+      max_ms(std::max(t_max_ms, std::max<unsigned long>(t_initial_ms, 1))),
+      rng(seed) {}
+
+std::chrono::milliseconds reconnect_backoff::next_delay() {
+  // doubling stops at max_ms, the shift is bounded so it cannot overflow after many attempts
+  auto ceiling = static_cast<std::uint64_t>(initial_ms) << std::min(failed_attempts, 20U);
+  ceiling = std::min<std::uint64_t>(ceiling, max_ms);
+  failed_attempts++;
+  std::uniform_int_distribution<std::uint64_t> jitter(ceiling / 2, ceiling);
+  return std::chrono::milliseconds(jitter(rng));
+}
+
+void connection_metrics::set_state(connection_state state) {
+  auto previous = current.exchange(state, std::memory_order_relaxed);
+  if (previous != state) {
+    spdlog::info("opc_reader: connection {} -> {}", to_string(previous), to_string(state));
+  }
+}
+
+void connection_metrics::outage_started(std::chrono::steady_clock::time_point time) {
+  std::int64_t none = 0;
+  if (outage_start.compare_exchange_strong(none, time.time_since_epoch().count(), std::memory_order_relaxed)) {
+    outage_count.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+std::chrono::nanoseconds connection_metrics::data_received(std::chrono::steady_clock::time_point time) {
+  if (outage_start.load(std::memory_order_relaxed) == 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  // only one of the threads delivering data closes the outage
+  auto start = outage_start.exchange(0, std::memory_order_relaxed);
+  if (start == 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  auto duration = time - std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(start));
+  recovery.record(duration);
+  return duration;
+}
+
+void connection_metrics::log(std::string_view name) const {
+  spdlog::info("opc_reader: {} connection {}, {} outages", name, to_string(state()), outages());
+  if (recovery.count() == 0) {
+    return;
+  }
+  spdlog::info("opc_reader: {} time to recovery n {:>7} p50 {:>8}ms p99 {:>8}ms max {:>8}ms", name,
+               recovery.count(),
+               std::chrono::duration_cast<std::chrono::milliseconds>(recovery.percentile(0.5)).count(),
+               std::chrono::duration_cast<std::chrono::milliseconds>(recovery.percentile(0.99)).count(),
+               std::chrono::duration_cast<std::chrono::milliseconds>(recovery.max()).count());
+}
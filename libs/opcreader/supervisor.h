@@ -0,0 +1,71 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string_view>
+
+#include "latency.h"
+
+// states of the connection to the tag source, driven by opc_reader::query_server.
+// DISCONNECTED waits out the backoff, CONNECTING connects to the server, SUBSCRIBING creates the groups and items and
+// subscribes, RUNNING delivers data and DEGRADED still delivers data but at least one group is late.
+enum struct connection_state { DISCONNECTED, CONNECTING, SUBSCRIBING, RUNNING, DEGRADED };
+
+std::string_view to_string(connection_state state);
+
+// delay before the next connection attempt. It doubles with every failed attempt up to max_ms and is drawn at random
+// from its upper half, so readers that lost the same server do not reconnect in lockstep.
+class reconnect_backoff {
+ public:
+  reconnect_backoff(unsigned long t_initial_ms, unsigned long t_max_ms, std::uint64_t seed);
+
+  // the delay before the next attempt, counts the attempt
+  std::chrono::milliseconds next_delay();
+
+  // called once a connection was established, the next failure starts over at initial_ms
+  void reset() { failed_attempts = 0; }
+
+  unsigned attempts() const { return failed_attempts; }
+
+ private:
+  unsigned long initial_ms;
+  unsigned long max_ms;
+  unsigned failed_attempts{0};
+  std::mt19937_64 rng;
+};
+
+// state and outages of the connection. The query loop changes them, any thread may read them.
+class connection_metrics {
+ public:
+  connection_state state() const { return current.load(std::memory_order_relaxed); }
+
+  // logs the transition if the state changes
+  void set_state(connection_state state);
+
+  // a running connection was lost at time, ignored while an outage is already open
+  void outage_started(std::chrono::steady_clock::time_point time);
+
+  // data arrived at time. Closes the open outage and records its duration, which is returned, zero if there was none.
+  // Called for every batch, so the common case is a single relaxed load.
+  std::chrono::nanoseconds data_received(std::chrono::steady_clock::time_point time);
+
+  std::uint64_t outages() const { return outage_count.load(std::memory_order_relaxed); }
+
+  // time from losing a connection to the first data of the next one
+  latency_histogram const& time_to_recovery() const { return recovery; }
+
+  // logs the state, the number of outages and the percentiles of the time to recovery
+  void log(std::string_view name) const;
+
+ private:
+  std::atomic<connection_state> current{connection_state::DISCONNECTED};
+  std::atomic<std::uint64_t> outage_count{0};
+  // steady clock ticks of the start of the open outage, 0 while there is none
+  std::atomic<std::int64_t> outage_start{0};
+  latency_histogram recovery;
+};
+
+#endif  // SUPERVISOR_H
@@ -0,0 +1,184 @@
+#ifndef TAGSOURCE_H
+#define TAGSOURCE_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <variant>
+#include <vector>
+
+enum struct opc_data_types { UNKNOWN, STRING, FLOAT, BYTE, WORD, INT };
+
+struct opc_data_point {
+  std::string name;
+  std::string label;
+  opc_data_types dataType;
+  // requested update rate, 0 uses the query interval of the reader
+  unsigned long rate_ms{0};
+  // DA 3.0 settings the server applies to the item, 0 or false leaves them to the group. A DA 2.0 server ignores them.
+  // server_deadband_percent overrides the deadband of the group, sampling_ms samples the item faster than the group
+  // updates and buffer_samples lets the server send every sample taken between two updates.
+  float server_deadband_percent{0};
+  unsigned long sampling_ms{0};
+  bool buffer_samples{false};
+  // change filter of the reader: a numeric value passes once it moved by more than deadband from the value published
+  // last, and an unchanged value is published again after max_publish_ms, 0 uses the default of the filter
+  double deadband{0};
+  unsigned long max_publish_ms{0};
+  // dropped by a configuration reload. The index stays reserved, so the ids clients know keep their meaning and a
+  // tag that comes back gets its old id.
+  bool removed{false};
+};
+
+inline unsigned long effective_rate_ms(opc_data_point const& data_point, unsigned long default_rate_ms) {
+  return data_point.rate_ms != 0 ? data_point.rate_ms : default_rate_ms;
+}
+
+// true if the server applies the same DA 3.0 settings to both items
+inline bool same_item_settings(opc_data_point const& a, opc_data_point const& b) {
+  return a.server_deadband_percent == b.server_deadband_percent && a.sampling_ms == b.sampling_ms &&
+         a.buffer_samples == b.buffer_samples;
+}
+
+// items sharing an update rate, read and subscribed as one OPC group
+struct tag_group {
+  unsigned long rate_ms{0};
+  std::vector<std::uint32_t> tag_indices;
+};
+
+// partitions the data points that are not removed by their update rate, groups are sorted by ascending rate
+inline std::vector<tag_group> group_by_rate(std::vector<opc_data_point> const& data_points,
+                                            unsigned long default_rate_ms) {
+  std::map<unsigned long, std::vector<std::uint32_t>> by_rate;
+  for (std::size_t i = 0; i < data_points.size(); i++) {
+    if (data_points[i].removed) {
+      continue;
+    }
+    by_rate[effective_rate_ms(data_points[i], default_rate_ms)].push_back(static_cast<std::uint32_t>(i));
+  }
+  std::vector<tag_group> groups;
+  groups.reserve(by_rate.size());
+  for (auto& [rate, indices] : by_rate) {
+    groups.push_back(tag_group{rate, std::move(indices)});
+  }
+  return groups;
+}
+
+using opc_value = std::variant<int, double, std::string>;
+
+// where the server took the values of a read from
+enum struct read_source { CACHE, DEVICE };
+
+// values of all tags in columns indexed by tag index, reused from cycle to cycle so reads do not allocate.
+// numeric tags (FLOAT, INT, BYTE, WORD) live in the numeric column, STRING tags in the text column.
+struct sample_buffer {
+  std::vector<double> numeric;
+  std::vector<std::string> text;
+  std::vector<std::uint16_t> quality;
+  std::vector<std::chrono::system_clock::time_point> timestamp;
+  std::vector<std::int32_t> error;
+  // tag indices written by the last read or data change, in the order the source delivered them
+  std::vector<std::uint32_t> updated;
+
+  // group of the last read or data change, and the time the source spent on the server call and on decoding it.
+  // read_time is zero for data changes pushed by the server.
+  std::size_t group{0};
+  std::chrono::nanoseconds read_time{0};
+  std::chrono::nanoseconds decode_time{0};
+  // source of the last read, meaningless for data changes
+  read_source read_from{read_source::DEVICE};
+
+  void resize(std::size_t tag_count) {
+    numeric.resize(tag_count, 0.0);
+    text.resize(tag_count);
+    quality.resize(tag_count, 0);
+    timestamp.resize(tag_count);
+    error.resize(tag_count, 0);
+    updated.reserve(tag_count);
+  }
+
+  std::size_t size() const { return numeric.size(); }
+
+  opc_value value(std::size_t index, opc_data_types data_type) const {
+    switch (data_type) {
+      case opc_data_types::STRING:
+        return text[index];
+      case opc_data_types::FLOAT:
+        return numeric[index];
+      default:
+        return static_cast<int>(numeric[index]);
+    }
+  }
+};
+
+// the callback may shrink samples.updated, a source fills it anew for every read or data change
+using sample_callback = std::function<void(sample_buffer&)>;
+
+// a value a client wants written to the tag with index
+struct tag_write {
+  std::uint32_t index;
+  opc_value value;
+};
+
+// HRESULTs of writes that did not get a result from the server, the values of opcerror.h and winerror.h
+constexpr std::int32_t write_error_failed = static_cast<std::int32_t>(0x80004005);        // E_FAIL
+constexpr std::int32_t write_error_bad_type = static_cast<std::int32_t>(0xC0040004);      // OPC_E_BADTYPE
+constexpr std::int32_t write_error_unknown_item = static_cast<std::int32_t>(0xC0040007);  // OPC_E_UNKNOWNITEMID
+
+// receives one HRESULT per write in the order of the request, 0 on success
+using write_callback = std::function<void(std::vector<std::int32_t> const& errors)>;
+
+// receives why the connection is gone, when a source learns it without being asked
+using connection_lost_callback = std::function<void(std::string const& reason)>;
+
+// source of tag values for the opc_reader, either a real OPC DA server or a simulation
+class tag_source {
+ public:
+  virtual ~tag_source() = default;
+
+  // a failed connect may leave a partial connection behind, disconnect cleans it up
+  virtual bool connect() = 0;
+  virtual void disconnect() = 0;
+
+  // asks the server whether it is still running, false if it cannot be reached or left the running state
+  virtual bool check_status() = 0;
+
+  // handler is called from a thread of the source when the server announces its shutdown, so the reader does not
+  // have to wait for a failed read. Set before connect.
+  virtual void set_connection_lost_handler(connection_lost_callback handler) = 0;
+
+  // items with the same rate_ms end up in one group, see group_by_rate.
+  // returns the number of items that could be registered
+  virtual std::size_t add_items(std::vector<opc_data_point> const& data_points) = 0;
+
+  // applies a configuration reload while the source keeps running. data_points is the complete new list, it only
+  // grows and changed lists the indices that were added, removed or modified. Only the groups of changed tags are
+  // touched, a new rate gets a new group at the end. Returns the number of changed tags registered with the source.
+  virtual std::size_t update_items(std::vector<opc_data_point> const& data_points,
+                                   std::vector<std::uint32_t> const& changed) = 0;
+
+  // groups are numbered 0 .. group_count() - 1, add_items numbers them in ascending order of their rate and
+  // update_items appends groups for new rates. Group numbers stay valid until the next add_items.
+  virtual std::size_t group_count() const = 0;
+
+  // reads the items of one group into samples, which has been sized to the number of data points.
+  // false if nothing was read, a pipelining source also returns false until its first read completed. A group a
+  // reload left without items reads nothing and returns true.
+  virtual bool read(std::size_t group, sample_buffer& samples) = 0;
+
+  // callback is invoked from threads owned by the source, samples.updated lists the changed items of one group only.
+  // callbacks of different groups may run concurrently.
+  virtual bool subscribe(sample_callback callback) = 0;
+  virtual void unsubscribe() = 0;
+
+  // update rate the source actually grants for a group, may be slower than requested
+  virtual unsigned long update_rate_ms(std::size_t group) const = 0;
+
+  // writes the values with one server call per group, writes names every tag at most once.
+  // errors receives the HRESULT of every write, returns false if a server call failed as a whole.
+  virtual bool write(std::vector<tag_write> const& writes, std::vector<std::int32_t>& errors) = 0;
+};
+
+#endif  // TAGSOURCE_H
@@ -0,0 +1,189 @@
+#include "tagcodec.h"
+
+#include <bit>
+#include <chrono>
+
+#include <spdlog/spdlog.h>
+
+grpcopc::TagType to_tag_type(opc_data_types data_type) {
+  switch (data_type) {
+    case opc_data_types::STRING:
+      return grpcopc::TAG_TYPE_STRING;
+    case opc_data_types::FLOAT:
+      return grpcopc::TAG_TYPE_FLOAT;
+    case opc_data_types::BYTE:
+      return grpcopc::TAG_TYPE_BYTE;
+    case opc_data_types::WORD:
+      return grpcopc::TAG_TYPE_WORD;
+    case opc_data_types::INT:
+      return grpcopc::TAG_TYPE_INT;
+    default:
+      return grpcopc::TAG_TYPE_UNKNOWN;
+  }
+}
+
+namespace {
+
+std::int64_t to_unix_us(std::chrono::system_clock::time_point timestamp) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(timestamp.time_since_epoch()).count();
+}
+
+// appends one update to the columns of batch, the first update sets the base time
+void append_update(grpcopc::TagBatch& batch,
+                   std::uint32_t id,
+                   opc_data_types data_type,
+                   double numeric,
+                   std::string const& text,
+                   std::uint16_t quality,
+                   std::chrono::system_clock::time_point timestamp,
+                   std::int32_t error) {
+  if (batch.ids().empty()) {
+    batch.set_base_time_us(to_unix_us(timestamp));
+  }
+  batch.add_ids(id);
+  // the timestamp of a failed read is meaningless, offset 0 costs a single byte
+  batch.add_time_offsets_us(error < 0 ? 0 : to_unix_us(timestamp) - batch.base_time_us());
+  batch.add_qualities(quality);
+  if (error != 0) {
+    batch.add_error_ids(id);
+    batch.add_errors(error);
+  }
+  if (error < 0) {
+    return;
+  }
+  switch (data_type) {
+    case opc_data_types::STRING:
+      batch.add_string_values(text);
+      break;
+    case opc_data_types::FLOAT:
+      batch.add_float_values(numeric);
+      break;
+    default:
+      batch.add_int_values(static_cast<std::int64_t>(numeric));
+      break;
+  }
+}
+
+void add_dictionary_tag(std::vector<grpcopc::TagStream>& pages,
+                        std::vector<opc_data_point> const& vec_opc_data,
+                        std::size_t index,
+                        std::size_t tags_per_page) {
+  if (pages.empty() || static_cast<std::size_t>(pages.back().dictionary().tags_size()) >= tags_per_page) {
+    pages.emplace_back().mutable_dictionary();
+  }
+  encode_tag_info(vec_opc_data, index, *pages.back().mutable_dictionary()->add_tags());
+}
+
+}  // namespace
+
+void encode_tag_info(std::vector<opc_data_point> const& vec_opc_data, std::size_t index, grpcopc::TagInfo& info) {
+  info.set_id(static_cast<std::uint32_t>(index));
+  info.set_name(vec_opc_data[index].name);
+  info.set_label(vec_opc_data[index].label);
+  info.set_type(to_tag_type(vec_opc_data[index].dataType));
+  info.set_rate_ms(static_cast<std::uint32_t>(vec_opc_data[index].rate_ms));
+  info.set_removed(vec_opc_data[index].removed);
+}
+
+std::vector<grpcopc::TagStream> encode_dictionary(std::vector<opc_data_point> const& vec_opc_data,
+                                                  tag_filter const& filter,
+                                                  std::size_t tags_per_page) {
+  std::vector<grpcopc::TagStream> pages;
+  filter.for_each(vec_opc_data.size(), [&](std::size_t index) {
+    // a removed tag is only listed by the dictionary that removes it
+    if (!vec_opc_data[index].removed) {
+      add_dictionary_tag(pages, vec_opc_data, index, tags_per_page);
+    }
+  });
+  if (pages.empty()) {
+    // a subscription without tags still learns that its dictionary is empty
+    pages.emplace_back().mutable_dictionary();
+  }
+  return pages;
+}
+
+std::vector<grpcopc::TagStream> encode_dictionary(std::vector<opc_data_point> const& vec_opc_data,
+                                                  std::vector<std::uint32_t> const& indices,
+                                                  std::size_t tags_per_page) {
+  std::vector<grpcopc::TagStream> pages;
+  for (auto index : indices) {
+    add_dictionary_tag(pages, vec_opc_data, index, tags_per_page);
+  }
+  return pages;
+}
+
+void encode_tag_batch(sample_buffer const& samples,
+                      std::vector<opc_data_point> const& vec_opc_data,
+                      tag_filter const& filter,
+                      std::uint64_t sequence,
+                      grpcopc::TagBatch& batch) {
+  batch.set_sequence(sequence);
+  batch.set_group(static_cast<std::uint32_t>(samples.group));
+  if (filter.all()) {
+    auto count = static_cast<int>(samples.updated.size());
+    batch.mutable_ids()->Reserve(count);
+    batch.mutable_time_offsets_us()->Reserve(count);
+    batch.mutable_qualities()->Reserve(count);
+  }
+  for (auto index : samples.updated) {
+    // out of range only if a source reports a tag it was never given
+    if (index >= vec_opc_data.size() || !filter.contains(index)) {
+      continue;
+    }
+    append_update(batch, index, vec_opc_data[index].dataType, samples.numeric[index], samples.text[index],
+                  samples.quality[index], samples.timestamp[index], samples.error[index]);
+  }
+}
+
+void encode_snapshot_batch(tag_snapshot const& snapshot,
+                           std::vector<opc_data_point> const& vec_opc_data,
+                           std::vector<std::uint64_t> const& tags,
+                           grpcopc::TagBatch& batch) {
+  batch.set_sequence(snapshot.sequence());
+  batch.set_conflated(true);
+  for (std::size_t w = 0; w < tags.size(); w++) {
+    for (auto word = tags[w]; word != 0; word &= word - 1) {
+      auto index = w * 64 + static_cast<std::size_t>(std::countr_zero(word));
+      if (index < snapshot.size() && index < vec_opc_data.size() && snapshot.valid(index)) {
+        append_update(batch, static_cast<std::uint32_t>(index), vec_opc_data[index].dataType, snapshot.numeric(index),
+                      snapshot.text(index), snapshot.quality(index), snapshot.timestamp(index), snapshot.error(index));
+      }
+    }
+  }
+}
+
+void encode_tag_value(tag_snapshot const& snapshot,
+                      std::vector<opc_data_point> const& vec_opc_data,
+                      std::size_t index,
+                      grpcopc::TagUpdate& update) {
+  update.set_id(static_cast<std::uint32_t>(index));
+  update.set_quality(snapshot.quality(index));
+  update.set_error(snapshot.error(index));
+  if (snapshot.error(index) < 0) {
+    // a failed read leaves the value unset
+    return;
+  }
+  update.set_timestamp_us(to_unix_us(snapshot.timestamp(index)));
+  switch (vec_opc_data[index].dataType) {
+    case opc_data_types::STRING:
+      update.set_string_value(snapshot.text(index));
+      break;
+    case opc_data_types::FLOAT:
+      update.set_float_value(snapshot.numeric(index));
+      break;
+    default:
+      update.set_int_value(static_cast<std::int64_t>(snapshot.numeric(index)));
+      break;
+  }
+}
+
+std::shared_ptr<grpc::ByteBuffer const> serialize_tag_stream(grpcopc::TagStream const& message) {
+  auto buffer = std::make_shared<grpc::ByteBuffer>();
+  bool own_buffer;
+  auto status = grpc::SerializationTraits<grpcopc::TagStream>::Serialize(message, buffer.get(), &own_buffer);
+  if (!status.ok()) {
+    spdlog::warn("tag_service: could not serialize message, reason: {}", status.error_message());
+    return nullptr;
+  }
+  return buffer;
+}
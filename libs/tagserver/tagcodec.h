@@ -0,0 +1,53 @@
+#ifndef TAGCODEC_H
+#define TAGCODEC_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include <opcgrpc.grpc.pb.h>
+
+#include <snapshot.h>
+#include <tagsource.h>
+
+#include "tagfilter.h"
+
+grpcopc::TagType to_tag_type(opc_data_types data_type);
+
+void encode_tag_info(std::vector<opc_data_point> const& vec_opc_data, std::size_t index, grpcopc::TagInfo& info);
+
+// the tags selected by filter as dictionary messages of at most tags_per_page tags
+std::vector<grpcopc::TagStream> encode_dictionary(std::vector<opc_data_point> const& vec_opc_data,
+                                                  tag_filter const& filter,
+                                                  std::size_t tags_per_page);
+
+// the listed tags as dictionary messages of at most tags_per_page tags, none if indices is empty
+std::vector<grpcopc::TagStream> encode_dictionary(std::vector<opc_data_point> const& vec_opc_data,
+                                                  std::vector<std::uint32_t> const& indices,
+                                                  std::size_t tags_per_page);
+
+// converts the items listed in samples.updated and selected by filter into one packed batch
+void encode_tag_batch(sample_buffer const& samples,
+                      std::vector<opc_data_point> const& vec_opc_data,
+                      tag_filter const& filter,
+                      std::uint64_t sequence,
+                      grpcopc::TagBatch& batch);
+
+// latest value of the tags set in the bit per tag index tags, as one conflated batch
+void encode_snapshot_batch(tag_snapshot const& snapshot,
+                           std::vector<opc_data_point> const& vec_opc_data,
+                           std::vector<std::uint64_t> const& tags,
+                           grpcopc::TagBatch& batch);
+
+// the snapshot entry of tag index as a self-contained update
+void encode_tag_value(tag_snapshot const& snapshot,
+                      std::vector<opc_data_point> const& vec_opc_data,
+                      std::size_t index,
+                      grpcopc::TagUpdate& update);
+
+// serializes message into a buffer that can be written to any number of streams, null on failure
+std::shared_ptr<grpc::ByteBuffer const> serialize_tag_stream(grpcopc::TagStream const& message);
+
+#endif  // TAGCODEC_H
@@ -0,0 +1,102 @@
+#include "tagfilter.h"
+
+#include <algorithm>
+
+bool glob_match(std::string_view pattern, std::string_view name) {
+  // iterative matching, on a mismatch the last * takes one more character
+  std::size_t p = 0;
+  std::size_t n = 0;
+  std::size_t star = std::string_view::npos;
+  std::size_t star_n = 0;
+  while (n < name.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+      p++;
+      n++;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      star_n = n;
+    } else if (star != std::string_view::npos) {
+      p = star + 1;
+      n = ++star_n;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    p++;
+  }
+  return p == pattern.size();
+}
+
+tag_filter::tag_filter(std::vector<std::uint64_t> t_bits) : all_tags(false), bits(std::move(t_bits)) {}
+
+tag_name_index::tag_name_index(std::vector<opc_data_point> const& data_points) {
+  names.reserve(data_points.size());
+  sorted.reserve(data_points.size());
+  index_by_name.reserve(data_points.size());
+  for (std::size_t i = 0; i < data_points.size(); i++) {
+    names.push_back(data_points[i].name);
+    if (data_points[i].removed) {
+      continue;
+    }
+    sorted.push_back(static_cast<std::uint32_t>(i));
+    index_by_name.emplace(data_points[i].name, static_cast<std::uint32_t>(i));
+  }
+  std::sort(sorted.begin(), sorted.end(), [this](auto a, auto b) { return names[a] < names[b]; });
+}
+
+std::optional<std::uint32_t> tag_name_index::find(std::string const& name) const {
+  auto it = index_by_name.find(name);
+  if (it == index_by_name.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+std::pair<std::size_t, std::size_t> tag_name_index::prefix_range(std::string_view prefix) const {
+  auto first = std::lower_bound(sorted.begin(), sorted.end(), prefix,
+                                [this](auto index, std::string_view p) { return names[index] < p; });
+  auto last = std::find_if_not(first, sorted.end(), [this, prefix](auto index) {
+    return std::string_view(names[index]).starts_with(prefix);
+  });
+  return {static_cast<std::size_t>(first - sorted.begin()), static_cast<std::size_t>(last - sorted.begin())};
+}
+
+tag_filter tag_name_index::compile(std::vector<tag_pattern> const& patterns) const {
+  if (patterns.empty()) {
+    return tag_filter();
+  }
+  std::vector<std::uint64_t> bits((names.size() + 63) / 64, 0);
+  for (auto const& pattern : patterns) {
+    // a glob only has to be matched against the names starting with its literal part
+    auto literal = pattern.kind == tag_pattern_kind::PREFIX ? std::string_view(pattern.text)
+                                                            : std::string_view(pattern.text).substr(
+                                                                0, pattern.text.find_first_of("*?"));
+    auto [first, last] = prefix_range(literal);
+    for (auto i = first; i < last; i++) {
+      auto index = sorted[i];
+      if (pattern.kind == tag_pattern_kind::PREFIX || glob_match(pattern.text, names[index])) {
+        bits[index / 64] |= std::uint64_t{1} << (index % 64);
+      }
+    }
+  }
+  return tag_filter(std::move(bits));
+}
+
+std::string tag_name_index::key(std::vector<tag_pattern> const& patterns) {
+  std::vector<std::string> parts;
+  parts.reserve(patterns.size());
+  for (auto const& pattern : patterns) {
+    parts.push_back((pattern.kind == tag_pattern_kind::PREFIX ? "p:" : "g:") + pattern.text);
+  }
+  std::sort(parts.begin(), parts.end());
+  parts.erase(std::unique(parts.begin(), parts.end()), parts.end());
+  std::string result;
+  for (auto const& part : parts) {
+    // the length makes the key unambiguous for texts containing the separator
+    result += std::to_string(part.size());
+    result += ':';
+    result += part;
+  }
+  return result;
+}
@@ -0,0 +1,84 @@
+#ifndef TAGFILTER_H
+#define TAGFILTER_H
+
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <tagsource.h>
+
+enum struct tag_pattern_kind { PREFIX, GLOB };
+
+struct tag_pattern {
+  tag_pattern_kind kind;
+  std::string text;
+};
+
+// * matches any sequence of characters and ? a single one, everything else is literal. OPC item ids contain
+// brackets like [NB_plc]N7:0, so there are no character classes.
+bool glob_match(std::string_view pattern, std::string_view name);
+
+// set of tag indices, compiled once per subscription so testing a tag is a bit test
+class tag_filter {
+ public:
+  // selects every tag
+  tag_filter() = default;
+  explicit tag_filter(std::vector<std::uint64_t> t_bits);
+
+  bool all() const { return all_tags; }
+
+  // tags added by a reload after the filter was compiled are not contained
+  bool contains(std::size_t index) const {
+    return all_tags || (index / 64 < bits.size() && (bits[index / 64] >> (index % 64)) & 1);
+  }
+
+  // calls f with every selected index in ascending order, tag_count bounds the all() filter
+  template <typename F>
+  void for_each(std::size_t tag_count, F f) const {
+    if (all_tags) {
+      for (std::size_t i = 0; i < tag_count; i++) {
+        f(i);
+      }
+      return;
+    }
+    for (std::size_t w = 0; w < bits.size(); w++) {
+      for (auto word = bits[w]; word != 0; word &= word - 1) {
+        f(w * 64 + static_cast<std::size_t>(std::countr_zero(word)));
+      }
+    }
+  }
+
+ private:
+  bool all_tags{true};
+  std::vector<std::uint64_t> bits;
+};
+
+// tag names in sorted order, a prefix or the literal start of a glob selects a contiguous range of it. Removed tags
+// are neither found nor selected.
+class tag_name_index {
+ public:
+  explicit tag_name_index(std::vector<opc_data_point> const& data_points);
+
+  std::optional<std::uint32_t> find(std::string const& name) const;
+
+  // tags matching any of the patterns, no pattern selects every tag
+  tag_filter compile(std::vector<tag_pattern> const& patterns) const;
+
+  // identical pattern lists get the same key, whatever their order
+  static std::string key(std::vector<tag_pattern> const& patterns);
+
+ private:
+  // indices into sorted of the names starting with prefix
+  std::pair<std::size_t, std::size_t> prefix_range(std::string_view prefix) const;
+
+  std::vector<std::string> names;
+  std::vector<std::uint32_t> sorted;
+  std::unordered_map<std::string, std::uint32_t> index_by_name;
+};
+
+#endif  // TAGFILTER_H
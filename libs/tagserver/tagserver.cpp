@@ -0,0 +1,912 @@
+#include "tagserver.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <deque>
+#include <limits>
+#include <unordered_map>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+grpc::Status to_tag_patterns(google::protobuf::RepeatedPtrField<grpcopc::TagFilter> const& filters,
+                             std::vector<tag_pattern>& patterns) {
+  patterns.clear();
+  patterns.reserve(static_cast<std::size_t>(filters.size()));
+  for (auto const& filter : filters) {
+    switch (filter.filter_case()) {
+      case grpcopc::TagFilter::kPrefix:
+        patterns.push_back(tag_pattern{tag_pattern_kind::PREFIX, filter.prefix()});
+        break;
+      case grpcopc::TagFilter::kGlob:
+        patterns.push_back(tag_pattern{tag_pattern_kind::GLOB, filter.glob()});
+        break;
+      default:
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "filter without prefix or glob");
+    }
+  }
+  return grpc::Status::OK;
+}
+
+// one Subscribe stream. Lives from the request until the call is done and no operation is pending any more.
+// Batches wait in a queue of at most max_queued_batches. A subscriber whose queue is full only marks the tags of
+// further batches, once the queue drained it gets the latest value of the marked tags from the snapshot in one
+// conflated batch. A fast subscriber sees every batch.
+class subscribe_call : public async_call {
+ public:
+  enum : int { REQUEST, WRITE, FINISH, DONE };
+
+  subscribe_call(tag_service& t_service, grpc::ServerCompletionQueue* t_cq)
+      : service(t_service), cq(t_cq), writer(&ctx) {
+    ctx.AsyncNotifyWhenDone(&events[DONE]);
+    service.RequestSubscribe(&ctx, &request, &writer, cq, cq, &events[REQUEST]);
+  }
+
+  void on_event(int id, bool ok) override {
+    if (id == REQUEST) {
+      if (!ok) {
+        // the server shuts down, the call never started
+        delete this;
+        return;
+      }
+      peer = ctx.peer();
+      if (service.accepting_calls()) {
+        // keep one call waiting for the next subscriber
+        new subscribe_call(service, cq);
+      }
+
+      grpcopc::SubscribeRequest subscribe_request;
+      auto status = grpc::SerializationTraits<grpcopc::SubscribeRequest>::Deserialize(&request, &subscribe_request);
+      if (status.ok()) {
+        status = service.compile_subscription(subscribe_request.filters(), subscription);
+      }
+      std::unique_lock lock(mutex);
+      if (!status.ok()) {
+        finish_in_flight = true;
+        writer.Finish(status, &events[FINISH]);
+        return;
+      }
+      // the dictionary goes out before the first batch
+      queue.assign(subscription->dictionary.begin(), subscription->dictionary.end());
+      write_next(lock);
+      lock.unlock();
+
+      std::lock_guard list_lock(service.subscriber_mutex);
+      if (service.shutting_down) {
+        finish();
+      }
+      // a reload between compiling and registering did not reach this call, it catches up with a complete dictionary
+      // of the current tags
+      auto current = service.catalog();
+      if (subscription->generation != current->generation) {
+        auto next = tag_service::make_subscription(*current, subscription->patterns);
+        update_subscription(next, next->dictionary);
+      }
+      subscriber_it = service.subscribers.insert(service.subscribers.end(), this);
+      registered = true;
+      spdlog::info("tag_service: new subscriber {} with {} filters", peer, subscribe_request.filters_size());
+      return;
+    }
+
+    std::unique_lock lock(mutex);
+    switch (id) {
+      case WRITE:
+        write_in_flight = false;
+        if (ok) {
+          batches_written++;
+          write_next(lock);
+        } else {
+          closed = true;
+        }
+        break;
+      case FINISH:
+        finish_in_flight = false;
+        closed = true;
+        break;
+      case DONE:
+        done = true;
+        closed = true;
+        break;
+    }
+
+    if (!done || write_in_flight || finish_in_flight) {
+      return;
+    }
+    lock.unlock();
+    if (registered) {
+      // publish() holds the list lock while it uses a subscriber, after the erase no one else can reach this call
+      std::lock_guard list_lock(service.subscriber_mutex);
+      service.subscribers.erase(subscriber_it);
+    }
+    spdlog::info("tag_service: subscriber {} left, {} batches written, {} conflated batches with {} values dropped",
+                 peer, batches_written, conflated_batches, conflated_values);
+    delete this;
+  }
+
+  // queues a batch or, while the queue is full, marks its tags for the next conflated batch
+  void enqueue(std::shared_ptr<grpc::ByteBuffer const> const& batch, std::vector<std::uint32_t> const& updated) {
+    std::unique_lock lock(mutex);
+    if (closed || finishing) {
+      return;
+    }
+    if (!conflating && queue.size() >= tag_service::max_queued_batches) {
+      start_conflating();
+    }
+    if (conflating) {
+      mark_dirty(updated);
+      return;
+    }
+    queue.push_back(batch);
+    max_queue_depth = std::max(max_queue_depth, queue.size());
+    if (!write_in_flight) {
+      write_next(lock);
+    }
+  }
+
+  // marks the tags of a batch that was encoded for a subscription a reload replaced meanwhile. They go out in a
+  // conflated batch from the snapshot after the dictionary pages of the reload.
+  void conflate(std::vector<std::uint32_t> const& updated) {
+    std::unique_lock lock(mutex);
+    if (closed || finishing) {
+      return;
+    }
+    if (!conflating) {
+      start_conflating();
+    }
+    mark_dirty(updated);
+    if (!write_in_flight) {
+      write_next(lock);
+    }
+  }
+
+  // switches to the subscription recompiled by a reload and queues the dictionary pages describing its changes.
+  // Called under the list lock like enqueue(), the pages go out before every batch published afterwards.
+  void update_subscription(std::shared_ptr<compiled_subscription const> next,
+                           std::vector<std::shared_ptr<grpc::ByteBuffer const>> const& dictionary) {
+    std::unique_lock lock(mutex);
+    subscription = std::move(next);
+    if (closed || finishing || dictionary.empty()) {
+      return;
+    }
+    queue.insert(queue.end(), dictionary.begin(), dictionary.end());
+    max_queue_depth = std::max(max_queue_depth, queue.size());
+    if (!write_in_flight) {
+      write_next(lock);
+    }
+  }
+
+  // ends the stream once the write in flight completed
+  void finish() {
+    std::unique_lock lock(mutex);
+    finishing = true;
+    if (!write_in_flight) {
+      start_finish();
+    }
+  }
+
+  std::shared_ptr<compiled_subscription const> const& compiled() const { return subscription; }
+
+  subscriber_stats stats() {
+    std::lock_guard lock(mutex);
+    return subscriber_stats{peer, queue.size(), max_queue_depth, batches_written, conflated_batches, conflated_values};
+  }
+
+ private:
+  void start_conflating() {
+    conflating = true;
+    dirty_tags.resize((service.catalog()->data_points.size() + 63) / 64);
+  }
+
+  // sets the bits of the tags in updated selected by the subscription, called with the mutex held
+  void mark_dirty(std::vector<std::uint32_t> const& updated) {
+    for (auto index : updated) {
+      if (!subscription->filter.contains(index)) {
+        continue;
+      }
+      if (index / 64 >= dirty_tags.size()) {
+        // added by a reload after the conflation started
+        dirty_tags.resize(index / 64 + 1);
+      }
+      auto& word = dirty_tags[index / 64];
+      auto bit = std::uint64_t{1} << (index % 64);
+      if (word & bit) {
+        // the value marked before is overwritten without being sent
+        conflated_values++;
+      }
+      word |= bit;
+    }
+  }
+
+  void write_next(std::unique_lock<std::mutex>& lock) {
+    if (finishing) {
+      start_finish();
+      return;
+    }
+    if (closed) {
+      return;
+    }
+    if (!queue.empty()) {
+      in_flight = std::move(queue.front());
+      queue.pop_front();
+      write_in_flight = true;
+      writer.Write(*in_flight, &events[WRITE]);
+      return;
+    }
+    if (!conflating) {
+      return;
+    }
+
+    // the queue drained, send the marked tags. The write is reserved so enqueue() only queues while the batch is
+    // encoded without the lock, the values in the snapshot are at least as new as every batch queued meanwhile.
+    conflating = false;
+    write_in_flight = true;
+    sending_tags.swap(dirty_tags);
+    lock.unlock();
+    grpcopc::TagStream message;
+    // a reload grows the catalog before the snapshot, so the catalog loaded second covers every tag of the snapshot
+    auto snapshot = service.snapshot();
+    auto tags = service.catalog();
+    encode_snapshot_batch(*snapshot, tags->data_points, sending_tags, *message.mutable_batch());
+    auto buffer = serialize_tag_stream(message);
+    std::fill(sending_tags.begin(), sending_tags.end(), 0);
+    lock.lock();
+
+    if (!buffer) {
+      write_in_flight = false;
+      write_next(lock);
+      return;
+    }
+    conflated_batches++;
+    in_flight = std::move(buffer);
+    writer.Write(*in_flight, &events[WRITE]);
+  }
+
+  void start_finish() {
+    if (closed || finish_in_flight) {
+      return;
+    }
+    finish_in_flight = true;
+    writer.Finish(grpc::Status::OK, &events[FINISH]);
+  }
+
+  tag_service& service;
+  grpc::ServerCompletionQueue* cq;
+
+  grpc::ServerContext ctx;
+  grpc::ByteBuffer request;
+  grpc::ServerAsyncWriter<grpc::ByteBuffer> writer;
+  event events[4]{{this, REQUEST}, {this, WRITE}, {this, FINISH}, {this, DONE}};
+  std::string peer;
+  // only changed under the list lock, where publish() reads it, and under the mutex of the call
+  std::shared_ptr<compiled_subscription const> subscription;
+
+  std::list<subscribe_call*>::iterator subscriber_it;
+  bool registered{false};
+
+  // guards everything below, the events of the call and publish() run on different threads
+  std::mutex mutex;
+  std::deque<std::shared_ptr<grpc::ByteBuffer const>> queue;
+  std::shared_ptr<grpc::ByteBuffer const> in_flight;
+  // bit per tag index, tags changed while the queue was full
+  std::vector<std::uint64_t> dirty_tags;
+  std::vector<std::uint64_t> sending_tags;
+  bool conflating{false};
+
+  std::size_t max_queue_depth{0};
+  std::uint64_t batches_written{0};
+  std::uint64_t conflated_batches{0};
+  std::uint64_t conflated_values{0};
+
+  bool write_in_flight{false};
+  bool finish_in_flight{false};
+  bool finishing{false};
+  // no more writes possible, either finished or the client went away
+  bool closed{false};
+  bool done{false};
+};
+
+// one ListTags stream, writes the tag list page by page
+class list_tags_call : public async_call {
+ public:
+  enum : int { REQUEST, WRITE, FINISH };
+
+  list_tags_call(tag_service& t_service, grpc::ServerCompletionQueue* t_cq)
+      : service(t_service), cq(t_cq), writer(&ctx) {
+    service.RequestListTags(&ctx, &request, &writer, cq, cq, &events[REQUEST]);
+  }
+
+  void on_event(int id, bool ok) override {
+    switch (id) {
+      case REQUEST:
+        if (!ok) {
+          delete this;
+          return;
+        }
+        if (service.accepting_calls()) {
+          new list_tags_call(service, cq);
+        }
+        // every page comes from the same catalog, a reload meanwhile does not shift the pages
+        tags = service.catalog();
+        write_next_page();
+        break;
+      case WRITE:
+        if (ok) {
+          write_next_page();
+        } else {
+          writer.Finish(grpc::Status(grpc::StatusCode::CANCELLED, "client went away"), &events[FINISH]);
+        }
+        break;
+      case FINISH:
+        delete this;
+        break;
+    }
+  }
+
+ private:
+  void write_next_page() {
+    // an empty tag list is still sent as one empty page
+    if (next_tag >= tags->data_points.size() && pages_written > 0) {
+      writer.Finish(grpc::Status::OK, &events[FINISH]);
+      return;
+    }
+    next_tag = tag_service::fill_tag_page(*tags, next_tag, page);
+    pages_written++;
+    writer.Write(page, &events[WRITE]);
+  }
+
+  tag_service& service;
+  grpc::ServerCompletionQueue* cq;
+
+  grpc::ServerContext ctx;
+  grpcopc::ListTagsRequest request;
+  grpc::ServerAsyncWriter<grpcopc::TagList> writer;
+  event events[3]{{this, REQUEST}, {this, WRITE}, {this, FINISH}};
+
+  std::shared_ptr<tag_catalog const> tags;
+  grpcopc::TagList page;
+  std::size_t next_tag{0};
+  std::size_t pages_written{0};
+};
+
+// one GetSnapshot stream, writes the values of one snapshot page by page
+class get_snapshot_call : public async_call {
+ public:
+  enum : int { REQUEST, WRITE, FINISH };
+
+  get_snapshot_call(tag_service& t_service, grpc::ServerCompletionQueue* t_cq)
+      : service(t_service), cq(t_cq), writer(&ctx) {
+    service.RequestGetSnapshot(&ctx, &request, &writer, cq, cq, &events[REQUEST]);
+  }
+
+  void on_event(int id, bool ok) override {
+    switch (id) {
+      case REQUEST: {
+        if (!ok) {
+          delete this;
+          return;
+        }
+        if (service.accepting_calls()) {
+          new get_snapshot_call(service, cq);
+        }
+        // every page comes from the same snapshot, so the client gets the values of one moment. A reload grows the
+        // catalog before the snapshot, so the catalog loaded second covers every tag of the snapshot.
+        snapshot = service.snapshot();
+        tags = service.catalog();
+        auto status = tag_service::resolve_tags(*tags, request, all_tags, indices);
+        if (!status.ok()) {
+          writer.Finish(status, &events[FINISH]);
+          return;
+        }
+        write_next_page();
+      } break;
+      case WRITE:
+        if (ok) {
+          write_next_page();
+        } else {
+          writer.Finish(grpc::Status(grpc::StatusCode::CANCELLED, "client went away"), &events[FINISH]);
+        }
+        break;
+      case FINISH:
+        delete this;
+        break;
+    }
+  }
+
+ private:
+  void write_next_page() {
+    auto count = all_tags ? snapshot->size() : indices.size();
+    if (position >= count && pages_written > 0) {
+      writer.Finish(grpc::Status::OK, &events[FINISH]);
+      return;
+    }
+    page.Clear();
+    page.set_sequence(snapshot->sequence());
+    while (position < count && static_cast<std::size_t>(page.values_size()) < tag_service::tags_per_page) {
+      auto index = all_tags ? position : indices[position];
+      position++;
+      if (index < snapshot->size() && snapshot->valid(index)) {
+        encode_tag_value(*snapshot, tags->data_points, index, *page.add_values());
+      }
+    }
+    pages_written++;
+    writer.Write(page, &events[WRITE]);
+  }
+
+  tag_service& service;
+  grpc::ServerCompletionQueue* cq;
+
+  grpc::ServerContext ctx;
+  grpcopc::GetSnapshotRequest request;
+  grpc::ServerAsyncWriter<grpcopc::TagSnapshot> writer;
+  event events[3]{{this, REQUEST}, {this, WRITE}, {this, FINISH}};
+
+  std::shared_ptr<tag_snapshot const> snapshot;
+  std::shared_ptr<tag_catalog const> tags;
+  bool all_tags{false};
+  std::vector<std::uint32_t> indices;
+  std::size_t position{0};
+  grpcopc::TagSnapshot page;
+  std::size_t pages_written{0};
+};
+
+// one WriteTags call, answered once the write handler reported the result of its writes
+class write_tags_call : public async_call {
+ public:
+  enum : int { REQUEST, FINISH };
+
+  write_tags_call(tag_service& t_service, grpc::ServerCompletionQueue* t_cq)
+      : service(t_service), cq(t_cq), responder(&ctx) {
+    service.RequestWriteTags(&ctx, &request, &responder, cq, cq, &events[REQUEST]);
+  }
+
+  void on_event(int id, bool ok) override {
+    switch (id) {
+      case REQUEST: {
+        if (!ok) {
+          delete this;
+          return;
+        }
+        if (service.accepting_calls()) {
+          new write_tags_call(service, cq);
+        }
+        std::vector<tag_write> writes;
+        auto status = service.decode_writes(request, writes);
+        if (status.ok()) {
+          // done may run on the thread of the reader, Finish is the last thing it touches
+          status = service.submit_writes(std::move(writes), [this](std::vector<std::int32_t> const& errors) {
+            response.mutable_errors()->Add(errors.begin(), errors.end());
+            responder.Finish(response, grpc::Status::OK, &events[FINISH]);
+          });
+        }
+        if (!status.ok()) {
+          responder.FinishWithError(status, &events[FINISH]);
+        }
+      } break;
+      case FINISH:
+        delete this;
+        break;
+    }
+  }
+
+ private:
+  tag_service& service;
+  grpc::ServerCompletionQueue* cq;
+
+  grpc::ServerContext ctx;
+  grpcopc::WriteTagsRequest request;
+  grpcopc::WriteTagsResponse response;
+  grpc::ServerAsyncResponseWriter<grpcopc::WriteTagsResponse> responder;
+  event events[2]{{this, REQUEST}, {this, FINISH}};
+};
+
+// one StreamWriteTags call, collects the writes of every message and executes them together once the client is done
+class stream_write_tags_call : public async_call {
+ public:
+  enum : int { REQUEST, READ, FINISH };
+
+  stream_write_tags_call(tag_service& t_service, grpc::ServerCompletionQueue* t_cq)
+      : service(t_service), cq(t_cq), reader(&ctx) {
+    service.RequestStreamWriteTags(&ctx, &reader, cq, cq, &events[REQUEST]);
+  }
+
+  void on_event(int id, bool ok) override {
+    switch (id) {
+      case REQUEST:
+        if (!ok) {
+          delete this;
+          return;
+        }
+        if (service.accepting_calls()) {
+          new stream_write_tags_call(service, cq);
+        }
+        reader.Read(&request, &events[READ]);
+        break;
+      case READ: {
+        grpc::Status status;
+        if (ok) {
+          status = service.decode_writes(request, writes);
+          if (status.ok()) {
+            reader.Read(&request, &events[READ]);
+            return;
+          }
+        } else {
+          // the client closed its side, every write has been read
+          status = service.submit_writes(std::move(writes), [this](std::vector<std::int32_t> const& errors) {
+            response.mutable_errors()->Add(errors.begin(), errors.end());
+            reader.Finish(response, grpc::Status::OK, &events[FINISH]);
+          });
+        }
+        if (!status.ok()) {
+          reader.FinishWithError(status, &events[FINISH]);
+        }
+      } break;
+      case FINISH:
+        delete this;
+        break;
+    }
+  }
+
+ private:
+  tag_service& service;
+  grpc::ServerCompletionQueue* cq;
+
+  grpc::ServerContext ctx;
+  grpcopc::WriteTagsRequest request;
+  grpcopc::WriteTagsResponse response;
+  grpc::ServerAsyncReader<grpcopc::WriteTagsResponse, grpcopc::WriteTagsRequest> reader;
+  event events[3]{{this, REQUEST}, {this, READ}, {this, FINISH}};
+
+  std::vector<tag_write> writes;
+};
+
+tag_catalog::tag_catalog(std::vector<opc_data_point> t_data_points, std::uint64_t t_generation)
+    : data_points(std::move(t_data_points)), name_index(data_points), generation(t_generation) {}
+
+tag_service::tag_service(std::vector<opc_data_point> t_vec_opc_data)
+    : catalog_ptr(std::make_shared<tag_catalog const>(std::move(t_vec_opc_data), 0)),
+      all_tags_subscription(make_subscription(*catalog(), {})),
+      snapshots(catalog()->data_points.size()) {}
+
+std::size_t tag_service::fill_tag_page(tag_catalog const& tags, std::size_t first, grpcopc::TagList& page) {
+  page.Clear();
+  auto last = std::min(first + tags_per_page, tags.data_points.size());
+  for (auto i = first; i < last; i++) {
+    encode_tag_info(tags.data_points, i, *page.add_tags());
+  }
+  return last;
+}
+
+grpc::Status tag_service::resolve_tags(tag_catalog const& tags,
+                                       grpcopc::GetSnapshotRequest const& request,
+                                       bool& all_tags,
+                                       std::vector<std::uint32_t>& indices) {
+  all_tags = request.ids().empty() && request.names().empty() && request.filters().empty();
+  indices.clear();
+  if (all_tags) {
+    return grpc::Status::OK;
+  }
+  indices.reserve(static_cast<std::size_t>(request.ids_size() + request.names_size()));
+  for (auto id : request.ids()) {
+    if (id >= tags.data_points.size()) {
+      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, fmt::format("unknown tag id {}", id));
+    }
+    indices.push_back(id);
+  }
+  for (auto const& name : request.names()) {
+    auto index = tags.name_index.find(name);
+    if (!index) {
+      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, fmt::format("unknown tag {}", name));
+    }
+    indices.push_back(*index);
+  }
+  if (!request.filters().empty()) {
+    std::vector<tag_pattern> patterns;
+    auto status = to_tag_patterns(request.filters(), patterns);
+    if (!status.ok()) {
+      return status;
+    }
+    tags.name_index.compile(patterns).for_each(tags.data_points.size(), [&indices](std::size_t index) {
+      indices.push_back(static_cast<std::uint32_t>(index));
+    });
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status tag_service::compile_subscription(
+  google::protobuf::RepeatedPtrField<grpcopc::TagFilter> const& filters,
+  std::shared_ptr<compiled_subscription const>& subscription) {
+  if (filters.empty()) {
+    std::lock_guard lock(subscription_mutex);
+    subscription = all_tags_subscription;
+    return grpc::Status::OK;
+  }
+  std::vector<tag_pattern> patterns;
+  auto status = to_tag_patterns(filters, patterns);
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto key = tag_name_index::key(patterns);
+  std::lock_guard lock(subscription_mutex);
+  auto& cached = subscription_cache[key];
+  subscription = cached.lock();
+  if (!subscription) {
+    subscription = make_subscription(*catalog(), std::move(patterns));
+    cached = subscription;
+    std::erase_if(subscription_cache, [](auto const& entry) { return entry.second.expired(); });
+  }
+  return grpc::Status::OK;
+}
+
+std::shared_ptr<compiled_subscription const> tag_service::make_subscription(tag_catalog const& tags,
+                                                                            std::vector<tag_pattern> patterns) {
+  auto subscription = std::make_shared<compiled_subscription>();
+  subscription->filter = patterns.empty() ? tag_filter() : tags.name_index.compile(patterns);
+  subscription->patterns = std::move(patterns);
+  subscription->generation = tags.generation;
+  for (auto const& page : encode_dictionary(tags.data_points, subscription->filter, tags_per_page)) {
+    subscription->dictionary.push_back(serialize_tag_stream(page));
+  }
+  return subscription;
+}
+
+void tag_service::update_data_points(std::vector<opc_data_point> data_points,
+                                     std::vector<std::uint32_t> const& changed) {
+  std::lock_guard cache_lock(subscription_mutex);
+  auto old_tags = catalog();
+  auto tags = std::make_shared<tag_catalog const>(std::move(data_points), old_tags->generation + 1);
+
+  // every compiled subscription in use is compiled again. Its subscribers get the changed tags selected by the old or
+  // the new filter, so they also learn about tags that left their selection.
+  struct recompiled {
+    std::shared_ptr<compiled_subscription const> subscription;
+    std::vector<std::shared_ptr<grpc::ByteBuffer const>> dictionary;
+  };
+  std::unordered_map<compiled_subscription const*, recompiled> replaced;
+  std::vector<std::uint32_t> selected;
+  auto recompile = [&](std::shared_ptr<compiled_subscription const> const& old) {
+    auto [it, inserted] = replaced.try_emplace(old.get());
+    if (inserted) {
+      it->second.subscription = make_subscription(*tags, old->patterns);
+      selected.clear();
+      for (auto index : changed) {
+        if (old->filter.contains(index) || it->second.subscription->filter.contains(index)) {
+          selected.push_back(index);
+        }
+      }
+      for (auto const& page : encode_dictionary(tags->data_points, selected, tags_per_page)) {
+        it->second.dictionary.push_back(serialize_tag_stream(page));
+      }
+    }
+    return it->second.subscription;
+  };
+  all_tags_subscription = recompile(all_tags_subscription);
+  for (auto& [key, cached] : subscription_cache) {
+    if (auto old = cached.lock()) {
+      cached = recompile(old);
+    }
+  }
+  std::erase_if(subscription_cache, [](auto const& entry) { return entry.second.expired(); });
+
+  // the last value of a removed tag or of a tag with a new type must not be served
+  std::vector<std::uint32_t> invalidated;
+  for (auto index : changed) {
+    if (tags->data_points[index].removed ||
+        (index < old_tags->data_points.size() &&
+         old_tags->data_points[index].dataType != tags->data_points[index].dataType)) {
+      invalidated.push_back(index);
+    }
+  }
+
+  std::size_t updated_subscribers = 0;
+  {
+    std::lock_guard list_lock(subscriber_mutex);
+    catalog_ptr.store(tags, std::memory_order_release);
+    for (auto* sub : subscribers) {
+      // a subscription compiled while a registration caught up is not in the cache
+      recompile(sub->compiled());
+      auto const& next = replaced[sub->compiled().get()];
+      sub->update_subscription(next.subscription, next.dictionary);
+      updated_subscribers++;
+    }
+  }
+  snapshots.resize(tags->data_points.size(), invalidated);
+  spdlog::info("tag_service: {} tags changed by a reload, {} subscribers updated", changed.size(),
+               updated_subscribers);
+}
+
+grpc::Status tag_service::decode_writes(grpcopc::WriteTagsRequest const& request,
+                                        std::vector<tag_write>& writes) const {
+  if (writes.size() + static_cast<std::size_t>(request.writes_size()) > max_writes_per_call) {
+    return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
+                        fmt::format("more than {} writes in one call", max_writes_per_call));
+  }
+  writes.reserve(writes.size() + static_cast<std::size_t>(request.writes_size()));
+  for (auto const& write : request.writes()) {
+    tag_write tw;
+    switch (write.tag_case()) {
+      case grpcopc::TagWrite::kId:
+        tw.index = write.id();
+        break;
+      case grpcopc::TagWrite::kName:
+        tw.index = catalog()->name_index.find(write.name()).value_or(std::numeric_limits<std::uint32_t>::max());
+        break;
+      default:
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "write without id or name");
+    }
+    switch (write.value_case()) {
+      case grpcopc::TagWrite::kFloatValue:
+        tw.value = write.float_value();
+        break;
+      case grpcopc::TagWrite::kIntValue: {
+        // integers beyond the range of int are passed on as double, exact up to 2^53
+        auto value = write.int_value();
+        if (value >= std::numeric_limits<int>::min() && value <= std::numeric_limits<int>::max()) {
+          tw.value = static_cast<int>(value);
+        } else {
+          tw.value = static_cast<double>(value);
+        }
+      } break;
+      case grpcopc::TagWrite::kStringValue:
+        tw.value = write.string_value();
+        break;
+      default:
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "write without value");
+    }
+    writes.push_back(std::move(tw));
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status tag_service::submit_writes(std::vector<tag_write> writes, write_callback done) {
+  if (!writer) {
+    return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, "writes are not enabled");
+  }
+  writer(std::move(writes), std::move(done));
+  return grpc::Status::OK;
+}
+
+bool tag_service::accepting_calls() {
+  std::lock_guard lock(subscriber_mutex);
+  return !shutting_down;
+}
+
+void tag_service::publish(sample_buffer const& samples) {
+  auto batch_sequence = sequence++;
+  snapshots.update(samples, batch_sequence);
+
+  // subscribers with the same filters share one compiled subscription, every distinct one is encoded and serialized
+  // once and its subscribers share the slices of the buffer. They are collected under the lock and encoded without it.
+  std::unordered_map<compiled_subscription const*, std::shared_ptr<grpc::ByteBuffer const>> buffers;
+  std::vector<std::shared_ptr<compiled_subscription const>> compiled;
+  {
+    std::lock_guard lock(subscriber_mutex);
+    for (auto* sub : subscribers) {
+      if (buffers.emplace(sub->compiled().get(), nullptr).second) {
+        compiled.push_back(sub->compiled());
+      }
+    }
+  }
+  if (compiled.empty()) {
+    return;
+  }
+
+  auto tags = catalog();
+  for (auto const& subscription : compiled) {
+    grpcopc::TagStream message;
+    encode_tag_batch(samples, tags->data_points, subscription->filter, batch_sequence, *message.mutable_batch());
+    // subscribers of a filter that selects none of the changed tags get no batch
+    if (!message.batch().ids().empty()) {
+      buffers[subscription.get()] = serialize_tag_stream(message);
+    }
+  }
+
+  std::lock_guard lock(subscriber_mutex);
+  for (auto* sub : subscribers) {
+    auto it = buffers.find(sub->compiled().get());
+    if (it == buffers.end()) {
+      // a reload replaced the subscription while the batch was encoded, or the subscriber registered meanwhile. The
+      // values are in the snapshot already, so it gets them in a conflated batch encoded with its current filter.
+      sub->conflate(samples.updated);
+    } else if (it->second) {
+      sub->enqueue(it->second, samples.updated);
+    }
+  }
+}
+
+void tag_service::serve(grpc::ServerCompletionQueue* cq) {
+  // every queue keeps one call of each method waiting for the next client
+  new subscribe_call(*this, cq);
+  new list_tags_call(*this, cq);
+  new get_snapshot_call(*this, cq);
+  new write_tags_call(*this, cq);
+  new stream_write_tags_call(*this, cq);
+
+  void* tag;
+  bool ok;
+  while (cq->Next(&tag, &ok)) {
+    auto* ev = static_cast<async_call::event*>(tag);
+    ev->call->on_event(ev->id, ok);
+  }
+}
+
+void tag_service::shutdown() {
+  std::lock_guard lock(subscriber_mutex);
+  shutting_down = true;
+  for (auto* sub : subscribers) {
+    sub->finish();
+  }
+}
+
+std::size_t tag_service::subscriber_count() {
+  std::lock_guard lock(subscriber_mutex);
+  return subscribers.size();
+}
+
+std::vector<subscriber_stats> tag_service::list_subscribers() {
+  std::lock_guard lock(subscriber_mutex);
+  std::vector<subscriber_stats> stats;
+  stats.reserve(subscribers.size());
+  for (auto* sub : subscribers) {
+    stats.push_back(sub->stats());
+  }
+  return stats;
+}
+
+tag_server::tag_server(std::vector<opc_data_point> t_vec_opc_data, std::size_t t_cq_threads)
+    : service(std::move(t_vec_opc_data)), cq_thread_count(t_cq_threads) {
+  if (cq_thread_count == 0) {
+    cq_thread_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+tag_server::~tag_server() {
+  stop();
+}
+
+bool tag_server::start(std::string const& listen_address) {
+  grpc::ServerBuilder builder;
+  if (!listen_address.empty()) {
+    builder.AddListeningPort(listen_address, grpc::InsecureServerCredentials());
+  }
+  builder.RegisterService(&service);
+  for (std::size_t i = 0; i < cq_thread_count; i++) {
+    cqs.push_back(builder.AddCompletionQueue());
+  }
+  server = builder.BuildAndStart();
+  if (!server) {
+    spdlog::error("tag_server: could not listen on {}", listen_address);
+    cqs.clear();
+    return false;
+  }
+  for (auto& cq : cqs) {
+    cq_threads.emplace_back([this, cq = cq.get()]() { service.serve(cq); });
+  }
+  if (!listen_address.empty()) {
+    spdlog::info("tag_server: listening on {} with {} completion queue threads", listen_address, cq_thread_count);
+  }
+  return true;
+}
+
+void tag_server::stop() {
+  if (!server) {
+    return;
+  }
+  service.shutdown();
+  // streams that could not finish within the deadline are cancelled
+  server->Shutdown(std::chrono::system_clock::now() + std::chrono::seconds(1));
+  for (auto& cq : cqs) {
+    cq->Shutdown();
+  }
+  for (auto& thread : cq_threads) {
+    thread.join();
+  }
+  cq_threads.clear();
+  server.reset();
+  cqs.clear();
+}
+
+std::shared_ptr<grpc::Channel> tag_server::in_process_channel() {
+  return server->InProcessChannel(grpc::ChannelArguments());
+}
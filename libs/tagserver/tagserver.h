@@ -0,0 +1,213 @@
+#ifndef TAGSERVER_H
+#define TAGSERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include <opcgrpc.grpc.pb.h>
+
+#include <snapshot.h>
+#include <tagsource.h>
+
+#include "tagcodec.h"
+#include "tagfilter.h"
+
+grpc::Status to_tag_patterns(google::protobuf::RepeatedPtrField<grpcopc::TagFilter> const& filters,
+                             std::vector<tag_pattern>& patterns);
+
+// the tags known to the service, replaced as a whole by a configuration reload
+struct tag_catalog {
+  tag_catalog(std::vector<opc_data_point> t_data_points, std::uint64_t t_generation);
+
+  std::vector<opc_data_point> data_points;
+  tag_name_index name_index;
+  // counts the reloads
+  std::uint64_t generation;
+};
+
+// filter of a subscription and the dictionary pages it starts with, shared by the subscriptions with the same filters.
+// A reload compiles the patterns again.
+struct compiled_subscription {
+  tag_filter filter;
+  std::vector<std::shared_ptr<grpc::ByteBuffer const>> dictionary;
+  std::vector<tag_pattern> patterns;
+  // of the catalog the filter was compiled with
+  std::uint64_t generation{0};
+};
+
+struct subscriber_stats {
+  std::string peer;
+  std::size_t queue_depth{0};
+  std::size_t max_queue_depth{0};
+  std::uint64_t batches_written{0};
+  std::uint64_t conflated_batches{0};
+  // values of tags overwritten by a newer value before they were sent
+  std::uint64_t conflated_values{0};
+};
+
+// an rpc served through the async api. Every operation passes one of the call's events as completion queue tag.
+class async_call {
+ public:
+  struct event {
+    async_call* call;
+    int id;
+  };
+
+  virtual ~async_call() = default;
+
+  virtual void on_event(int id, bool ok) = 0;
+};
+
+class subscribe_call;
+class list_tags_call;
+class get_snapshot_call;
+class write_tags_call;
+class stream_write_tags_call;
+
+// executes writes and reports their result through done, which has to be called exactly once
+using write_handler = std::function<void(std::vector<tag_write> writes, write_callback done)>;
+
+// all methods are served through the async api, so no thread is bound to a client. Subscribe is raw, a batch is
+// serialized once and the same ByteBuffer is written to every subscriber.
+using tag_service_base = grpcopc::TagService::WithAsyncMethod_StreamWriteTags<
+  grpcopc::TagService::WithAsyncMethod_WriteTags<
+    grpcopc::TagService::WithAsyncMethod_GetSnapshot<grpcopc::TagService::WithAsyncMethod_ListTags<
+      grpcopc::TagService::WithRawMethod_Subscribe<grpcopc::TagService::Service>>>>>;
+
+class tag_service final : public tag_service_base {
+ public:
+  explicit tag_service(std::vector<opc_data_point> t_vec_opc_data);
+
+  // stores the values of one acquisition cycle in the snapshot, encodes them and queues the batch for every
+  // subscriber. Safe to call from several threads.
+  void publish(sample_buffer const& samples);
+
+  std::shared_ptr<tag_snapshot const> snapshot() const { return snapshots.current(); }
+
+  // replaces the tags after a configuration reload, changed lists the indices that were added, removed or modified.
+  // Every subscriber selecting one of them gets a dictionary with their new entries before their first value.
+  void update_data_points(std::vector<opc_data_point> data_points, std::vector<std::uint32_t> const& changed);
+
+  // WriteTags fails with FAILED_PRECONDITION until a handler is set, which has to happen before the server starts
+  void set_write_handler(write_handler handler) { writer = std::move(handler); }
+
+  // accepts calls on cq and handles their events until the queue is shut down
+  void serve(grpc::ServerCompletionQueue* cq);
+
+  // finishes all Subscribe calls, has to be called before the server shuts down
+  void shutdown();
+
+  std::size_t subscriber_count();
+
+  // queue depth and conflation counters of every subscriber
+  std::vector<subscriber_stats> list_subscribers();
+
+ private:
+  friend class subscribe_call;
+  friend class list_tags_call;
+  friend class get_snapshot_call;
+  friend class write_tags_call;
+  friend class stream_write_tags_call;
+
+  std::shared_ptr<tag_catalog const> catalog() const { return catalog_ptr.load(std::memory_order_acquire); }
+
+  // fills page with up to tags_per_page tags starting at first, returns the index after the last one
+  static std::size_t fill_tag_page(tag_catalog const& tags, std::size_t first, grpcopc::TagList& page);
+
+  // tag indices selected by the ids, names and filters of request, all_tags if there are none
+  static grpc::Status resolve_tags(tag_catalog const& tags,
+                                   grpcopc::GetSnapshotRequest const& request,
+                                   bool& all_tags,
+                                   std::vector<std::uint32_t>& indices);
+
+  // subscriptions with the same filters share one compiled_subscription
+  grpc::Status compile_subscription(google::protobuf::RepeatedPtrField<grpcopc::TagFilter> const& filters,
+                                    std::shared_ptr<compiled_subscription const>& subscription);
+
+  // no pattern selects every tag
+  static std::shared_ptr<compiled_subscription const> make_subscription(tag_catalog const& tags,
+                                                                        std::vector<tag_pattern> patterns);
+
+  // appends the writes of request, a tag name that is not known becomes an id the source reports as unknown item
+  grpc::Status decode_writes(grpcopc::WriteTagsRequest const& request, std::vector<tag_write>& writes) const;
+
+  // passes writes to the write handler, done is not called if the returned status is an error
+  grpc::Status submit_writes(std::vector<tag_write> writes, write_callback done);
+
+  bool accepting_calls();
+
+  // batches queued for a subscriber before it is switched to conflation
+  static constexpr std::size_t max_queued_batches = 64;
+  // keeps a page of the tag list or dictionary well below the default 4 MB receive limit of clients
+  static constexpr std::size_t tags_per_page = 10000;
+  // writes in one WriteTags or StreamWriteTags call, all of them are held until the call is executed
+  static constexpr std::size_t max_writes_per_call = 100000;
+
+  // stored under the list lock, so a subscriber registering can tell whether a reload passed it by
+  std::atomic<std::shared_ptr<tag_catalog const>> catalog_ptr;
+
+  // guards the cached subscriptions, locked before the list lock. Serializes reloads.
+  std::mutex subscription_mutex;
+  std::shared_ptr<compiled_subscription const> all_tags_subscription;
+  std::map<std::string, std::weak_ptr<compiled_subscription const>> subscription_cache;
+
+  std::atomic<std::uint64_t> sequence{0};
+  snapshot_store snapshots;
+
+  write_handler writer;
+
+  // guards the subscriber list, locked before the mutex of a subscribe_call
+  std::mutex subscriber_mutex;
+  std::list<subscribe_call*> subscribers;
+  bool shutting_down{false};
+};
+
+// gRPC server hosting the tag_service on cq_threads completion queues with one thread each
+class tag_server {
+ public:
+  // cq_threads 0 uses one thread per core
+  explicit tag_server(std::vector<opc_data_point> t_vec_opc_data, std::size_t t_cq_threads = 0);
+  ~tag_server();
+
+  // an empty listen_address starts the server for in-process channels only
+  bool start(std::string const& listen_address);
+  void stop();
+
+  void publish(sample_buffer const& samples) { service.publish(samples); }
+
+  std::shared_ptr<tag_snapshot const> snapshot() const { return service.snapshot(); }
+
+  // safe while the server runs, see tag_service::update_data_points
+  void update_data_points(std::vector<opc_data_point> data_points, std::vector<std::uint32_t> const& changed) {
+    service.update_data_points(std::move(data_points), changed);
+  }
+
+  // enables WriteTags, set before start. Every write has to be done before stop is called.
+  void set_write_handler(write_handler handler) { service.set_write_handler(std::move(handler)); }
+
+  std::size_t subscriber_count() { return service.subscriber_count(); }
+
+  std::vector<subscriber_stats> list_subscribers() { return service.list_subscribers(); }
+
+  // channel to the running server without a network hop, for benchmarks
+  std::shared_ptr<grpc::Channel> in_process_channel();
+
+ private:
+  tag_service service;
+  std::size_t cq_thread_count;
+  std::unique_ptr<grpc::Server> server;
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs;
+  std::vector<std::thread> cq_threads;
+};
+
+#endif  // TAGSERVER_H
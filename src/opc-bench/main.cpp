@@ -0,0 +1,731 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <spdlog/spdlog.h>
+
+#include <lyra/lyra.hpp>
+
+#include <latency.h>
+#include <opcreader.h>
+#include <simsource.h>
+#include <tagcodec.h>
+#include <tagserver.h>
+
+// one subscriber of a benchmark, reads its stream on a client completion queue
+struct bench_subscriber {
+  enum : int { START, READ, FINISH };
+
+  struct event {
+    bench_subscriber* sub;
+    int id;
+  };
+
+  grpc::ClientContext ctx;
+  std::unique_ptr<grpc::ClientAsyncReader<grpcopc::TagStream>> reader;
+  grpcopc::TagStream message;
+  grpc::Status status;
+  event events[3]{{this, START}, {this, READ}, {this, FINISH}};
+
+  std::uint64_t next_sequence{0};
+  std::uint64_t dictionary_tags{0};
+  std::uint64_t batches{0};
+  std::uint64_t missed{0};
+  std::uint64_t conflated{0};
+};
+
+// starts a Subscribe stream on cq
+std::unique_ptr<bench_subscriber> start_subscriber(grpcopc::TagService::Stub& stub, grpc::CompletionQueue& cq) {
+  auto sub = std::make_unique<bench_subscriber>();
+  sub->reader = stub.PrepareAsyncSubscribe(&sub->ctx, grpcopc::SubscribeRequest(), &cq);
+  sub->reader->StartCall(&sub->events[bench_subscriber::START]);
+  return sub;
+}
+
+// handles the events of the streams on cq until it is shut down. on_batch is called for every batch read.
+template <typename On_Batch>
+void read_subscribers(grpc::CompletionQueue& cq, std::atomic<std::size_t>& finished, On_Batch on_batch) {
+  void* tag;
+  bool ok;
+  while (cq.Next(&tag, &ok)) {
+    auto* ev = static_cast<bench_subscriber::event*>(tag);
+    auto* sub = ev->sub;
+    switch (ev->id) {
+      case bench_subscriber::START:
+      case bench_subscriber::READ:
+        if (ev->id == bench_subscriber::READ && ok && sub->message.has_dictionary()) {
+          sub->dictionary_tags += static_cast<std::uint64_t>(sub->message.dictionary().tags_size());
+        } else if (ev->id == bench_subscriber::READ && ok) {
+          auto const& batch = sub->message.batch();
+          // the sequence numbers all batches of the server, a subscriber joining late starts in the middle
+          if (sub->batches > 0 && batch.sequence() > sub->next_sequence) {
+            sub->missed += batch.sequence() - sub->next_sequence;
+          }
+          sub->next_sequence = batch.sequence() + 1;
+          sub->batches++;
+          if (batch.conflated()) {
+            sub->conflated++;
+          }
+          on_batch(*sub);
+        }
+        if (ok) {
+          sub->reader->Read(&sub->message, &sub->events[bench_subscriber::READ]);
+        } else {
+          sub->reader->Finish(&sub->status, &sub->events[bench_subscriber::FINISH]);
+        }
+        break;
+      case bench_subscriber::FINISH:
+        finished++;
+        break;
+    }
+  }
+}
+
+struct fan_out_result {
+  std::size_t subscribers{0};
+  std::uint64_t delivered{0};
+  std::chrono::nanoseconds publish_time{0};
+  std::chrono::nanoseconds wall_time{0};
+  double cpu_ms{0.0};
+};
+
+// publishes batches batches of tag_count changed tags to subscribers in-process subscribers
+fan_out_result run_fan_out(std::vector<opc_data_point> const& data_points,
+                           std::size_t subscribers,
+                           std::size_t batches) {
+  fan_out_result result;
+  result.subscribers = subscribers;
+
+  tag_server server(data_points);
+  if (!server.start("")) {
+    return result;
+  }
+  auto stub = grpcopc::TagService::NewStub(server.in_process_channel());
+
+  grpc::CompletionQueue cq;
+  std::atomic<std::uint64_t> received{0};
+  std::atomic<std::size_t> finished{0};
+  std::vector<std::unique_ptr<bench_subscriber>> subs;
+  for (std::size_t i = 0; i < subscribers; i++) {
+    subs.push_back(start_subscriber(*stub, cq));
+  }
+
+  std::thread client_thread([&]() { read_subscribers(cq, finished, [&](bench_subscriber&) { received++; }); });
+
+  auto connect_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+  while (server.subscriber_count() < subscribers && std::chrono::steady_clock::now() < connect_deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  sample_buffer samples;
+  samples.resize(data_points.size());
+  for (std::size_t i = 0; i < data_points.size(); i++) {
+    samples.text[i] = "ABCDEF";
+    samples.quality[i] = 0xC0;
+    samples.updated.push_back(static_cast<std::uint32_t>(i));
+  }
+
+  // the publisher stays at most window batches ahead of the slowest subscriber, so no subscriber is conflated
+  constexpr std::uint64_t window = 32;
+  auto cpu_start = std::clock();
+  auto wall_start = std::chrono::steady_clock::now();
+  for (std::size_t b = 0; b < batches; b++) {
+    while (b > window && received.load() < (b - window) * subscribers) {
+      std::this_thread::yield();
+    }
+    auto now = std::chrono::system_clock::now();
+    for (std::size_t i = 0; i < data_points.size(); i++) {
+      samples.numeric[i] = static_cast<double>(b + i);
+      samples.timestamp[i] = now;
+    }
+
+    auto publish_start = std::chrono::steady_clock::now();
+    server.publish(samples);
+    result.publish_time += std::chrono::steady_clock::now() - publish_start;
+  }
+
+  auto deliver_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+  while (received.load() < batches * subscribers && std::chrono::steady_clock::now() < deliver_deadline) {
+    std::this_thread::yield();
+  }
+  result.wall_time = std::chrono::steady_clock::now() - wall_start;
+  // process cpu time on posix systems, the msvc runtime reports wall time here
+  result.cpu_ms = 1000.0 * static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+  result.delivered = received.load();
+
+  // no call may start an operation on the queue after it has been shut down, so wait for all streams to finish
+  server.stop();
+  while (finished.load() < subscribers) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  cq.Shutdown();
+  client_thread.join();
+  return result;
+}
+
+struct load_options {
+  sim_config config;
+  unsigned long rate_ms{100};
+  std::size_t streams{2000};
+  // streams that sleep slow_delay after every batch, read on a queue of their own
+  std::size_t slow_streams{0};
+  std::chrono::milliseconds slow_delay{50};
+  std::size_t cq_threads{0};
+  std::size_t client_threads{4};
+  std::chrono::seconds duration{10};
+};
+
+struct load_result {
+  std::size_t connected{0};
+  std::size_t listed_tags{0};
+  std::uint64_t batches{0};
+  std::uint64_t updates{0};
+  // batches skipped by conflation, for the fast and the slow streams
+  std::uint64_t missed{0};
+  std::uint64_t slow_missed{0};
+  std::uint64_t slow_conflated_batches{0};
+  // from the server's subscriber stats at the end of the run
+  std::size_t max_queue_depth{0};
+  std::uint64_t conflated_values{0};
+  std::chrono::nanoseconds wall_time{0};
+  double cpu_ms{0.0};
+  // GetSnapshot of all tags while the source is running
+  std::size_t snapshot_tags{0};
+  std::chrono::nanoseconds snapshot_time{0};
+  // from the source timestamp of a batch to its arrival at the subscriber
+  latency_histogram delivery;
+};
+
+// runs a server fed by a simulated tag source and holds Subscribe streams open against it
+void run_load(load_options const& options, load_result& result) {
+  auto data_points = make_sim_data_points(options.config);
+  tag_server server(data_points, options.cq_threads);
+  if (!server.start("")) {
+    return;
+  }
+  auto stub = grpcopc::TagService::NewStub(server.in_process_channel());
+
+  {
+    grpc::ClientContext ctx;
+    auto list_reader = stub->ListTags(&ctx, grpcopc::ListTagsRequest());
+    grpcopc::TagList page;
+    while (list_reader->Read(&page)) {
+      result.listed_tags += static_cast<std::size_t>(page.tags_size());
+    }
+    auto status = list_reader->Finish();
+    if (!status.ok()) {
+      spdlog::error("ListTags failed, reason: {}", status.error_message());
+    }
+  }
+
+  std::vector<std::unique_ptr<grpc::CompletionQueue>> client_cqs;
+  for (std::size_t i = 0; i < options.client_threads; i++) {
+    client_cqs.push_back(std::make_unique<grpc::CompletionQueue>());
+  }
+  grpc::CompletionQueue slow_cq;
+  std::atomic<std::size_t> finished{0};
+  std::atomic<std::uint64_t> updates{0};
+  std::vector<std::unique_ptr<bench_subscriber>> subs;
+  for (std::size_t i = 0; i < options.streams; i++) {
+    subs.push_back(start_subscriber(*stub, *client_cqs[i % options.client_threads]));
+  }
+  std::vector<std::unique_ptr<bench_subscriber>> slow_subs;
+  for (std::size_t i = 0; i < options.slow_streams; i++) {
+    slow_subs.push_back(start_subscriber(*stub, slow_cq));
+  }
+
+  std::vector<std::thread> client_thread_pool;
+  for (auto& cq : client_cqs) {
+    client_thread_pool.emplace_back([&, cq = cq.get()]() {
+      read_subscribers(*cq, finished, [&](bench_subscriber& sub) {
+        auto const& batch = sub.message.batch();
+        updates += static_cast<std::uint64_t>(batch.ids_size());
+        if (batch.ids_size() > 0) {
+          auto now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count();
+          result.delivery.record(std::chrono::microseconds(now_us - batch.base_time_us() - batch.time_offsets_us(0)));
+        }
+      });
+    });
+  }
+  client_thread_pool.emplace_back([&]() {
+    read_subscribers(slow_cq, finished, [&](bench_subscriber&) { std::this_thread::sleep_for(options.slow_delay); });
+  });
+
+  auto total_streams = options.streams + options.slow_streams;
+  auto connect_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+  while (server.subscriber_count() < total_streams && std::chrono::steady_clock::now() < connect_deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  result.connected = server.subscriber_count();
+
+  sim_source source(options.config, options.rate_ms);
+  source.connect();
+  source.add_items(data_points);
+
+  auto cpu_start = std::clock();
+  auto wall_start = std::chrono::steady_clock::now();
+  source.subscribe([&server](sample_buffer const& samples) { server.publish(samples); });
+  std::this_thread::sleep_for(options.duration);
+
+  {
+    auto snapshot_start = std::chrono::steady_clock::now();
+    grpc::ClientContext ctx;
+    auto snapshot_reader = stub->GetSnapshot(&ctx, grpcopc::GetSnapshotRequest());
+    grpcopc::TagSnapshot page;
+    while (snapshot_reader->Read(&page)) {
+      result.snapshot_tags += static_cast<std::size_t>(page.values_size());
+    }
+    auto status = snapshot_reader->Finish();
+    if (!status.ok()) {
+      spdlog::error("GetSnapshot failed, reason: {}", status.error_message());
+    }
+    result.snapshot_time = std::chrono::steady_clock::now() - snapshot_start;
+  }
+
+  source.unsubscribe();
+  for (auto const& stats : server.list_subscribers()) {
+    result.max_queue_depth = std::max(result.max_queue_depth, stats.max_queue_depth);
+    result.conflated_values += stats.conflated_values;
+  }
+  result.wall_time = std::chrono::steady_clock::now() - wall_start;
+  result.cpu_ms = 1000.0 * static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+
+  server.stop();
+  auto finish_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+  while (finished.load() < total_streams && std::chrono::steady_clock::now() < finish_deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  for (auto& cq : client_cqs) {
+    cq->Shutdown();
+  }
+  slow_cq.Shutdown();
+  for (auto& thread : client_thread_pool) {
+    thread.join();
+  }
+
+  result.updates = updates.load();
+  for (auto const& sub : subs) {
+    result.batches += sub->batches;
+    result.missed += sub->missed;
+  }
+  for (auto const& sub : slow_subs) {
+    result.slow_missed += sub->missed;
+    result.slow_conflated_batches += sub->conflated;
+  }
+}
+
+// opcItems of an ini file in the format written by QSettings, opcItems\<n>\name=...
+std::vector<opc_data_point> read_ini_items(std::string const& file_name) {
+  std::map<int, opc_data_point> items;
+  std::ifstream ifs(file_name);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (!line.starts_with("opcItems\\")) {
+      continue;
+    }
+    auto key_start = line.find('\\', 9);
+    auto eq = line.find('=');
+    if (key_start == std::string::npos || eq == std::string::npos || eq < key_start) {
+      continue;
+    }
+    auto number = std::atoi(line.substr(9, key_start - 9).c_str());
+    auto key = line.substr(key_start + 1, eq - key_start - 1);
+    auto value = line.substr(eq + 1);
+    if (key == "name") {
+      items[number].name = value;
+    } else if (key == "label") {
+      items[number].label = value;
+    } else if (key == "type") {
+      auto& type = items[number].dataType;
+      type = value == "string" ? opc_data_types::STRING
+             : value == "float" ? opc_data_types::FLOAT
+             : value == "byte"  ? opc_data_types::BYTE
+             : value == "word"  ? opc_data_types::WORD
+                                : opc_data_types::INT;
+    }
+  }
+  std::vector<opc_data_point> data_points;
+  for (auto& [number, item] : items) {
+    data_points.push_back(std::move(item));
+  }
+  return data_points;
+}
+
+struct encoding_result {
+  std::string name;
+  std::size_t bytes{0};
+  std::chrono::nanoseconds encode_time{0};
+  std::chrono::nanoseconds decode_time{0};
+};
+
+// encodes batches cycles in which every tag changed in three ways: one message per tag carrying its name, a batch
+// of id based update messages, and the packed batch of Subscribe
+std::vector<encoding_result> run_encoding(std::vector<opc_data_point> const& data_points,
+                                          std::size_t batches,
+                                          std::size_t& dictionary_bytes) {
+  sample_buffer samples;
+  samples.resize(data_points.size());
+  std::uint64_t rng = 42;
+  auto next_random = [&rng]() {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+  };
+
+  std::vector<encoding_result> results{{"per-tag message with name"}, {"batch of id updates"}, {"packed batch"}};
+  tag_filter all_tags;
+  dictionary_bytes = 0;
+  for (auto const& page : encode_dictionary(data_points, all_tags, 10000)) {
+    dictionary_bytes += page.ByteSizeLong();
+  }
+
+  snapshot_store snapshots(data_points.size());
+  std::string wire;
+  for (std::size_t b = 0; b < batches; b++) {
+    // device timestamps of one cycle lie within a few milliseconds
+    auto now = std::chrono::system_clock::now();
+    samples.updated.clear();
+    for (std::size_t i = 0; i < data_points.size(); i++) {
+      samples.numeric[i] = static_cast<double>(next_random() % 256);
+      samples.text[i] = data_points[i].dataType == opc_data_types::STRING ? "ABCDEF" : "";
+      samples.quality[i] = 0xC0;
+      samples.timestamp[i] = now + std::chrono::microseconds(next_random() % 5000);
+      samples.updated.push_back(static_cast<std::uint32_t>(i));
+    }
+
+    // one message per tag
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> messages;
+    messages.reserve(samples.updated.size() * 2);
+    for (auto index : samples.updated) {
+      grpcopc::TagInfo info;
+      info.set_name(data_points[index].name);
+      info.set_type(to_tag_type(data_points[index].dataType));
+      grpcopc::TagUpdate update;
+      update.set_id(index);
+      update.set_quality(samples.quality[index]);
+      update.set_timestamp_us(
+        std::chrono::duration_cast<std::chrono::microseconds>(samples.timestamp[index].time_since_epoch()).count());
+      update.set_int_value(static_cast<std::int64_t>(samples.numeric[index]));
+      messages.push_back(info.SerializeAsString());
+      messages.push_back(update.SerializeAsString());
+    }
+    results[0].encode_time += std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (std::size_t m = 0; m < messages.size(); m += 2) {
+      grpcopc::TagInfo info;
+      grpcopc::TagUpdate update;
+      info.ParseFromString(messages[m]);
+      update.ParseFromString(messages[m + 1]);
+      // every message is framed by a length prefix on the wire
+      results[0].bytes += messages[m].size() + messages[m + 1].size() + 2;
+    }
+    results[0].decode_time += std::chrono::steady_clock::now() - start;
+
+    // id based update messages, the stream format before the packed batch
+    snapshots.update(samples, b);
+    auto snapshot = snapshots.current();
+    start = std::chrono::steady_clock::now();
+    {
+      grpcopc::TagSnapshot batch;
+      for (auto index : samples.updated) {
+        encode_tag_value(*snapshot, data_points, index, *batch.add_values());
+      }
+      batch.SerializeToString(&wire);
+    }
+    results[1].encode_time += std::chrono::steady_clock::now() - start;
+    results[1].bytes += wire.size();
+    start = std::chrono::steady_clock::now();
+    {
+      grpcopc::TagSnapshot batch;
+      batch.ParseFromString(wire);
+    }
+    results[1].decode_time += std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    {
+      grpcopc::TagStream message;
+      encode_tag_batch(samples, data_points, all_tags, b, *message.mutable_batch());
+      message.SerializeToString(&wire);
+    }
+    results[2].encode_time += std::chrono::steady_clock::now() - start;
+    results[2].bytes += wire.size();
+    start = std::chrono::steady_clock::now();
+    {
+      grpcopc::TagStream message;
+      message.ParseFromString(wire);
+    }
+    results[2].decode_time += std::chrono::steady_clock::now() - start;
+  }
+  return results;
+}
+
+struct write_result {
+  std::string name;
+  std::size_t calls{0};
+  std::size_t failed{0};
+  std::chrono::nanoseconds time{0};
+};
+
+// the value written to tag index in a write benchmark, of the type of the tag
+void make_tag_write(std::vector<opc_data_point> const& data_points, std::size_t index, grpcopc::TagWrite& write) {
+  write.set_id(static_cast<std::uint32_t>(index));
+  switch (data_points[index].dataType) {
+    case opc_data_types::STRING:
+      write.set_string_value(fmt::format("setpoint {}", index));
+      break;
+    case opc_data_types::FLOAT:
+      write.set_float_value(static_cast<double>(index) * 0.5);
+      break;
+    default:
+      write.set_int_value(static_cast<std::int64_t>(index % 255));
+      break;
+  }
+}
+
+// writes the same tags once per tag, as one WriteTags call and as a StreamWriteTags stream through an opc_reader
+// running the given config, so every call waits for the query loop like it does against a real server
+std::vector<write_result> run_write(std::string const& reader_config, std::size_t tag_count, std::size_t per_message) {
+  std::vector<write_result> results;
+  opc_reader reader(reader_config);
+  if (!reader.init()) {
+    return results;
+  }
+  auto data_points = reader.data_points();
+  tag_count = std::min(tag_count, data_points.size());
+  tag_server server(data_points, 1);
+  server.set_write_handler([&reader](std::vector<tag_write> writes, write_callback done) {
+    reader.write(std::move(writes), std::move(done));
+  });
+  if (!server.start("")) {
+    return results;
+  }
+  auto stub = grpcopc::TagService::NewStub(server.in_process_channel());
+  std::thread reader_thread(&opc_reader::query_server, &reader);
+
+  auto write_tags = [&stub](grpcopc::WriteTagsRequest const& request, write_result& result) {
+    grpc::ClientContext ctx;
+    grpcopc::WriteTagsResponse response;
+    auto status = stub->WriteTags(&ctx, request, &response);
+    result.calls++;
+    if (!status.ok()) {
+      result.failed += static_cast<std::size_t>(request.writes_size());
+      return;
+    }
+    result.failed += static_cast<std::size_t>(std::ranges::count_if(response.errors(), [](auto e) { return e < 0; }));
+  };
+
+  // the reader accepts writes once its items are added
+  auto ready_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+  grpcopc::WriteTagsRequest request;
+  make_tag_write(data_points, 0, *request.add_writes());
+  for (write_result probe; std::chrono::steady_clock::now() < ready_deadline; probe = write_result()) {
+    write_tags(request, probe);
+    if (probe.failed == 0) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  {
+    auto& result = results.emplace_back(write_result{"one call per tag"});
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < tag_count; i++) {
+      request.Clear();
+      make_tag_write(data_points, i, *request.add_writes());
+      write_tags(request, result);
+    }
+    result.time = std::chrono::steady_clock::now() - start;
+  }
+  {
+    auto& result = results.emplace_back(write_result{"one WriteTags call"});
+    auto start = std::chrono::steady_clock::now();
+    request.Clear();
+    for (std::size_t i = 0; i < tag_count; i++) {
+      make_tag_write(data_points, i, *request.add_writes());
+    }
+    write_tags(request, result);
+    result.time = std::chrono::steady_clock::now() - start;
+  }
+  {
+    auto& result = results.emplace_back(write_result{"StreamWriteTags"});
+    auto start = std::chrono::steady_clock::now();
+    grpc::ClientContext ctx;
+    grpcopc::WriteTagsResponse response;
+    auto stream = stub->StreamWriteTags(&ctx, &response);
+    for (std::size_t first = 0; first < tag_count; first += per_message) {
+      request.Clear();
+      for (auto i = first; i < std::min(first + per_message, tag_count); i++) {
+        make_tag_write(data_points, i, *request.add_writes());
+      }
+      stream->Write(request);
+    }
+    stream->WritesDone();
+    auto status = stream->Finish();
+    result.calls = 1;
+    result.failed = status.ok() ? static_cast<std::size_t>(
+                                    std::ranges::count_if(response.errors(), [](auto e) { return e < 0; }))
+                                : tag_count;
+    result.time = std::chrono::steady_clock::now() - start;
+  }
+
+  reader.stop_query();
+  reader_thread.join();
+  server.stop();
+  return results;
+}
+
+int main(int argc, char** argv) {
+  bool show_help{false};
+  std::string mode{"fanout"};
+  std::size_t tag_count{1000};
+  std::size_t batches{200};
+  std::size_t max_subscribers{1000};
+  load_options load;
+  std::string config_file{"config/opc_reader.ini"};
+  std::size_t scale{1000};
+  std::size_t duration_s{10};
+  std::size_t slow_delay_ms{50};
+  std::string reader_config{"config/opc-reader-sim.json"};
+  std::size_t writes_per_message{100};
+
+  auto cli = lyra::help(show_help) |
+             lyra::opt(mode, "mode")["-m"]["--mode"]("fanout, load, encoding or write, default fanout") |
+             lyra::opt(tag_count, "tags")["-t"]["--tags"]("tags per batch, load: simulated tags, write: tags written") |
+             lyra::opt(batches, "batches")["-b"]["--batches"]("fanout, encoding: batches per run") |
+             lyra::opt(config_file, "ini file")["-c"]["--config"]("encoding: ini file with the opcItems") |
+             lyra::opt(scale, "copies")["--scale"]("encoding: copies of the opcItems") |
+             lyra::opt(reader_config, "json file")["--reader-config"]("write: opc_reader config, default demo mode") |
+             lyra::opt(writes_per_message, "writes")["--per-message"]("write: writes per StreamWriteTags message") |
+             lyra::opt(max_subscribers, "subscribers")["-s"]["--max-subscribers"]("fanout: largest subscriber count") |
+             lyra::opt(load.streams, "streams")["-n"]["--streams"]("load: Subscribe streams held open") |
+             lyra::opt(load.slow_streams, "streams")["--slow-streams"]("load: additional streams that read slowly") |
+             lyra::opt(slow_delay_ms, "ms")["--slow-delay"]("load: time a slow stream spends on every batch") |
+             lyra::opt(duration_s, "seconds")["-d"]["--duration"]("load: run time in seconds") |
+             lyra::opt(load.rate_ms, "ms")["-r"]["--rate"]("load: update rate of the simulated tags") |
+             lyra::opt(load.cq_threads, "threads")["--threads"]("load: server completion queue threads, 0 per core") |
+             lyra::opt(load.client_threads, "threads")["--client-threads"]("load: client completion queue threads");
+
+  auto parse_result = cli.parse({argc, argv});
+  if (!parse_result) {
+    spdlog::error("error in command line: {}", parse_result.message());
+    show_help = true;
+  }
+
+  if (show_help) {
+    std::stringstream cli_out;
+    cli_out << cli;
+    spdlog::info("{}", cli_out.str());
+    return EXIT_SUCCESS;
+  }
+
+  // subscribers connecting and leaving would flood the output
+  spdlog::set_level(spdlog::level::warn);
+
+  sim_config config;
+  config.tag_count = tag_count;
+
+  if (mode == "load") {
+    load.config = config;
+    load.client_threads = std::max<std::size_t>(load.client_threads, 1);
+    load.duration = std::chrono::seconds(duration_s);
+    load.slow_delay = std::chrono::milliseconds(slow_delay_ms);
+    fmt::print("load of {} streams and {} slow streams on {} simulated tags at {} ms for {} s\n", load.streams,
+               load.slow_streams, tag_count, load.rate_ms, duration_s);
+    auto result = std::make_unique<load_result>();
+    run_load(load, *result);
+    auto seconds = std::chrono::duration<double>(result->wall_time).count();
+    fmt::print("listed tags      {}\n", result->listed_tags);
+    fmt::print("connected        {}\n", result->connected);
+    fmt::print("batches/s        {:.0f}\n", seconds > 0 ? static_cast<double>(result->batches) / seconds : 0.0);
+    fmt::print("updates/s        {:.0f}\n", seconds > 0 ? static_cast<double>(result->updates) / seconds : 0.0);
+    fmt::print("missed batches   {}\n", result->missed);
+    fmt::print("slow streams     {} batches missed, {} conflated batches\n", result->slow_missed,
+               result->slow_conflated_batches);
+    fmt::print("queue depth max  {}\n", result->max_queue_depth);
+    fmt::print("conflated values {}\n", result->conflated_values);
+    fmt::print("cpu ms           {:.0f}\n", result->cpu_ms);
+    fmt::print("snapshot         {} tags in {:.1f} ms\n", result->snapshot_tags,
+               std::chrono::duration<double, std::milli>(result->snapshot_time).count());
+    fmt::print("delivery p50 {} us, p99 {} us, p999 {} us, max {} us\n", result->delivery.percentile(0.5).count(),
+               result->delivery.percentile(0.99).count(), result->delivery.percentile(0.999).count(),
+               result->delivery.max().count());
+    return EXIT_SUCCESS;
+  }
+  if (mode == "encoding") {
+    auto items = read_ini_items(config_file);
+    if (items.empty()) {
+      spdlog::error("no opcItems in {}", config_file);
+      return EXIT_FAILURE;
+    }
+    std::vector<opc_data_point> data_points;
+    data_points.reserve(items.size() * scale);
+    for (std::size_t c = 0; c < scale; c++) {
+      data_points.insert(data_points.end(), items.begin(), items.end());
+    }
+    std::size_t dictionary_bytes{0};
+    auto results = run_encoding(data_points, batches, dictionary_bytes);
+    auto updates = static_cast<double>(batches * data_points.size());
+    fmt::print("{} batches of {} tags, the {} opcItems of {} {} times\n", batches, data_points.size(), items.size(),
+               config_file, scale);
+    fmt::print("{:<26} {:>12} {:>12} {:>16} {:>16}\n", "encoding", "bytes/batch", "bytes/tag", "encode Mtags/s",
+               "decode Mtags/s");
+    for (auto const& r : results) {
+      fmt::print("{:<26} {:>12.0f} {:>12.2f} {:>16.2f} {:>16.2f}\n", r.name,
+                 static_cast<double>(r.bytes) / static_cast<double>(batches), static_cast<double>(r.bytes) / updates,
+                 updates / std::chrono::duration<double, std::micro>(r.encode_time).count(),
+                 updates / std::chrono::duration<double, std::micro>(r.decode_time).count());
+    }
+    fmt::print("dictionary sent once per subscription: {} bytes\n", dictionary_bytes);
+    return EXIT_SUCCESS;
+  }
+  if (mode == "write") {
+    auto results = run_write(reader_config, tag_count, std::max<std::size_t>(writes_per_message, 1));
+    if (results.empty()) {
+      spdlog::error("could not run the opc_reader with {}", reader_config);
+      return EXIT_FAILURE;
+    }
+    fmt::print("writing {} tags through the opc_reader of {}\n", tag_count, reader_config);
+    fmt::print("{:<20} {:>8} {:>8} {:>12} {:>14}\n", "method", "calls", "failed", "total ms", "us/write");
+    for (auto const& r : results) {
+      auto ms = std::chrono::duration<double, std::milli>(r.time).count();
+      fmt::print("{:<20} {:>8} {:>8} {:>12.1f} {:>14.1f}\n", r.name, r.calls, r.failed, ms,
+                 1000.0 * ms / static_cast<double>(tag_count));
+    }
+    return EXIT_SUCCESS;
+  }
+  if (mode != "fanout") {
+    spdlog::error("unknown mode {}", mode);
+    return EXIT_FAILURE;
+  }
+
+  auto data_points = make_sim_data_points(config);
+
+  fmt::print("fan-out of {} batches with {} tags over an in-process channel\n", batches, tag_count);
+  fmt::print("{:>11} {:>14} {:>10} {:>10} {:>16} {:>12}\n", "subscribers", "publish us/b", "wall ms", "cpu ms",
+             "cpu us/delivery", "delivered");
+  for (std::size_t subscribers = 1; subscribers <= max_subscribers; subscribers *= 10) {
+    auto r = run_fan_out(data_points, subscribers, batches);
+    auto publish_us = std::chrono::duration<double, std::micro>(r.publish_time).count() / static_cast<double>(batches);
+    auto wall_ms = std::chrono::duration<double, std::milli>(r.wall_time).count();
+    auto cpu_per_delivery = r.delivered > 0 ? 1000.0 * r.cpu_ms / static_cast<double>(r.delivered) : 0.0;
+    fmt::print("{:>11} {:>14.1f} {:>10.1f} {:>10.1f} {:>16.2f} {:>12}\n", r.subscribers, publish_us, wall_ms, r.cpu_ms,
+               cpu_per_delivery, r.delivered);
+  }
+
+  return EXIT_SUCCESS;
+}
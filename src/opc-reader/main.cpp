@@ -14,6 +14,7 @@
 #include <lyra/lyra.hpp>
 
 #include <opcreader.h>
+#include <tagserver.h>
 
 std::promise<void> g_exit_requested;
 
@@ -66,9 +67,15 @@ int main(int argc, char** argv) {
   bool show_help{false};
   std::string config_file;
   bool debug_messages{false};
+  std::string listen_address{"0.0.0.0:50051"};
+  std::size_t cq_threads{0};
+  bool allow_writes{false};
 
   auto cli = lyra::help(show_help) | lyra::opt(config_file, "config file")["-c"]["--config"]("config file").required() |
-             lyra::opt(debug_messages)["-d"]["--debug"]("show debug messages");
+             lyra::opt(debug_messages)["-d"]["--debug"]("show debug messages") |
+             lyra::opt(listen_address, "address")["-l"]["--listen"]("gRPC listen address, default 0.0.0.0:50051") |
+             lyra::opt(cq_threads, "threads")["-t"]["--threads"]("completion queue threads, default one per core") |
+             lyra::opt(allow_writes)["-w"]["--writes"]("accept WriteTags calls that write to the OPC server");
 
   auto parse_result = cli.parse({argc, argv});
   if (!parse_result) {
@@ -94,6 +101,23 @@ int main(int argc, char** argv) {
     return EXIT_FAILURE;
   }
 
+  tag_server server(reader.data_points(), cq_threads);
+  if (allow_writes) {
+    // the reader fails pending writes when its loop stops, so they are all done before the server stops
+    server.set_write_handler([&reader](std::vector<tag_write> writes, write_callback done) {
+      reader.write(std::move(writes), std::move(done));
+    });
+  }
+  if (!server.start(listen_address)) {
+    return EXIT_FAILURE;
+  }
+  reader.set_batch_handler([&server](sample_buffer const& samples) { server.publish(samples); });
+  // items added or removed by editing the config file reach the subscribers without a restart
+  reader.set_data_points_handler(
+    [&server](std::vector<opc_data_point> const& data_points, std::vector<std::uint32_t> const& changed) {
+      server.update_data_points(data_points, changed);
+    });
+
   std::thread reader_thread(&opc_reader::query_server, &reader);
 
   auto f = g_exit_requested.get_future();
@@ -104,5 +128,8 @@ int main(int argc, char** argv) {
   reader_thread.join();
   spdlog::info("reader thread stopped");
 
+  server.stop();
+  spdlog::info("grpc server stopped");
+
   return EXIT_SUCCESS;
 }
\ No newline at end of file
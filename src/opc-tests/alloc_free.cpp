@@ -0,0 +1,152 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+#include <opcreader.h>
+#include <simsource.h>
+
+namespace {
+
+// allocations made while counting is set, from any thread
+std::atomic<bool> counting{false};
+std::atomic<std::size_t> allocations{0};
+
+void* counted_alloc(std::size_t size) {
+  if (counting.load(std::memory_order_relaxed)) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (auto* p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+// runs body with the allocations counted, returns their number
+template <typename Body>
+std::size_t count_allocations(Body body) {
+  allocations = 0;
+  counting = true;
+  body();
+  counting = false;
+  return allocations.load();
+}
+
+// exposes the processing of a batch, which the query loop calls for every read
+class test_reader : public opc_reader {
+ public:
+  using opc_reader::opc_reader;
+  using opc_reader::process_samples;
+};
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+  return counted_alloc(size);
+}
+
+void* operator new[](std::size_t size) {
+  return counted_alloc(size);
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+// once the sample buffer is sized, reading the simulated tags and passing them through the change filter to the batch
+// handler must not allocate
+int main() {
+  constexpr int cycles = 50;
+  // a direct call cannot be elided, so it shows the replaced operator is in use
+  if (count_allocations([]() { ::operator delete(::operator new(64)); }) != 1) {
+    spdlog::error("alloc_free: allocations are not counted");
+    return 1;
+  }
+
+  auto ini_file = std::filesystem::temp_directory_path() / "opc-tests-alloc-free.json";
+  {
+    std::ofstream ofs(ini_file);
+    ofs << R"({
+  "hostname": "localhost",
+  "opcServerName": "simulation",
+  "mode": "poll",
+  "demoMode": true,
+  "reloadCheckMs": 0,
+  "changeFilter": {"enabled": true, "maxPublishMs": 1},
+  "simulation": {"tagCount": 10000, "changeRate": 0.5, "types": ["float", "int", "string"]},
+  "opcItems": [
+    {"name": "line.speed", "label": "line speed", "type": "float", "rateMs": 500,
+     "deadbandPercent": 1, "euLow": 0, "euHigh": 100}
+  ]
+})";
+  }
+
+  test_reader reader(ini_file.string());
+  if (!reader.init()) {
+    spdlog::error("alloc_free: reader did not start with {}", ini_file.string());
+    return 1;
+  }
+  std::size_t published = 0;
+  reader.set_batch_handler([&published](sample_buffer& samples) { published += samples.updated.size(); });
+
+  auto data_points = reader.data_points();
+  sim_source source(sim_config{}, 1000);
+  source.add_items(data_points);
+  sample_buffer samples;
+  samples.resize(data_points.size());
+
+  // the first cycle delivers every tag for the first time and sizes the strings
+  for (std::size_t group = 0; group < source.group_count(); group++) {
+    source.read(group, samples);
+    reader.process_samples(samples);
+  }
+
+  auto read_allocations = count_allocations([&]() {
+    for (int cycle = 0; cycle < cycles; cycle++) {
+      for (std::size_t group = 0; group < source.group_count(); group++) {
+        source.read(group, samples);
+      }
+    }
+  });
+
+  published = 0;
+  auto process_allocations = count_allocations([&]() {
+    for (int cycle = 0; cycle < cycles; cycle++) {
+      for (std::size_t group = 0; group < source.group_count(); group++) {
+        source.read(group, samples);
+        reader.process_samples(samples);
+      }
+    }
+  });
+  std::filesystem::remove(ini_file);
+
+  if (read_allocations != 0 || process_allocations != 0) {
+    spdlog::error("alloc_free: {} allocations by sim_source::read, {} with process_samples", read_allocations,
+                  process_allocations);
+    return 1;
+  }
+  if (published == 0) {
+    spdlog::error("alloc_free: no value passed the change filter");
+    return 1;
+  }
+  spdlog::info("alloc_free: {} cycles of {} tags without allocation, {} values published", cycles,
+               data_points.size(), published);
+  return 0;
+}
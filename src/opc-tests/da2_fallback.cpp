@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include <opcdasource.h>
+
+namespace {
+
+// OPC_E_UNKNOWNITEMID and OPC_E_BADRIGHTS of opcerror.h
+constexpr HRESULT unknown_item = static_cast<HRESULT>(0xC0040007L);
+constexpr HRESULT bad_rights = static_cast<HRESULT>(0xC0040006L);
+
+// items of the fake server, by name. A name it does not know is rejected by AddItems.
+struct fake_item {
+  std::wstring name;
+  VARTYPE type;
+  // the read of the item fails with bad_rights
+  bool fails_read;
+};
+
+std::vector<fake_item> const known_items{
+  {L"plc.speed", VT_R8, false},
+  {L"plc.recipe", VT_BSTR, false},
+  {L"plc.locked", VT_I4, true},
+};
+
+// a group of a DA 2.0 server. It refuses every DA 3.0 interface and records the reads it serves.
+class fake_group : public IOPCGroupStateMgt, public IOPCSyncIO, public IOPCAsyncIO2, public IOPCItemMgt {
+ public:
+  explicit fake_group(float t_deadband) : deadband(t_deadband) {}
+
+  STDMETHODIMP QueryInterface(REFIID iid, LPVOID* ppInterface) override {
+    if (ppInterface == NULL) {
+      return E_INVALIDARG;
+    }
+    if (iid == IID_IUnknown || iid == IID_IOPCGroupStateMgt) {
+      *ppInterface = static_cast<IOPCGroupStateMgt*>(this);
+    } else if (iid == IID_IOPCSyncIO) {
+      *ppInterface = static_cast<IOPCSyncIO*>(this);
+    } else if (iid == IID_IOPCAsyncIO2) {
+      *ppInterface = static_cast<IOPCAsyncIO2*>(this);
+    } else if (iid == IID_IOPCItemMgt) {
+      *ppInterface = static_cast<IOPCItemMgt*>(this);
+    } else {
+      refused.push_back(iid);
+      *ppInterface = NULL;
+      return E_NOINTERFACE;
+    }
+    AddRef();
+    return S_OK;
+  }
+
+  STDMETHODIMP_(ULONG) AddRef() override { return ++mRefCount; }
+
+  STDMETHODIMP_(ULONG) Release() override {
+    auto count = --mRefCount;
+    if (count == 0) {
+      delete this;
+    }
+    return count;
+  }
+
+  // IOPCGroupStateMgt, only SetState is used by the toolkit
+  STDMETHODIMP GetState(DWORD*, BOOL*, LPWSTR*, LONG*, FLOAT*, DWORD*, OPCHANDLE*, OPCHANDLE*) override {
+    return E_NOTIMPL;
+  }
+
+  STDMETHODIMP SetState(DWORD* pRequestedUpdateRate,
+                        DWORD* pRevisedUpdateRate,
+                        BOOL*,
+                        LONG*,
+                        FLOAT* pPercentDeadband,
+                        DWORD*,
+                        OPCHANDLE*) override {
+    if (pPercentDeadband != NULL) {
+      deadband = *pPercentDeadband;
+    }
+    if (pRevisedUpdateRate != NULL) {
+      *pRevisedUpdateRate = pRequestedUpdateRate != NULL ? *pRequestedUpdateRate : 0;
+    }
+    return S_OK;
+  }
+
+  STDMETHODIMP SetName(LPCWSTR) override { return E_NOTIMPL; }
+
+  STDMETHODIMP CloneGroup(LPCWSTR, REFIID, LPUNKNOWN*) override { return E_NOTIMPL; }
+
+  // IOPCSyncIO
+  STDMETHODIMP Read(OPCDATASOURCE dwSource,
+                    DWORD dwCount,
+                    OPCHANDLE* phServer,
+                    OPCITEMSTATE** ppItemValues,
+                    HRESULT** ppErrors) override {
+    reads.push_back(dwSource);
+    auto* values = static_cast<OPCITEMSTATE*>(::CoTaskMemAlloc(dwCount * sizeof(OPCITEMSTATE)));
+    auto* errors = static_cast<HRESULT*>(::CoTaskMemAlloc(dwCount * sizeof(HRESULT)));
+    FILETIME now;
+    ::GetSystemTimeAsFileTime(&now);
+    HRESULT result = S_OK;
+    for (DWORD i = 0; i < dwCount; i++) {
+      auto const& item = added[phServer[i]];
+      values[i].hClient = item.client_handle;
+      values[i].ftTimeStamp = now;
+      values[i].wQuality = OPC_QUALITY_GOOD;
+      values[i].wReserved = 0;
+      ::VariantInit(&values[i].vDataValue);
+      if (item.known->fails_read) {
+        errors[i] = bad_rights;
+        result = S_FALSE;
+        continue;
+      }
+      errors[i] = S_OK;
+      values[i].vDataValue.vt = item.known->type;
+      if (item.known->type == VT_BSTR) {
+        values[i].vDataValue.bstrVal = ::SysAllocString(L"recipe 7");
+      } else {
+        values[i].vDataValue.dblVal = 12.5;
+      }
+    }
+    *ppItemValues = values;
+    *ppErrors = errors;
+    return result;
+  }
+
+  STDMETHODIMP Write(DWORD, OPCHANDLE*, VARIANT*, HRESULT**) override { return E_NOTIMPL; }
+
+  // IOPCAsyncIO2, the test reads synchronously
+  STDMETHODIMP Read(DWORD, OPCHANDLE*, DWORD, DWORD*, HRESULT**) override { return E_NOTIMPL; }
+
+  STDMETHODIMP Write(DWORD, OPCHANDLE*, VARIANT*, DWORD, DWORD*, HRESULT**) override { return E_NOTIMPL; }
+
+  STDMETHODIMP Refresh2(OPCDATASOURCE, DWORD, DWORD*) override { return E_NOTIMPL; }
+
+  STDMETHODIMP Cancel2(DWORD) override { return E_NOTIMPL; }
+
+  STDMETHODIMP SetEnable(BOOL) override { return E_NOTIMPL; }
+
+  STDMETHODIMP GetEnable(BOOL*) override { return E_NOTIMPL; }
+
+  // IOPCItemMgt
+  STDMETHODIMP AddItems(DWORD dwCount,
+                        OPCITEMDEF* pItemArray,
+                        OPCITEMRESULT** ppAddResults,
+                        HRESULT** ppErrors) override {
+    auto* results = static_cast<OPCITEMRESULT*>(::CoTaskMemAlloc(dwCount * sizeof(OPCITEMRESULT)));
+    auto* errors = static_cast<HRESULT*>(::CoTaskMemAlloc(dwCount * sizeof(HRESULT)));
+    HRESULT result = S_OK;
+    for (DWORD i = 0; i < dwCount; i++) {
+      results[i] = OPCITEMRESULT{};
+      auto known = std::ranges::find(known_items, std::wstring(pItemArray[i].szItemID), &fake_item::name);
+      if (known == known_items.end()) {
+        errors[i] = unknown_item;
+        result = S_FALSE;
+        continue;
+      }
+      // the server handle is the position in added
+      results[i].hServer = static_cast<OPCHANDLE>(added.size());
+      results[i].vtCanonicalDataType = known->type;
+      results[i].dwAccessRights = OPC_READABLE;
+      added.push_back(added_item{&*known, pItemArray[i].hClient});
+      errors[i] = S_OK;
+    }
+    *ppAddResults = results;
+    *ppErrors = errors;
+    return result;
+  }
+
+  STDMETHODIMP ValidateItems(DWORD, OPCITEMDEF*, BOOL, OPCITEMRESULT**, HRESULT**) override { return E_NOTIMPL; }
+
+  STDMETHODIMP RemoveItems(DWORD dwCount, OPCHANDLE*, HRESULT** ppErrors) override {
+    auto* errors = static_cast<HRESULT*>(::CoTaskMemAlloc(dwCount * sizeof(HRESULT)));
+    std::fill(errors, errors + dwCount, S_OK);
+    *ppErrors = errors;
+    return S_OK;
+  }
+
+  STDMETHODIMP SetActiveState(DWORD, OPCHANDLE*, BOOL, HRESULT**) override { return E_NOTIMPL; }
+
+  STDMETHODIMP SetClientHandles(DWORD, OPCHANDLE*, OPCHANDLE*, HRESULT**) override { return E_NOTIMPL; }
+
+  STDMETHODIMP SetDatatypes(DWORD, OPCHANDLE*, VARTYPE*, HRESULT**) override { return E_NOTIMPL; }
+
+  STDMETHODIMP CreateEnumerator(REFIID, LPUNKNOWN*) override { return E_NOTIMPL; }
+
+  bool was_refused(IID const& iid) const { return std::ranges::find(refused, iid) != refused.end(); }
+
+  float deadband;
+  std::vector<IID> refused;
+  std::vector<OPCDATASOURCE> reads;
+
+ private:
+  struct added_item {
+    fake_item const* known;
+    OPCHANDLE client_handle;
+  };
+
+  ULONG mRefCount{0};
+  std::vector<added_item> added;
+};
+
+// a DA 2.0 server with one group at most, the group is kept for the checks of the test
+class fake_server : public IOPCServer, public IOPCBrowseServerAddressSpace, public IOPCItemProperties {
+ public:
+  ~fake_server() {
+    if (group != NULL) {
+      group->Release();
+    }
+  }
+
+  STDMETHODIMP QueryInterface(REFIID iid, LPVOID* ppInterface) override {
+    if (ppInterface == NULL) {
+      return E_INVALIDARG;
+    }
+    if (iid == IID_IUnknown || iid == IID_IOPCServer) {
+      *ppInterface = static_cast<IOPCServer*>(this);
+    } else if (iid == IID_IOPCBrowseServerAddressSpace) {
+      *ppInterface = static_cast<IOPCBrowseServerAddressSpace*>(this);
+    } else if (iid == IID_IOPCItemProperties) {
+      *ppInterface = static_cast<IOPCItemProperties*>(this);
+    } else {
+      *ppInterface = NULL;
+      return E_NOINTERFACE;
+    }
+    AddRef();
+    return S_OK;
+  }
+
+  STDMETHODIMP_(ULONG) AddRef() override { return ++mRefCount; }
+
+  STDMETHODIMP_(ULONG) Release() override {
+    auto count = --mRefCount;
+    if (count == 0) {
+      delete this;
+    }
+    return count;
+  }
+
+  // IOPCServer
+  STDMETHODIMP AddGroup(LPCWSTR,
+                        BOOL,
+                        DWORD dwRequestedUpdateRate,
+                        OPCHANDLE,
+                        LONG*,
+                        FLOAT* pPercentDeadband,
+                        DWORD,
+                        OPCHANDLE* phServerGroup,
+                        DWORD* pRevisedUpdateRate,
+                        REFIID riid,
+                        LPUNKNOWN* ppUnk) override {
+    if (group != NULL) {
+      return E_FAIL;
+    }
+    group = new fake_group(pPercentDeadband != NULL ? *pPercentDeadband : 0.0f);
+    group->AddRef();
+    *phServerGroup = 1;
+    *pRevisedUpdateRate = dwRequestedUpdateRate;
+    return group->QueryInterface(riid, reinterpret_cast<void**>(ppUnk));
+  }
+
+  STDMETHODIMP GetErrorString(HRESULT, LCID, LPWSTR*) override { return E_NOTIMPL; }
+
+  STDMETHODIMP GetGroupByName(LPCWSTR, REFIID, LPUNKNOWN*) override { return E_NOTIMPL; }
+
+  STDMETHODIMP GetStatus(OPCSERVERSTATUS** ppServerStatus) override {
+    auto* status = static_cast<OPCSERVERSTATUS*>(::CoTaskMemAlloc(sizeof(OPCSERVERSTATUS)));
+    *status = OPCSERVERSTATUS{};
+    status->dwServerState = OPC_STATUS_RUNNING;
+    status->wMajorVersion = 2;
+    *ppServerStatus = status;
+    return S_OK;
+  }
+
+  STDMETHODIMP RemoveGroup(OPCHANDLE, BOOL) override { return S_OK; }
+
+  STDMETHODIMP CreateGroupEnumerator(OPCENUMSCOPE, REFIID, LPUNKNOWN*) override { return E_NOTIMPL; }
+
+  // IOPCBrowseServerAddressSpace, the reader does not browse
+  STDMETHODIMP QueryOrganization(OPCNAMESPACETYPE*) override { return E_NOTIMPL; }
+
+  STDMETHODIMP ChangeBrowsePosition(OPCBROWSEDIRECTION, LPCWSTR) override { return E_NOTIMPL; }
+
+  STDMETHODIMP BrowseOPCItemIDs(OPCBROWSETYPE, LPCWSTR, VARTYPE, DWORD, LPENUMSTRING*) override { return E_NOTIMPL; }
+
+  STDMETHODIMP GetItemID(LPWSTR, LPWSTR*) override { return E_NOTIMPL; }
+
+  STDMETHODIMP BrowseAccessPaths(LPCWSTR, LPENUMSTRING*) override { return E_NOTIMPL; }
+
+  // IOPCItemProperties
+  STDMETHODIMP QueryAvailableProperties(LPWSTR, DWORD*, DWORD**, LPWSTR**, VARTYPE**) override { return E_NOTIMPL; }
+
+  STDMETHODIMP GetItemProperties(LPWSTR, DWORD, DWORD*, VARIANT**, HRESULT**) override { return E_NOTIMPL; }
+
+  STDMETHODIMP LookupItemIDs(LPWSTR, DWORD, DWORD*, LPWSTR**, HRESULT**) override { return E_NOTIMPL; }
+
+  fake_group* group{NULL};
+
+ private:
+  ULONG mRefCount{0};
+};
+
+int failures = 0;
+
+void check(bool condition, char const* what) {
+  if (!condition) {
+    spdlog::error("da2_fallback: {}", what);
+    failures++;
+  }
+}
+
+}  // namespace
+
+// a group configured with cacheVerify, item deadbands and sampling rates on a server that only implements DA 2.0:
+// the items work with the deadband and update rate of the group, reads go through IOPCSyncIO instead of ReadMaxAge
+int main() {
+  ATL::CComPtr<fake_server> server(new fake_server());
+
+  std::vector<opc_data_point> data_points(4);
+  data_points[0].name = "plc.speed";
+  data_points[0].dataType = opc_data_types::FLOAT;
+  data_points[0].server_deadband_percent = 5.0f;
+  data_points[1].name = "plc.recipe";
+  data_points[1].dataType = opc_data_types::STRING;
+  data_points[1].sampling_ms = 100;
+  data_points[2].name = "plc.locked";
+  data_points[2].dataType = opc_data_types::INT;
+  data_points[2].buffer_samples = true;
+  data_points[3].name = "plc.missing";
+  data_points[3].dataType = opc_data_types::FLOAT;
+
+  opc_da_config config;
+  config.reads.mode = group_read_mode::CACHE_VERIFY;
+  config.reads.verify_interval_ms = 60000;
+  opc_da_source source("fake DA 2.0 server", 1000, false, config);
+  if (!source.connect(ATL::CComPtr<IOPCServer>(server))) {
+    spdlog::error("da2_fallback: could not connect to the fake server");
+    return 1;
+  }
+
+  check(source.add_items(data_points) == 3, "the unknown item was not the only one rejected");
+  check(source.group_count() == 1 && server->group != NULL, "no group was created");
+  if (failures > 0) {
+    return 1;
+  }
+  auto& group = *server->group;
+  check(group.was_refused(IID_IOPCSyncIO2), "IOPCSyncIO2 was not asked for");
+  check(group.was_refused(IID_IOPCItemDeadbandMgt), "IOPCItemDeadbandMgt was not asked for");
+  check(group.was_refused(IID_IOPCItemSamplingMgt), "IOPCItemSamplingMgt was not asked for");
+  check(group.deadband == 0.0f, "the item deadband changed the deadband of the group");
+
+  sample_buffer samples;
+  samples.resize(data_points.size());
+  // the first read verifies the device, the next one within the verify interval takes the cache
+  check(source.read(0, samples), "the first read failed");
+  check(samples.read_from == read_source::DEVICE, "the first read did not go to the device");
+  check(source.read(0, samples), "the second read failed");
+  check(samples.read_from == read_source::CACHE, "the second read did not take the cache");
+  check(group.reads == std::vector<OPCDATASOURCE>{OPC_DS_DEVICE, OPC_DS_CACHE},
+        "the reads did not fall back to IOPCSyncIO::Read");
+
+  // the rejected item is not read, the failed read of an item is reported with its error
+  check(samples.updated == std::vector<std::uint32_t>{0, 1, 2}, "the wrong tags were read");
+  check(samples.numeric[0] == 12.5 && samples.error[0] == S_OK, "the value of plc.speed is wrong");
+  check(samples.quality[0] == OPC_QUALITY_GOOD, "the quality of plc.speed is wrong");
+  check(samples.text[1] == "recipe 7" && samples.error[1] == S_OK, "the value of plc.recipe is wrong");
+  check(samples.error[2] == bad_rights, "the read error of plc.locked was lost");
+  check(samples.error[3] == S_OK, "the rejected item got a read result");
+
+  source.disconnect();
+  if (failures > 0) {
+    return 1;
+  }
+  spdlog::info("da2_fallback: the DA 2.0 server was read with the settings of the group");
+  return 0;
+}
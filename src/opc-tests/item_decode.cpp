@@ -0,0 +1,157 @@
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include <itemdecode.h>
+#include <tagsource.h>
+
+namespace {
+
+constexpr std::uint16_t quality_good = 0xC0;
+constexpr std::uint16_t quality_bad_comm_failure = 0x18;
+constexpr std::int32_t error_failed = static_cast<std::int32_t>(0x80004005);  // E_FAIL
+
+// a value as a server sends it, standing in for a VARIANT
+struct fake_value {
+  double number{0};
+  std::string text;
+};
+
+void decode_fake_value(opc_data_types data_type, fake_value const& value, sample_buffer& samples, std::size_t index) {
+  if (data_type == opc_data_types::STRING) {
+    samples.text[index] = value.text;
+  } else {
+    samples.numeric[index] = value.number;
+  }
+}
+
+// timestamps in ms since the epoch, standing in for a FILETIME
+std::chrono::system_clock::time_point fake_time(std::int64_t ms) {
+  return std::chrono::system_clock::time_point(std::chrono::milliseconds(ms));
+}
+
+// receives data changes the way the toolkit does: the arrays of OnDataChange are listed by position, they are stored
+// by client handle in a table of all items and the handles written are kept in order
+class fake_data_callback {
+ public:
+  fake_data_callback(std::vector<std::size_t> t_vec_tag_index, std::vector<opc_data_types> t_vec_data_type,
+                     std::size_t tag_count, sample_callback t_callback)
+      : vec_tag_index(std::move(t_vec_tag_index)),
+        vec_data_type(std::move(t_vec_data_type)),
+        callback(std::move(t_callback)) {
+    auto item_count = vec_tag_index.size();
+    values.resize(item_count);
+    qualities.resize(item_count);
+    times.resize(item_count);
+    errors.resize(item_count);
+    samples.resize(tag_count);
+  }
+
+  void on_data_change(std::size_t count,
+                      std::uint32_t const* client_handles,
+                      fake_value const* item_values,
+                      std::uint16_t const* item_qualities,
+                      std::int64_t const* item_times,
+                      std::int32_t const* item_errors) {
+    updated.assign(client_handles, client_handles + count);
+    for (std::size_t i = 0; i < count; i++) {
+      auto handle = client_handles[i];
+      values[handle] = item_values[i];
+      qualities[handle] = item_qualities[i];
+      times[handle] = item_times[i];
+      errors[handle] = item_errors[i];
+    }
+    decode_item_samples(updated.size(), updated.data(), values.data(), qualities.data(), times.data(), errors.data(),
+                        vec_tag_index, vec_data_type, samples, decode_fake_value, fake_time);
+    if (!samples.updated.empty()) {
+      callback(samples);
+    }
+  }
+
+ private:
+  std::vector<std::size_t> vec_tag_index;
+  std::vector<opc_data_types> vec_data_type;
+  sample_callback callback;
+
+  std::vector<std::uint32_t> updated;
+  std::vector<fake_value> values;
+  std::vector<std::uint16_t> qualities;
+  std::vector<std::int64_t> times;
+  std::vector<std::int32_t> errors;
+  sample_buffer samples;
+};
+
+int failures = 0;
+
+void expect(std::string_view what, bool passed) {
+  if (!passed) {
+    spdlog::error("item_decode: wrong {}", what);
+    failures++;
+  }
+}
+
+}  // namespace
+
+// data changes of a group whose client handles do not follow the tag indices are stored at the tag of each handle,
+// with bad qualities and failed items passed on
+int main() {
+  // client handle 0 is tag 5, 1 is tag 2, 2 is tag 7 and 3 is tag 0
+  std::vector<std::size_t> vec_tag_index{5, 2, 7, 0};
+  std::vector<opc_data_types> vec_data_type{opc_data_types::FLOAT, opc_data_types::STRING, opc_data_types::INT,
+                                            opc_data_types::FLOAT};
+  std::vector<std::uint32_t> delivered;
+  sample_buffer last;
+  fake_data_callback handler(vec_tag_index, vec_data_type, 8, [&](sample_buffer& samples) {
+    delivered = samples.updated;
+    last = samples;
+  });
+
+  {
+    std::vector<std::uint32_t> handles{3, 0, 1, 2};
+    std::vector<fake_value> values{{1.5, ""}, {12.5, ""}, {0, "recipe 7"}, {42, ""}};
+    std::vector<std::uint16_t> qualities{quality_good, quality_good, quality_good, quality_good};
+    std::vector<std::int64_t> times{1000, 2000, 3000, 4000};
+    std::vector<std::int32_t> errors{0, 0, 0, 0};
+    handler.on_data_change(handles.size(), handles.data(), values.data(), qualities.data(), times.data(),
+                           errors.data());
+  }
+  expect("first updated", delivered == std::vector<std::uint32_t>{0, 5, 2, 7});
+  expect("numeric of tag 5", last.numeric[5] == 12.5);
+  expect("numeric of tag 0", last.numeric[0] == 1.5);
+  expect("numeric of tag 7", last.numeric[7] == 42.0);
+  expect("text of tag 2", last.text[2] == std::string("recipe 7"));
+  expect("timestamp of tag 7", last.timestamp[7] == fake_time(4000));
+
+  // handle 0 turns bad but still carries a value, handle 2 fails and keeps its last value
+  {
+    std::vector<std::uint32_t> handles{2, 0};
+    std::vector<fake_value> values{{99, ""}, {13.0, ""}};
+    std::vector<std::uint16_t> qualities{quality_good, quality_bad_comm_failure};
+    std::vector<std::int64_t> times{9000, 5000};
+    std::vector<std::int32_t> errors{error_failed, 0};
+    handler.on_data_change(handles.size(), handles.data(), values.data(), qualities.data(), times.data(),
+                           errors.data());
+  }
+  expect("second updated", delivered == std::vector<std::uint32_t>{7, 5});
+  expect("numeric of bad tag 5", last.numeric[5] == 13.0);
+  expect("quality of bad tag 5", last.quality[5] == quality_bad_comm_failure);
+  expect("error of bad tag 5", last.error[5] == std::int32_t{0});
+  expect("timestamp of bad tag 5", last.timestamp[5] == fake_time(5000));
+  expect("numeric of failed tag 7", last.numeric[7] == 42.0);
+  expect("error of failed tag 7", last.error[7] == error_failed);
+  expect("timestamp of failed tag 7", last.timestamp[7] == fake_time(4000));
+  // tags of other handles are left alone
+  expect("numeric of tag 0", last.numeric[0] == 1.5);
+  expect("quality of tag 2", last.quality[2] == quality_good);
+
+  if (failures != 0) {
+    return 1;
+  }
+  spdlog::info("item_decode: data changes decoded by client handle");
+  return 0;
+}
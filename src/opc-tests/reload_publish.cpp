@@ -0,0 +1,116 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <spdlog/spdlog.h>
+
+#include <tagserver.h>
+
+// publishes a batch of all tags per round while reloads replace the subscription of the subscriber. After every round
+// the subscriber has to hold the value of that round for each tag, a batch dropped by a reload is never repeated.
+int main() {
+  // a reload logs, which would slow down the reloads
+  spdlog::set_level(spdlog::level::warn);
+  constexpr std::size_t tag_count = 1000;
+  constexpr int rounds = 1000;
+  std::vector<opc_data_point> data_points(tag_count);
+  for (std::size_t i = 0; i < tag_count; i++) {
+    data_points[i].name = fmt::format("tag.{}", i);
+    data_points[i].dataType = opc_data_types::FLOAT;
+  }
+
+  tag_server server(data_points, 2);
+  if (!server.start("")) {
+    spdlog::error("reload_publish: server did not start");
+    return 1;
+  }
+  auto stub = grpcopc::TagService::NewStub(server.in_process_channel());
+
+  // latest value received for every tag, all tags are floats without errors so the values line up with the ids
+  std::mutex received_mutex;
+  std::condition_variable received_cv;
+  std::vector<double> received(tag_count, -1.0);
+  grpc::ClientContext ctx;
+  auto reader = stub->Subscribe(&ctx, grpcopc::SubscribeRequest());
+  std::thread client_thread([&]() {
+    grpcopc::TagStream message;
+    while (reader->Read(&message)) {
+      if (!message.has_batch()) {
+        continue;
+      }
+      auto const& batch = message.batch();
+      std::lock_guard lock(received_mutex);
+      for (int k = 0; k < batch.ids_size() && k < batch.float_values_size(); k++) {
+        if (batch.ids(k) < tag_count) {
+          received[batch.ids(k)] = batch.float_values(k);
+        }
+      }
+      received_cv.notify_all();
+    }
+  });
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+  while (server.subscriber_count() < 1 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // every reload relabels tag 0, which compiles the subscription again
+  std::atomic<bool> publishing{true};
+  std::atomic<std::size_t> reloads{0};
+  std::thread reload_thread([&]() {
+    auto reloaded = data_points;
+    while (publishing.load()) {
+      reloaded[0].label = fmt::format("reload {}", reloads.load());
+      server.update_data_points(reloaded, {0});
+      reloads++;
+    }
+  });
+
+  sample_buffer samples;
+  samples.resize(tag_count);
+  int failed_round = -1;
+  std::size_t missing = 0;
+  for (int round = 0; round < rounds && failed_round < 0; round++) {
+    samples.updated.clear();
+    for (std::size_t i = 0; i < tag_count; i++) {
+      samples.numeric[i] = round;
+      samples.quality[i] = 0xC0;
+      samples.timestamp[i] = std::chrono::system_clock::now();
+      samples.updated.push_back(static_cast<std::uint32_t>(i));
+    }
+    server.publish(samples);
+
+    std::unique_lock lock(received_mutex);
+    auto round_done = [&]() {
+      missing = 0;
+      for (auto value : received) {
+        missing += value != round ? 1 : 0;
+      }
+      return missing == 0;
+    };
+    if (!received_cv.wait_for(lock, std::chrono::seconds(5), round_done)) {
+      failed_round = round;
+    }
+  }
+  publishing = false;
+  reload_thread.join();
+
+  server.stop();
+  client_thread.join();
+  reader->Finish();
+
+  if (failed_round >= 0) {
+    spdlog::error("reload_publish: {} of {} tags missing the value of round {} after {} reloads", missing, tag_count,
+                  failed_round, reloads.load());
+    return 1;
+  }
+  spdlog::warn("reload_publish: {} rounds of {} tags received during {} reloads", rounds, tag_count, reloads.load());
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include <opcreader.h>
+
+// a subscription to a server that drops out publishes the loss as a bad quality with a failed error, so the values of
+// the reader's own buffer, which data changes never fill, do not reach clients as real values
+int main() {
+  constexpr std::uint16_t quality_comm_failure = 0x18;
+
+  auto ini_file = std::filesystem::temp_directory_path() / "opc-tests-subscribe-outage.json";
+  {
+    std::ofstream ofs(ini_file);
+    ofs << R"({
+  "hostname": "localhost",
+  "opcServerName": "simulation",
+  "mode": "subscribe",
+  "demoMode": true,
+  "reloadCheckMs": 0,
+  "retryIntervalMs": 100,
+  "retryMaxMs": 500,
+  "watchdogTimeoutMs": 200,
+  "simulation": {"tagCount": 100, "changeRate": 0.2, "outageIntervalMs": 1500, "outageMs": 500},
+  "opcItems": [
+    {"name": "line.speed", "label": "line speed", "type": "float", "rateMs": 100}
+  ]
+})";
+  }
+
+  opc_reader reader(ini_file.string());
+  if (!reader.init()) {
+    spdlog::error("subscribe_outage: reader did not start with {}", ini_file.string());
+    return 1;
+  }
+  std::mutex mutex;
+  std::size_t loss_values = 0;
+  std::size_t loss_values_with_value = 0;
+  std::size_t values_after_loss = 0;
+  reader.set_batch_handler([&](sample_buffer& samples) {
+    std::lock_guard lock(mutex);
+    for (auto index : samples.updated) {
+      if (samples.quality[index] == quality_comm_failure) {
+        loss_values++;
+        // the codec and the snapshot publish a value unless the error failed
+        if (samples.error[index] >= 0) {
+          loss_values_with_value++;
+        }
+      } else if (loss_values > 0) {
+        values_after_loss++;
+      }
+    }
+  });
+
+  std::thread query(&opc_reader::query_server, &reader);
+  std::this_thread::sleep_for(std::chrono::milliseconds(3000));
+  reader.stop_query();
+  query.join();
+  std::filesystem::remove(ini_file);
+
+  if (loss_values == 0) {
+    spdlog::error("subscribe_outage: no connection loss was published");
+    return 1;
+  }
+  if (loss_values_with_value != 0) {
+    spdlog::error("subscribe_outage: {} of {} values of the connection loss carry a value", loss_values_with_value,
+                  loss_values);
+    return 1;
+  }
+  if (values_after_loss == 0) {
+    spdlog::error("subscribe_outage: no data after the connection came back");
+    return 1;
+  }
+  spdlog::info("subscribe_outage: {} stale values without a value, {} values after the reconnect", loss_values,
+               values_after_loss);
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include <opcreader.h>
+
+// a subscription to tags that never change gets no data change after the first values, the reader still publishes
+// them again every max_publish_ms
+int main() {
+  constexpr int max_publish_ms = 200;
+  constexpr int run_ms = 1600;
+  // the first value and at least half of the republishes, to leave room for a slow machine
+  constexpr int least_publishes = 1 + run_ms / max_publish_ms / 2;
+
+  auto ini_file = std::filesystem::temp_directory_path() / "opc-tests-subscribe-republish.json";
+  {
+    std::ofstream ofs(ini_file);
+    ofs << R"({
+  "hostname": "localhost",
+  "opcServerName": "simulation",
+  "mode": "subscribe",
+  "demoMode": true,
+  "reloadCheckMs": 0,
+  "changeFilter": {"enabled": true, "maxPublishMs": )"
+        << max_publish_ms << R"(},
+  "simulation": {"tagCount": 100, "changeRate": 0.0},
+  "opcItems": [
+    {"name": "line.speed", "label": "line speed", "type": "float", "rateMs": 100}
+  ]
+})";
+  }
+
+  opc_reader reader(ini_file.string());
+  if (!reader.init()) {
+    spdlog::error("subscribe_republish: reader did not start with {}", ini_file.string());
+    return 1;
+  }
+  std::mutex mutex;
+  std::map<std::uint32_t, int> publishes;
+  reader.set_batch_handler([&](sample_buffer& samples) {
+    std::lock_guard lock(mutex);
+    for (auto index : samples.updated) {
+      publishes[index]++;
+    }
+  });
+
+  std::thread query(&opc_reader::query_server, &reader);
+  std::this_thread::sleep_for(std::chrono::milliseconds(run_ms));
+  reader.stop_query();
+  query.join();
+  std::filesystem::remove(ini_file);
+
+  auto tag_count = reader.data_points().size();
+  if (publishes.size() != tag_count) {
+    spdlog::error("subscribe_republish: {} of {} tags published", publishes.size(), tag_count);
+    return 1;
+  }
+  for (auto [index, count] : publishes) {
+    if (count < least_publishes) {
+      spdlog::error("subscribe_republish: tag {} published {} times in {} ms, expected at least {}", index, count,
+                    run_ms, least_publishes);
+      return 1;
+    }
+  }
+  spdlog::info("subscribe_republish: {} unchanged tags republished", tag_count);
+  return 0;
+}